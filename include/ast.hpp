@@ -1,7 +1,11 @@
 #pragma once
 
+#include <cstdint>
+#include <iostream>
 #include <list>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <boost/spirit/home/x3/support/ast/variant.hpp>
 #include <boost/foreach.hpp>
 
@@ -10,24 +14,93 @@ typedef unsigned int uint;
 namespace ast {
     namespace x3 = boost::spirit::x3;
     struct nil {};
+
+    // Identifiers a rule may use, by slot. Gettext only defines `n`.
+    constexpr char const* variable_names[] = {"n"};
+    constexpr std::size_t variable_count =
+        sizeof(variable_names) / sizeof(variable_names[0]);
+
+    struct variable {
+        std::uint32_t slot;
+    };
+
+    // Sets `slot` to the slot of identifier `name`, if it is known.
+    constexpr bool
+    find_variable(std::string_view name, std::uint32_t& slot) {
+        for (std::size_t idx = 0; idx < variable_count; ++idx) {
+            if (name == variable_names[idx]) {
+                slot = idx;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // What the parsers report they expected instead of an unknown name.
+    inline std::string
+    expected_variable() {
+        std::string which{"variable"};
+        for (char const* name : variable_names) {
+            which += std::string(" ") + name;
+        }
+        return which;
+    }
     struct binary_op;
     struct conditional_op;
     struct expression;
 
+    enum class optoken : std::uint8_t {
+        mod,
+        logical_and,
+        logical_or,
+        less,
+        less_equal,
+        greater,
+        greater_equal,
+        equal,
+        not_equal,
+    };
+
     struct binary_operator {
-        std::string name;
-        std::function<uint(uint, uint)> op;
+        optoken code;
+
+        constexpr char const*
+        name() const {
+            switch (code) {
+            case optoken::mod: return "%";
+            case optoken::logical_and: return "&&";
+            case optoken::logical_or: return "||";
+            case optoken::less: return "<";
+            case optoken::less_equal: return "<=";
+            case optoken::greater: return ">";
+            case optoken::greater_equal: return ">=";
+            case optoken::equal: return "==";
+            case optoken::not_equal: return "!=";
+            }
+            return "?";
+        }
 
-        uint
+        constexpr uint
         operator()(uint lhs, uint rhs) const {
-            return op(lhs, rhs);
+            switch (code) {
+            case optoken::mod: return rhs ? lhs % rhs : 0;
+            case optoken::logical_and: return lhs && rhs;
+            case optoken::logical_or: return lhs || rhs;
+            case optoken::less: return lhs < rhs;
+            case optoken::less_equal: return lhs <= rhs;
+            case optoken::greater: return lhs > rhs;
+            case optoken::greater_equal: return lhs >= rhs;
+            case optoken::equal: return lhs == rhs;
+            case optoken::not_equal: return lhs != rhs;
+            }
+            return 0;
         }
     };
 
     struct operand : x3::variant<
                          nil,
                          uint,
-                         std::string,
+                         variable,
                          x3::forward_ast<binary_op>,
                          x3::forward_ast<conditional_op>,
                          x3::forward_ast<expression>> {
@@ -60,6 +133,9 @@ namespace ast {
     struct printer {
         typedef void result_type;
 
+        printer(std::ostream& out = std::cout) : out(out) {}
+        std::ostream& out;
+
         result_type
         operator()(operand const& ast) const {
             boost::apply_visitor(*this, ast.get());
@@ -71,56 +147,64 @@ namespace ast {
         result_type
         operator()(expression const& ast) const {
             if (ast.rhs.size() > 0) {
-                std::cout << '(';
+                out << '(';
             }
             boost::apply_visitor(*this, ast.lhs);
             BOOST_FOREACH (operation const& op, ast.rhs) { (*this)(op); }
             if (ast.rhs.size() > 0) {
-                std::cout << ')';
+                out << ')';
             }
         }
 
         result_type
         operator()(operation const& ast) const {
-            std::cout << ' ' << ast.op.name << ' ';
+            out << ' ' << ast.op.name() << ' ';
             boost::apply_visitor(*this, ast.rhs);
         }
 
         result_type
         operator()(binary_op const& ast) const {
-            std::cout << '(';
+            out << '(';
             boost::apply_visitor(*this, ast.lhs);
+            out << ' ' << ast.op.name() << ' ';
             boost::apply_visitor(*this, ast.rhs);
-            std::cout << ')';
+            out << ')';
         }
 
         result_type
         operator()(conditional_op const& ast) const {
-            std::cout << '(';
+            out << '(';
             boost::apply_visitor(*this, ast.lhs);
-            std::cout << " ? ";
+            out << " ? ";
             boost::apply_visitor(*this, ast.rhs_true);
-            std::cout << " : ";
+            out << " : ";
             boost::apply_visitor(*this, ast.rhs_false);
-            std::cout << ')';
+            out << ')';
         }
 
         result_type
         operator()(uint const& ast) const {
-            std::cout << ast;
+            out << ast;
         }
 
         result_type
-        operator()(std::string const& ast) const {
-            std::cout << ast;
+        operator()(variable const& ast) const {
+            out << variable_names[ast.slot];
         }
     };
 
+    inline std::string
+    to_string(operand const& ast) {
+        std::ostringstream out;
+        printer{out}(ast);
+        return out.str();
+    }
+
     struct evaluator {
         typedef uint result_type;
 
-        evaluator(const result_type variable) : variable(variable) {}
-        result_type variable;
+        evaluator(const result_type n) : variables{n} {}
+        result_type variables[variable_count];
 
         result_type
         operator()(operand const& ast) const {
@@ -170,8 +254,8 @@ namespace ast {
         }
 
         result_type
-        operator()(std::string const& ast) const {
-            return variable;
+        operator()(variable const& ast) const {
+            return variables[ast.slot];
         }
     };
 
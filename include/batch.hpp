@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace client {
+typedef unsigned int uint;
+namespace ast {
+    struct operand;
+} // namespace ast
+
+namespace batch {
+    // A straight-line, branch-free form of a rule. Every instruction writes
+    // the register with its own index; conditionals evaluate both branches
+    // and pick one with `select`, so all lanes run the same code.
+    enum class opcode : std::uint8_t {
+        constant,      // a = value
+        variable,      //
+        mod_const,     // a = register, b = divisor index
+        mod,           // a, b = registers
+        logical_and,   // a, b = registers
+        logical_or,    // a, b = registers
+        less,          // a, b = registers
+        less_equal,    // a, b = registers
+        greater,       // a, b = registers
+        greater_equal, // a, b = registers
+        equal,         // a, b = registers
+        not_equal,     // a, b = registers
+        select,        // a = condition, b = if true, c = if false
+    };
+
+    struct instruction {
+        opcode op;
+        uint a;
+        uint b;
+        uint c;
+    };
+
+    // Division by an invariant integer using a 32-bit multiply-high, in the
+    // branch-free form described by libdivide: q = (((n - t) >> 1) + t) >>
+    // shift with t = mulhi(magic, n). Only 32-bit lane multiplies are
+    // needed, which SSE4.1 and AVX2 provide.
+    struct divisor32 {
+        uint value;
+        uint magic;
+        uint shift;
+    };
+
+    // `value` must be at least 2; `% 1` is compiled to a constant.
+    divisor32
+    make_divisor32(uint value);
+
+    // Maximum number of registers, i.e. distinct subexpressions, a batch
+    // program may use.
+    constexpr std::size_t max_registers = 256;
+
+    struct program {
+        std::vector<instruction> code;
+        std::vector<divisor32> divisors;
+    };
+
+    bool
+    compile(ast::operand const& ast, program& out, std::string& error);
+
+    enum class isa { scalar, sse4, avx2, best };
+
+    char const*
+    isa_name(isa target);
+
+    // The widest instruction set supported by the running CPU.
+    isa
+    detect_isa();
+
+    // Evaluates the rule for `count` values of n. Results are saturated to
+    // 255 so that each fits in one category byte.
+    void
+    evaluate(
+        program const& prog,
+        uint const* ns,
+        std::uint8_t* out,
+        std::size_t count,
+        isa target = isa::best);
+
+    // Per-ISA kernels; see batch_kernel.hpp.
+    void
+    evaluate_scalar(
+        instruction const* code,
+        std::size_t size,
+        divisor32 const* divisors,
+        uint const* ns,
+        std::uint8_t* out,
+        std::size_t count);
+
+    void
+    evaluate_sse4(
+        instruction const* code,
+        std::size_t size,
+        divisor32 const* divisors,
+        uint const* ns,
+        std::uint8_t* out,
+        std::size_t count);
+
+    void
+    evaluate_avx2(
+        instruction const* code,
+        std::size_t size,
+        divisor32 const* divisors,
+        uint const* ns,
+        std::uint8_t* out,
+        std::size_t count);
+
+} // namespace batch
+} // namespace client
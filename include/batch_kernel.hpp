@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "batch.hpp"
+
+// The batch kernel is written once against a small set of lane-wise
+// primitives and instantiated per instruction set. Each kernel translation
+// unit is compiled with its own -m flags, so everything here has internal
+// linkage to keep wide instructions from leaking into another unit.
+
+namespace client {
+namespace batch {
+    namespace {
+        // Vectors processed per instruction; amortizes dispatch.
+        constexpr std::size_t tile = 4;
+
+        template <typename V>
+        inline typename V::vector
+        remainder(
+            typename V::vector n,
+            typename V::vector magic,
+            typename V::vector value,
+            uint shift) {
+            const typename V::vector q{V::mulhi(n, magic)};
+            const typename V::vector t{
+                V::add(V::shift_right(V::sub(n, q), 1), q)};
+            return V::sub(n, V::mullo(V::shift_right(t, shift), value));
+        }
+
+        template <typename V>
+        inline typename V::vector
+        boolean(typename V::vector mask) {
+            return V::bit_and(mask, V::set1(1));
+        }
+
+        template <typename V>
+        inline typename V::vector
+        negated(typename V::vector mask) {
+            return V::bit_andnot(mask, V::set1(1));
+        }
+
+        template <typename V>
+        void
+        run(instruction const* code,
+            std::size_t size,
+            divisor32 const* divisors,
+            uint const* ns,
+            std::uint8_t* out,
+            std::size_t count) {
+            typedef typename V::vector vector;
+            constexpr std::size_t lanes{V::width * tile};
+
+            vector regs[max_registers][tile];
+            uint padded[lanes];
+            std::uint8_t bytes[lanes];
+            const vector zero{V::set1(0)};
+
+            for (std::size_t base = 0; base < count; base += lanes) {
+                const std::size_t chunk{std::min(lanes, count - base)};
+                uint const* src = ns + base;
+                if (chunk < lanes) {
+                    std::fill(std::copy(src, src + chunk, padded),
+                              padded + lanes,
+                              0);
+                    src = padded;
+                }
+
+                for (std::size_t idx = 0; idx < size; ++idx) {
+                    instruction const& ins = code[idx];
+                    vector* dst = regs[idx];
+
+                    if (ins.op == opcode::constant) {
+                        const vector value{V::set1(ins.a)};
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = value;
+                        }
+                        continue;
+                    }
+                    if (ins.op == opcode::variable) {
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = V::load(src + t * V::width);
+                        }
+                        continue;
+                    }
+
+                    // Operands always refer to earlier registers.
+                    vector const* a = regs[ins.a];
+                    vector const* b = regs[ins.b];
+                    vector const* c = regs[ins.c];
+
+                    switch (ins.op) {
+                    case opcode::constant:
+                    case opcode::variable: break;
+                    case opcode::mod_const: {
+                        divisor32 const& d = divisors[ins.b];
+                        const vector magic{V::set1(d.magic)};
+                        const vector value{V::set1(d.value)};
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = remainder<V>(a[t], magic, value, d.shift);
+                        }
+                        break;
+                    }
+                    case opcode::mod:
+                        // No lane-wise integer division exists; spill.
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            uint lhs[V::width];
+                            uint rhs[V::width];
+                            V::store(lhs, a[t]);
+                            V::store(rhs, b[t]);
+                            for (std::size_t lane = 0; lane < V::width;
+                                 ++lane) {
+                                lhs[lane] =
+                                    rhs[lane] ? lhs[lane] % rhs[lane] : 0;
+                            }
+                            dst[t] = V::load(lhs);
+                        }
+                        break;
+                    case opcode::logical_and:
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = negated<V>(V::bit_or(
+                                V::equal(a[t], zero), V::equal(b[t], zero)));
+                        }
+                        break;
+                    case opcode::logical_or:
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = negated<V>(V::bit_and(
+                                V::equal(a[t], zero), V::equal(b[t], zero)));
+                        }
+                        break;
+                    case opcode::less:
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = negated<V>(
+                                V::equal(V::max(a[t], b[t]), a[t]));
+                        }
+                        break;
+                    case opcode::less_equal:
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = boolean<V>(
+                                V::equal(V::min(a[t], b[t]), a[t]));
+                        }
+                        break;
+                    case opcode::greater:
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = negated<V>(
+                                V::equal(V::min(a[t], b[t]), a[t]));
+                        }
+                        break;
+                    case opcode::greater_equal:
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = boolean<V>(
+                                V::equal(V::max(a[t], b[t]), a[t]));
+                        }
+                        break;
+                    case opcode::equal:
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = boolean<V>(V::equal(a[t], b[t]));
+                        }
+                        break;
+                    case opcode::not_equal:
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = negated<V>(V::equal(a[t], b[t]));
+                        }
+                        break;
+                    case opcode::select:
+                        for (std::size_t t = 0; t < tile; ++t) {
+                            dst[t] = V::blend(V::equal(a[t], zero), b[t], c[t]);
+                        }
+                        break;
+                    }
+                }
+
+                vector const* result = regs[size - 1];
+                if (chunk == lanes) {
+                    V::pack(result, out + base);
+                } else {
+                    V::pack(result, bytes);
+                    std::memcpy(out + base, bytes, chunk);
+                }
+            }
+        }
+
+        // One 32-bit lane; the portable fallback, and the reference that the
+        // SSE4.1 and AVX2 primitives mirror.
+        struct scalar_lanes {
+            typedef uint vector;
+            static constexpr std::size_t width = 1;
+
+            static vector
+            load(uint const* src) {
+                return *src;
+            }
+
+            static void
+            store(uint* dst, vector v) {
+                *dst = v;
+            }
+
+            static vector
+            set1(uint v) {
+                return v;
+            }
+
+            static vector
+            add(vector a, vector b) {
+                return a + b;
+            }
+
+            static vector
+            sub(vector a, vector b) {
+                return a - b;
+            }
+
+            static vector
+            shift_right(vector a, uint s) {
+                return a >> s;
+            }
+
+            static vector
+            mullo(vector a, vector b) {
+                return a * b;
+            }
+
+            static vector
+            min(vector a, vector b) {
+                return std::min(a, b);
+            }
+
+            static vector
+            max(vector a, vector b) {
+                return std::max(a, b);
+            }
+
+            static vector
+            bit_and(vector a, vector b) {
+                return a & b;
+            }
+
+            static vector
+            bit_or(vector a, vector b) {
+                return a | b;
+            }
+
+            static vector
+            bit_andnot(vector a, vector b) {
+                return ~a & b;
+            }
+
+
+            static vector
+            mulhi(vector a, vector b) {
+                return (std::uint64_t{a} * b) >> 32;
+            }
+
+            static vector
+            equal(vector a, vector b) {
+                return a == b ? ~0u : 0u;
+            }
+
+            // Picks `if_true` where `is_false` is clear.
+            static vector
+            blend(vector is_false, vector if_true, vector if_false) {
+                return is_false ? if_false : if_true;
+            }
+
+            static void
+            pack(vector const* v, std::uint8_t* out) {
+                for (std::size_t t = 0; t < tile; ++t) {
+                    out[t] = std::min(v[t], 255u);
+                }
+            }
+        };
+
+    } // namespace
+} // namespace batch
+} // namespace client
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "compiled_rule.hpp"
+
+// A process-wide cache of compiled rules keyed by their text.
+//
+// Each thread keeps a small direct-mapped table of the rules it used last,
+// so a repeated evaluate() takes no lock and performs no atomic read-modify-
+// write; lookup() only adds the reference count of the shared_ptr it
+// returns. Misses fall through to a shared LRU list, guarded by a mutex and
+// bounded by `capacity`; only a miss there parses and compiles the rule.
+// An evicted rule stays alive while a thread's table or a caller still
+// holds it, so at most capacity + threads * front_size rules are resident.
+//
+// Rules are also hash-consed by their canonical form (canonical.hpp): a
+// text that misses is parsed first, and if an equivalent text is cached,
+// the new one shares its compiled rule instead of compiling another. The
+// rule's text() is then the spelling it was first compiled from.
+
+namespace client {
+namespace cache {
+    constexpr std::size_t default_capacity = 1024;
+    constexpr std::size_t front_size = 64;
+
+    struct statistics {
+        std::uint64_t hits = 0;      // served without compiling
+        std::uint64_t misses = 0;    // compiled
+        std::uint64_t evictions = 0;
+        std::uint64_t shared = 0;    // hits served by an equivalent text
+        std::size_t size = 0;        // texts in the shared list
+        std::size_t programs = 0;    // distinct rules they hold
+        std::size_t capacity = 0;
+
+        // Texts per rule in the shared list: 1 without any sharing.
+        double
+        dedup_ratio() const {
+            return programs ? static_cast<double>(size) / programs : 1;
+        }
+    };
+
+    // The rule compiled for the automatic engine, or nullptr with `error`
+    // set if `text` does not compile. Failures are not cached.
+    std::shared_ptr<compiled_rule const>
+    lookup(std::string const& text, std::string& error);
+
+    // Evaluates the cached rule for `text` without taking a reference.
+    bool
+    evaluate(
+        std::string const& text, uint n, uint& result, std::string& error);
+
+    // Changes the bound on the shared list, evicting the least recently
+    // used rules if it shrinks.
+    void
+    set_capacity(std::size_t capacity);
+
+    // Counters summed over all threads, including ones that have exited.
+    statistics
+    stats();
+
+} // namespace cache
+} // namespace client
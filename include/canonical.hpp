@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "ast.hpp"
+
+// A canonical form for rules that are equivalent up to spelling.
+//
+// Operations associate as if nested to the left, so parentheses and
+// whitespace leave no trace. The operands of `==` and `!=` are put in a
+// fixed order, `<` and `>` (and `<=`, `>=`) are mirrored to match, and
+// chains of `&&` or `||` are flattened and their operands sorted. Rules
+// that differ only by these rewrites have the same canonical form and so
+// the same key. Chains are keyed in a loop, however long they are.
+//
+// Reordering `&&` and `||` is sound because their operands have no side
+// effects and `% 0` yields 0; only which divisions by zero are reached,
+// which range::analyze reports, may differ between two spellings.
+
+namespace client {
+namespace canonical {
+    // Rewrites `ast` into canonical form and returns its key: a prefix
+    // serialization of the canonical tree. Keys are equal exactly when the
+    // canonical trees are, and order operands by kind first, so constants
+    // end up on the right of a comparison: `1 == n` becomes `n == 1`.
+    // The tree nests wherever an operand moves in front of a chain, which
+    // `n == 1 == n % 7 == n % 7` does at every link, so it is meant for
+    // printing short rules; key() does not build it.
+    std::string
+    canonicalize(ast::operand& ast);
+
+    // The key of the canonical form of `ast`, leaving `ast` as it is.
+    std::string
+    key(ast::operand const& ast);
+
+    // FNV-1a over a key. It depends only on the bytes of the key, so it is
+    // the same in every process and on every platform.
+    std::uint64_t
+    hash(std::string_view key);
+
+} // namespace canonical
+} // namespace client
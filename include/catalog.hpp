@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compiled_rule.hpp"
+
+// Reading the Plural-Forms header of Gettext catalogs.
+//
+// A .mo file is mapped into memory and its header entry, the translation of
+// the empty msgid, is found through the string tables in place. A .po file
+// is mapped and scanned for the first entry instead; only that entry's
+// msgstr is unescaped into a string. Rules are compiled through the cache,
+// so a directory of catalogs sharing a handful of rules compiles each once,
+// however differently the catalogs spell them.
+
+namespace client {
+namespace catalog {
+    // What gettext uses for a catalog whose header has no Plural-Forms.
+    constexpr std::uint32_t default_nplurals = 2;
+    constexpr std::string_view default_plural{"n != 1"};
+
+    // Finds the Plural-Forms field in a catalog header, the text of the
+    // header entry, and its nplurals and plural values. `plural` points
+    // into `header`, trimmed of spaces and the trailing ';'. Without the
+    // field, the gettext defaults are returned and `defaulted` is set.
+    bool
+    find_plural_forms(
+        std::string_view header,
+        std::uint32_t& nplurals,
+        std::string_view& plural,
+        bool& defaulted,
+        std::string& error);
+
+    // The header entry of a .mo image in either byte order, pointing into
+    // `image`.
+    bool
+    mo_header(
+        std::string_view image, std::string_view& header, std::string& error);
+
+    // The header entry of a .po file: the msgstr of the first message,
+    // which must have an empty msgid and no msgctxt.
+    bool
+    po_header(std::string_view text, std::string& header, std::string& error);
+
+    struct entry {
+        std::string path;
+        std::uint32_t nplurals = 0;
+        std::string plural;
+        bool defaulted = false; // no Plural-Forms in the header
+        std::shared_ptr<compiled_rule const> rule;
+        std::string error;
+        double seconds = 0; // mapping, extracting and compiling
+    };
+
+    // Loads the Plural-Forms of the .mo or .po file at `out.path`, which
+    // is told apart by its extension.
+    bool
+    load(entry& out);
+
+    struct options {
+        std::vector<std::string> paths; // files or directories
+        std::size_t threads = 0;        // 0: one per hardware thread
+        bool quiet = false;             // only print the summary
+    };
+
+    // Loads every .mo and .po file named or found under a directory in
+    // `config.paths` on a pool of threads, then prints one line per file
+    // with its time and a summary counting the distinct plural texts and
+    // distinct rules, which are told apart by their canonical form. Fails
+    // if any file fails to load.
+    bool
+    run(options const& config);
+
+} // namespace catalog
+} // namespace client
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Ahead-of-time C++ for plural-forms rules.
+//
+// Each distinct rule, told apart by its canonical form, becomes one
+// `inline constexpr` function in a self-contained header, so a program can
+// include its rules and have the compiler inline them with no parser at
+// run time. Subtrees that every path evaluates more than once are computed
+// once into a local, as the VM hoists them into slots, and `%` by a
+// constant is left as integer modulo for the compiler to strength-reduce.
+// Named rules are also listed in a table sorted by locale with a constexpr
+// lookup.
+
+namespace client {
+namespace codegen {
+    struct source {
+        // Letters, digits and `_@.-`, or empty for a rule left out of the
+        // table.
+        std::string locale;
+        std::string text;
+    };
+
+    struct options {
+        std::string name_space = "plurals";
+    };
+
+    // Writes the header for `rules` to `out`. Fails without writing
+    // anything if a rule does not compile, a locale has other characters,
+    // or two rules share a locale.
+    bool
+    generate(
+        std::vector<source> const& rules,
+        options const& config,
+        std::ostream& out,
+        std::string& error);
+
+} // namespace codegen
+} // namespace client
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ast.hpp"
+#include "flat.hpp"
+#include "jit.hpp"
+#include "kernels.hpp"
+#include "periodic.hpp"
+#include "vm.hpp"
+
+namespace client {
+    enum class engine : std::uint8_t {
+        automatic,
+        kernel,
+        table,
+        jit,
+        vm,
+        tree,
+    };
+
+    char const*
+    engine_name(engine target);
+
+    // Accepts the names printed by engine_name; `automatic` is "auto".
+    bool
+    parse_engine(std::string const& name, engine& out);
+
+    // Turns text into an ast::operand. Both build the same tree and report
+    // the same errors; the hand-written `pratt` parser is several times
+    // faster than the Spirit X3 grammar, which is kept as the reference.
+    enum class frontend : std::uint8_t {
+        pratt,
+        x3,
+    };
+
+    char const*
+    frontend_name(frontend parser);
+
+    bool
+    parse_frontend(std::string const& name, frontend& out);
+
+    // Why a rule failed to compile. Syntax errors have the offset into the
+    // text where parsing failed and what the parser expected there, such
+    // as "')'", "variable n", "character" for a byte that can never appear,
+    // "nesting depth" for a rule nested past scan::max_depth, or "end of
+    // input" for trailing text. Rules that parse but do not suit the
+    // requested engine have an empty `expected`.
+    struct compile_error {
+        std::size_t offset = 0;
+        std::string expected;
+        std::string message;
+    };
+
+    // A plural-forms rule parsed, optimized and lowered for one engine.
+    // `automatic` picks a built-in kernel, then a table, then the VM. A
+    // compiled rule is never modified, so it may be evaluated from several
+    // threads at once.
+    class compiled_rule {
+    public:
+        compiled_rule() = default;
+        compiled_rule(compiled_rule&&) = default;
+        compiled_rule& operator=(compiled_rule&&) = default;
+
+        // Never throws: malformed input, including bytes rejected by
+        // scan::first_invalid before the parser runs, and allocation
+        // failures are all reported through `error`.
+        static bool
+        compile(
+            std::string const& text,
+            engine preferred,
+            compiled_rule& out,
+            compile_error& error,
+            frontend parser = frontend::pratt) noexcept;
+
+        // As above, with only the message.
+        static bool
+        compile(
+            std::string const& text,
+            engine preferred,
+            compiled_rule& out,
+            std::string& error,
+            frontend parser = frontend::pratt);
+
+        uint
+        operator()(uint n) const;
+
+        std::string const&
+        text() const {
+            return source;
+        }
+
+        ast::operand const&
+        program() const {
+            return tree;
+        }
+
+        engine
+        selected() const {
+            return target;
+        }
+
+        // The kernel, table, bytecode and machine code are only set for
+        // the engine that was selected.
+        kernels::kernel const*
+        kernel() const {
+            return builtin;
+        }
+
+        periodic::table const&
+        table() const {
+            return lookup;
+        }
+
+        vm::program const&
+        bytecode() const {
+            return code;
+        }
+
+        jit::function const&
+        function() const {
+            return native;
+        }
+
+        std::uint64_t
+        fingerprint() const {
+            return hash;
+        }
+
+        // The key of the rule's canonical form and its stable hash; see
+        // canonical.hpp. Rules with equal keys compute the same function.
+        std::string const&
+        canonical() const {
+            return key;
+        }
+
+        std::uint64_t
+        canonical_hash() const {
+            return identity;
+        }
+
+        // Nodes in the parsed tree, and how many the optimizer removed.
+        std::size_t
+        nodes() const {
+            return parsed_nodes;
+        }
+
+        std::size_t
+        removed() const {
+            return removed_nodes;
+        }
+
+    private:
+        std::string source;
+        ast::operand tree;
+        engine target = engine::automatic;
+        kernels::kernel const* builtin = nullptr;
+        periodic::table lookup;
+        vm::program code;
+        jit::function native;
+        flat::tree flattened;
+        std::uint64_t hash = 0;
+        std::string key;
+        std::uint64_t identity = 0;
+        std::size_t parsed_nodes = 0;
+        std::size_t removed_nodes = 0;
+    };
+
+} // namespace client
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ast.hpp"
+
+// A constexpr parser for the grammar in parser_def.hpp, for rules known at
+// build time:
+//
+//     static constexpr auto polish = client::compiletime::parse(
+//         "(n == 1) ? 0 : ((n % 10 >= 2 && n % 10 <= 4 && "
+//         "(n % 100 < 12 || n % 100 > 14)) ? 1 : 2)");
+//     using polish_rule = client::compiletime::rule<polish>;
+//
+//     uint form = polish_rule::evaluate(n);
+//
+// rule<> unfolds the parsed tree into nested template instantiations, so
+// the whole rule is inlined at the call site with every constant in place.
+
+namespace client {
+namespace compiletime {
+    enum class kind : std::uint8_t { constant, variable, binary, conditional };
+
+    struct node {
+        kind type = kind::constant;
+        ast::optoken op = ast::optoken::mod;
+        uint value = 0;
+        std::uint16_t lhs = 0;
+        std::uint16_t rhs = 0;
+        std::uint16_t alt = 0;
+    };
+
+    constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    template <std::size_t Capacity = 256>
+    struct program {
+        node nodes[Capacity]{};
+        std::size_t size = 0;
+        std::size_t root = 0;
+        // Offset of the first character that could not be parsed.
+        std::size_t error = npos;
+
+        constexpr bool
+        valid() const {
+            return error == npos;
+        }
+
+        constexpr uint
+        operator()(uint n) const {
+            return evaluate(root, n);
+        }
+
+        constexpr uint
+        evaluate(std::size_t idx, uint n) const {
+            node const& self = nodes[idx];
+            switch (self.type) {
+            case kind::constant: return self.value;
+            case kind::variable: return n;
+            case kind::binary:
+                return ast::binary_operator{self.op}(
+                    evaluate(self.lhs, n), evaluate(self.rhs, n));
+            case kind::conditional:
+                return evaluate(self.lhs, n) ? evaluate(self.rhs, n)
+                                             : evaluate(self.alt, n);
+            }
+            return 0;
+        }
+    };
+
+    // Recursive descent mirroring parser_def.hpp rule for rule, including
+    // its right-recursive `logical` rule.
+    template <std::size_t Capacity>
+    class parser {
+    public:
+        constexpr explicit parser(char const* text) : text(text) {}
+
+        constexpr program<Capacity>
+        parse() {
+            out.root = expression();
+            skip();
+            if (text[pos] != '\0') {
+                fail();
+            }
+            return out;
+        }
+
+    private:
+        char const* text;
+        std::size_t pos = 0;
+        program<Capacity> out{};
+
+        constexpr bool
+        failed() const {
+            return !out.valid();
+        }
+
+        constexpr std::size_t
+        fail() {
+            if (out.valid()) {
+                out.error = pos;
+            }
+            return 0;
+        }
+
+        static constexpr bool
+        is_space(char c) {
+            return c == ' ' || (c >= '\t' && c <= '\r');
+        }
+
+        static constexpr bool
+        is_alpha(char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        }
+
+        static constexpr bool
+        is_digit(char c) {
+            return c >= '0' && c <= '9';
+        }
+
+        constexpr void
+        skip() {
+            while (is_space(text[pos])) {
+                ++pos;
+            }
+        }
+
+        constexpr bool
+        accept(char const* token) {
+            skip();
+            std::size_t len = 0;
+            while (token[len] != '\0') {
+                if (text[pos + len] != token[len]) {
+                    return false;
+                }
+                ++len;
+            }
+            pos += len;
+            return true;
+        }
+
+        constexpr std::size_t
+        add(node const& value) {
+            if (out.size == Capacity) {
+                return fail();
+            }
+            out.nodes[out.size] = value;
+            return out.size++;
+        }
+
+        constexpr std::size_t
+        binary(ast::optoken op, std::size_t lhs, std::size_t rhs) {
+            node value{};
+            value.type = kind::binary;
+            value.op = op;
+            value.lhs = lhs;
+            value.rhs = rhs;
+            return add(value);
+        }
+
+        constexpr std::size_t
+        expression() {
+            return conditional();
+        }
+
+        constexpr std::size_t
+        conditional() {
+            const std::size_t condition{logical()};
+            if (failed() || !accept("?")) {
+                return condition;
+            }
+            const std::size_t if_true{expression()};
+            if (failed() || !accept(":")) {
+                return fail();
+            }
+            const std::size_t if_false{expression()};
+            node value{};
+            value.type = kind::conditional;
+            value.lhs = condition;
+            value.rhs = if_true;
+            value.alt = if_false;
+            return add(value);
+        }
+
+        constexpr std::size_t
+        logical() {
+            const std::size_t lhs{equality()};
+            if (failed()) {
+                return lhs;
+            }
+            ast::optoken op{};
+            if (accept("&&")) {
+                op = ast::optoken::logical_and;
+            } else if (accept("||")) {
+                op = ast::optoken::logical_or;
+            } else {
+                return lhs;
+            }
+            const std::size_t rhs{logical()};
+            return failed() ? rhs : binary(op, lhs, rhs);
+        }
+
+        constexpr std::size_t
+        equality() {
+            std::size_t lhs{relational()};
+            while (!failed()) {
+                ast::optoken op{};
+                if (accept("==")) {
+                    op = ast::optoken::equal;
+                } else if (accept("!=")) {
+                    op = ast::optoken::not_equal;
+                } else {
+                    break;
+                }
+                lhs = binary(op, lhs, relational());
+            }
+            return lhs;
+        }
+
+        constexpr std::size_t
+        relational() {
+            std::size_t lhs{multiplicative()};
+            while (!failed()) {
+                ast::optoken op{};
+                if (accept("<=")) {
+                    op = ast::optoken::less_equal;
+                } else if (accept(">=")) {
+                    op = ast::optoken::greater_equal;
+                } else if (accept("<")) {
+                    op = ast::optoken::less;
+                } else if (accept(">")) {
+                    op = ast::optoken::greater;
+                } else {
+                    break;
+                }
+                lhs = binary(op, lhs, multiplicative());
+            }
+            return lhs;
+        }
+
+        constexpr std::size_t
+        multiplicative() {
+            std::size_t lhs{primary()};
+            while (!failed() && accept("%")) {
+                lhs = binary(ast::optoken::mod, lhs, primary());
+            }
+            return lhs;
+        }
+
+        constexpr std::size_t
+        primary() {
+            skip();
+            node value{};
+            if (is_digit(text[pos])) {
+                std::uint64_t number = 0;
+                while (is_digit(text[pos])) {
+                    number = number * 10 + (text[pos++] - '0');
+                    if (number > 0xFFFFFFFF) {
+                        return fail();
+                    }
+                }
+                value.type = kind::constant;
+                value.value = number;
+                return add(value);
+            }
+            if (accept("(")) {
+                const std::size_t inner{expression()};
+                if (failed() || !accept(")")) {
+                    return fail();
+                }
+                return inner;
+            }
+            if (is_alpha(text[pos])) {
+                const std::size_t start{pos};
+                while (is_alpha(text[pos]) || is_digit(text[pos])) {
+                    ++pos;
+                }
+                std::uint32_t slot = 0;
+                if (!ast::find_variable({text + start, pos - start}, slot)) {
+                    pos = start;
+                    return fail();
+                }
+                value.type = kind::variable;
+                value.value = slot;
+                return add(value);
+            }
+            return fail();
+        }
+    };
+
+    template <std::size_t Capacity = 256>
+    constexpr program<Capacity>
+    parse(char const* text) {
+        return parser<Capacity>(text).parse();
+    }
+
+    // Evaluates node `Node` of a constexpr program as straight-line code.
+    template <auto const& Program, std::size_t Node = Program.root>
+    struct rule {
+        static_assert(Program.valid(), "plural-forms expression is malformed");
+
+        static constexpr node self{Program.nodes[Node]};
+
+        static constexpr uint
+        evaluate(uint n) {
+            if constexpr (self.type == kind::constant) {
+                return self.value;
+            } else if constexpr (self.type == kind::variable) {
+                return n;
+            } else if constexpr (self.type == kind::binary) {
+                return ast::binary_operator{self.op}(
+                    rule<Program, self.lhs>::evaluate(n),
+                    rule<Program, self.rhs>::evaluate(n));
+            } else {
+                return rule<Program, self.lhs>::evaluate(n)
+                           ? rule<Program, self.rhs>::evaluate(n)
+                           : rule<Program, self.alt>::evaluate(n);
+            }
+        }
+    };
+
+    // True if `prog` agrees with `truth` for every n in [first, last].
+    template <std::size_t Capacity>
+    constexpr bool
+    matches(
+        program<Capacity> const& prog,
+        uint (*truth)(uint),
+        uint first,
+        uint last) {
+        for (uint n = first; n <= last; ++n) {
+            if (prog(n) != truth(n)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+} // namespace compiletime
+} // namespace client
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <cstddef>
+
+namespace client {
+typedef unsigned int uint;
+namespace corpus {
+    // Standard Gettext plural-forms rules and the C++ they are meant to be
+    // equivalent to. Shared by the test suite and the compile-time checks.
+    struct entry {
+        char const* expression;
+        uint (*truth)(uint);
+    };
+
+    constexpr entry rules[]{
+        entry{
+            "0", [](uint n) -> uint { return 0; }},
+        entry{
+            "(n == 0) ? 0 : ((n == 1) ? 1 : 2)",
+            [](uint n) -> uint { return (n == 0) ? 0 : ((n == 1) ? 1 : 2); }},
+        entry{
+            "(n == 0) ? 0 : ((n == 1) ? 1 : (((n % 100 == 2 || n % 100 == "
+            "22 || n % 100 == 42 || n % 100 == 62 || n % 100 == 82) || n % "
+            "1000 == 0 && (n % 100000 >= 1000 && n % 100000 <= 20000 || n "
+            "% 100000 == 40000 || n % 100000 == 60000 || n % 100000 == "
+            "80000) || n != 0 && n % 1000000 == 100000) ? 2 : ((n % 100 == "
+            "3 || n % 100 == 23 || n % 100 == 43 || n % 100 == 63 || n % "
+            "100 == 83) ? 3 : ((n != 1 && (n % 100 == 1 || n % 100 == 21 "
+            "|| n % 100 == 41 || n % 100 == 61 || n % 100 == 81)) ? 4 : "
+            "5))))",
+            [](uint n) -> uint {
+                return (n == 0)
+                           ? 0
+                           : ((n == 1)
+                                  ? 1
+                                  : (((n % 100 == 2 || n % 100 == 22 ||
+                                       n % 100 == 42 || n % 100 == 62 ||
+                                       n % 100 == 82) ||
+                                      n % 1000 == 0 &&
+                                          (n % 100000 >= 1000 &&
+                                               n % 100000 <= 20000 ||
+                                           n % 100000 == 40000 ||
+                                           n % 100000 == 60000 ||
+                                           n % 100000 == 80000) ||
+                                      n != 0 && n % 1000000 == 100000)
+                                         ? 2
+                                         : ((n % 100 == 3 || n % 100 == 23 ||
+                                             n % 100 == 43 || n % 100 == 63 ||
+                                             n % 100 == 83)
+                                                ? 3
+                                                : ((n != 1 && (n % 100 == 1 ||
+                                                               n % 100 == 21 ||
+                                                               n % 100 == 41 ||
+                                                               n % 100 == 61 ||
+                                                               n % 100 == 81))
+                                                       ? 4
+                                                       : 5))));
+            }},
+        entry{
+            "(n == 0) ? 0 : ((n == 1) ? 1 : ((n == 2) ? 2 : ((n % 100 >= 3 "
+            "&& n % 100 <= 10) ? 3 : ((n % 100 >= 11 && n % 100 <= 99) ? 4 "
+            ": 5))))",
+            [](uint n) -> uint {
+                return (n == 0)
+                           ? 0
+                           : ((n == 1)
+                                  ? 1
+                                  : ((n == 2) ? 2
+                                              : ((n % 100 >= 3 && n % 100 <= 10)
+                                                     ? 3
+                                                     : ((n % 100 >= 11 &&
+                                                         n % 100 <= 99)
+                                                            ? 4
+                                                            : 5))));
+            }},
+        entry{
+            "(n == 0) ? 0 : ((n == 1) ? 1 : ((n == 2) ? 2 : ((n == 3) ? 3 "
+            ": ((n == 6) ? 4 : 5))))",
+            [](uint n) -> uint {
+                return (n == 0)
+                           ? 0
+                           : ((n == 1)
+                                  ? 1
+                                  : ((n == 2)
+                                         ? 2
+                                         : ((n == 3) ? 3
+                                                     : ((n == 6) ? 4 : 5))));
+            }},
+        entry{
+            "(n == 0 || n == 1) ? 0 : ((n >= 2 && n <= 10) ? 1 : 2)",
+            [](uint n) -> uint {
+                return (n == 0 || n == 1) ? 0 : ((n >= 2 && n <= 10) ? 1 : 2);
+            }},
+        entry{
+            "n != 1", [](uint n) -> uint { return n != 1; }},
+        entry{
+            "n > 1", [](uint n) -> uint { return n > 1; }},
+        entry{
+            "(n % 100 == 1) ? 0 : ((n % 100 == 2) ? 1 : ((n % 100 == 3 || "
+            "n % 100 == 4) ? 2 : 3))",
+            [](uint n) -> uint {
+                return (n % 100 == 1)
+                           ? 0
+                           : ((n % 100 == 2)
+                                  ? 1
+                                  : ((n % 100 == 3 || n % 100 == 4) ? 2 : 3));
+            }},
+        entry{
+            "(n % 10 == 0 || n % 100 >= 11 && n % 100 <= 19) ? 0 : ((n % "
+            "10 == 1 && n % 100 != 11) ? 1 : 2)",
+            [](uint n) -> uint {
+                return (n % 10 == 0 || n % 100 >= 11 && n % 100 <= 19)
+                           ? 0
+                           : ((n % 10 == 1 && n % 100 != 11) ? 1 : 2);
+            }},
+        entry{
+            "(n % 10 == 1) ? 0 : ((n % 10 == 2) ? 1 : ((n % 100 == 0 || n "
+            "% 100 == 20 || n % 100 == 40 || n % 100 == 60 || n % 100 == "
+            "80) ? 2 : 3))",
+            [](uint n) -> uint {
+                return (n % 10 == 1)
+                           ? 0
+                           : ((n % 10 == 2) ? 1
+                                            : ((n % 100 == 0 || n % 100 == 20 ||
+                                                n % 100 == 40 ||
+                                                n % 100 == 60 || n % 100 == 80)
+                                                   ? 2
+                                                   : 3));
+            }},
+        entry{
+            "n % 10 != 1 || n % 100 == 11",
+            [](uint n) -> uint { return n % 10 != 1 || n % 100 == 11; }},
+        entry{
+            "(n % 10 == 1 && n % 100 != 11) ? 0 : ((n % 10 >= 2 && n % 10 "
+            "<= 4 && (n % 100 < 12 || n % 100 > 14)) ? 1 : 2)",
+            [](uint n) -> uint {
+                return (n % 10 == 1 && n % 100 != 11)
+                           ? 0
+                           : ((n % 10 >= 2 && n % 10 <= 4 &&
+                               (n % 100 < 12 || n % 100 > 14))
+                                  ? 1
+                                  : 2);
+            }},
+        entry{
+            "(n % 10 == 1 && (n % 100 < 11 || n % 100 > 19)) ? 0 : ((n % "
+            "10 >= 2 && n % 10 <= 9 && (n % 100 < 11 || n % 100 > 19)) ? 1 "
+            ": 2)",
+            [](uint n) -> uint {
+                return (n % 10 == 1 && (n % 100 < 11 || n % 100 > 19))
+                           ? 0
+                           : ((n % 10 >= 2 && n % 10 <= 9 &&
+                               (n % 100 < 11 || n % 100 > 19))
+                                  ? 1
+                                  : 2);
+            }},
+        entry{
+            "(n % 10 == 1 && n % 100 != 11 && n % 100 != 71 && n % 100 != "
+            "91) ? 0 : ((n % 10 == 2 && n % 100 != 12 && n % 100 != 72 && "
+            "n % 100 != 92) ? 1 : ((((n % 10 == 3 || n % 10 == 4) || n % "
+            "10 == 9) && (n % 100 < 10 || n % 100 > 19) && (n % 100 < 70 "
+            "|| n % 100 > 79) && (n % 100 < 90 || n % 100 > 99)) ? 2 : ((n "
+            "!= 0 && n % 1000000 == 0) ? 3 : 4)))",
+            [](uint n) -> uint {
+                return (n % 10 == 1 && n % 100 != 11 && n % 100 != 71 &&
+                        n % 100 != 91)
+                           ? 0
+                           : ((n % 10 == 2 && n % 100 != 12 && n % 100 != 72 &&
+                               n % 100 != 92)
+                                  ? 1
+                                  : ((((n % 10 == 3 || n % 10 == 4) ||
+                                       n % 10 == 9) &&
+                                      (n % 100 < 10 || n % 100 > 19) &&
+                                      (n % 100 < 70 || n % 100 > 79) &&
+                                      (n % 100 < 90 || n % 100 > 99))
+                                         ? 2
+                                         : ((n != 0 && n % 1000000 == 0) ? 3
+                                                                         : 4)));
+            }},
+        entry{
+            "(n == 1) ? 0 : ((n == 0 || n % 100 >= 2 && n % 100 <= 10) ? 1 "
+            ": ((n % 100 >= 11 && n % 100 <= 19) ? 2 : 3))",
+            [](uint n) -> uint {
+                return (n == 1)
+                           ? 0
+                           : ((n == 0 || n % 100 >= 2 && n % 100 <= 10)
+                                  ? 1
+                                  : ((n % 100 >= 11 && n % 100 <= 19) ? 2 : 3));
+            }},
+        entry{
+            "(n == 1) ? 0 : ((n == 0 || n % 100 >= 2 && n % 100 <= 19) ? 1 "
+            ": 2)",
+            [](uint n) -> uint {
+                return (n == 1)
+                           ? 0
+                           : ((n == 0 || n % 100 >= 2 && n % 100 <= 19) ? 1
+                                                                        : 2);
+            }},
+        entry{
+            "(n == 1) ? 0 : ((n % 10 >= 2 && n % 10 <= 4 && (n % 100 < 12 "
+            "|| n % 100 > 14)) ? 1 : 2)",
+            [](uint n) -> uint {
+                return (n == 1) ? 0
+                                : ((n % 10 >= 2 && n % 10 <= 4 &&
+                                    (n % 100 < 12 || n % 100 > 14))
+                                       ? 1
+                                       : 2);
+            }},
+        entry{
+            "(n == 1) ? 0 : ((n == 2) ? 1 : 2)",
+            [](uint n) -> uint { return (n == 1) ? 0 : ((n == 2) ? 1 : 2); }},
+        entry{
+            "(n == 1) ? 0 : ((n == 2) ? 1 : ((n > 10 && n % 10 == 0) ? 2 : "
+            "3))",
+            [](uint n) -> uint {
+                return (n == 1)
+                           ? 0
+                           : ((n == 2) ? 1 : ((n > 10 && n % 10 == 0) ? 2 : 3));
+            }},
+        entry{
+            "(n == 1) ? 0 : ((n == 2) ? 1 : ((n >= 3 && n <= 6) ? 2 : ((n "
+            ">= 7 && n <= 10) ? 3 : 4)))",
+            [](uint n) -> uint {
+                return (n == 1)
+                           ? 0
+                           : ((n == 2) ? 1
+                                       : ((n >= 3 && n <= 6)
+                                              ? 2
+                                              : ((n >= 7 && n <= 10) ? 3 : 4)));
+            }},
+        entry{
+            "(n == 1) ? 0 : ((n >= 2 && n <= 4) ? 1 : 2)",
+            [](uint n) -> uint {
+                return (n == 1) ? 0 : ((n >= 2 && n <= 4) ? 1 : 2);
+            }},
+        entry{
+            "(n == 1 || n == 11) ? 0 : ((n == 2 || n == 12) ? 1 : ((n >= 3 "
+            "&& n <= 10 || n >= 13 && n <= 19) ? 2 : 3))",
+            [](uint n) -> uint {
+                return (n == 1 || n == 11)
+                           ? 0
+                           : ((n == 2 || n == 12)
+                                  ? 1
+                                  : ((n >= 3 && n <= 10 || n >= 13 && n <= 19)
+                                         ? 2
+                                         : 3));
+            }},
+        entry{
+            "n != 1 && n != 2 && n != 3 && (n % 10 == 4 || n % 10 == 6 || "
+            "n % 10 == 9)",
+            [](uint n) -> uint {
+                return n != 1 && n != 2 && n != 3 &&
+                       (n % 10 == 4 || n % 10 == 6 || n % 10 == 9);
+            }},
+        entry{
+            "n >= 2 && (n < 11 || n > 99)",
+            [](uint n) -> uint { return n >= 2 && (n < 11 || n > 99); }},
+    };
+
+    constexpr std::size_t size = sizeof(rules) / sizeof(rules[0]);
+
+} // namespace corpus
+} // namespace client
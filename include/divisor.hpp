@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+namespace client {
+typedef unsigned int uint;
+
+// Precomputed reciprocal for a constant 32-bit divisor (Lemire, Kaser and
+// Kurz, "Faster Remainder by Direct Computation", 2019). For any 32-bit
+// numerator the remainder is the high half of the product of d with the
+// 64-bit fractional part of n / d, so no hardware divide is issued.
+struct divisor {
+    uint value = 1;
+    std::uint64_t magic = 0;
+
+    divisor() = default;
+
+    explicit divisor(uint value)
+        : value(value), magic(UINT64_C(0xFFFFFFFFFFFFFFFF) / value + 1) {}
+
+    uint
+    remainder(uint n) const {
+        const std::uint64_t fraction{magic * n};
+        return static_cast<uint>(
+            (static_cast<unsigned __int128>(fraction) * value) >> 64);
+    }
+};
+
+} // namespace client
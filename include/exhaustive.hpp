@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace client {
+namespace exhaustive {
+    // Calls `task(worker, first, last)` on disjoint chunks of at most
+    // `grain` values that together cover [first, last]. Each of `threads`
+    // workers starts with a contiguous share of the chunks and, once it
+    // runs out, steals chunks from the other end of another worker's
+    // queue. While waiting, the calling thread passes the number of values
+    // done so far to `progress` about twice a second. A task returning
+    // false stops all workers early, and parallel_for then returns false.
+    bool
+    parallel_for(
+        std::size_t threads,
+        std::uint64_t first,
+        std::uint64_t last,
+        std::uint64_t grain,
+        std::function<bool(std::size_t, std::uint64_t, std::uint64_t)> const&
+            task,
+        std::function<void(std::uint64_t)> const& progress);
+
+    struct options {
+        // "all", or one of kernel, table, jit, batch, vm and tree, which is
+        // the flat tree compiled_rule evaluates for engine::tree. It is only
+        // run when named, as it is much slower than the others.
+        std::string engine = "all";
+        std::uint64_t last = 0xFFFFFFFF;
+        std::size_t threads = 0; // 0: one per hardware thread
+    };
+
+    // Checks the selected engines against every corpus truth function for
+    // all n in [0, options.last], printing progress and throughput.
+    bool
+    verify(options const& config);
+
+} // namespace exhaustive
+} // namespace client
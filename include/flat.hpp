@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+
+namespace client {
+namespace flat {
+    enum class kind : std::uint8_t {
+        constant,    // a = value
+        variable,    // a = slot
+        binary,      // a, b = children, c = binary nodes down the a side
+        conditional, // a = condition, b = if true, c = if false
+    };
+
+    struct node {
+        kind type;
+        ast::binary_operator op;
+        std::uint32_t a;
+        std::uint32_t b;
+        std::uint32_t c;
+    };
+    static_assert(sizeof(node) == 16, "flat::node must stay 16 bytes");
+
+    // A rule as one contiguous array of nodes that refer to their children
+    // by 32-bit index. Every node is at least one character of source text,
+    // so parsing reserves room for text.size() nodes up front: a tree costs
+    // a single allocation, however deep the rule, and is freed at once.
+    //
+    // A chain of operations is a spine of binary nodes, each the left
+    // child of the next. add() counts the links of each spine, so that
+    // evaluate() walks long chains in a loop instead of recursing once per
+    // link.
+    class tree {
+    public:
+        std::uint32_t
+        add(node const& value) {
+            nodes.push_back(value);
+            node& added = nodes.back();
+            if (added.type == kind::binary) {
+                node const& lhs = nodes[added.a];
+                added.c = lhs.type == kind::binary ? lhs.c + 1 : 1;
+            }
+            return static_cast<std::uint32_t>(nodes.size() - 1);
+        }
+
+        void
+        reserve(std::size_t count) {
+            nodes.reserve(count);
+        }
+
+        void
+        clear() {
+            nodes.clear();
+            top = 0;
+        }
+
+        node const&
+        operator[](std::uint32_t index) const {
+            return nodes[index];
+        }
+
+        std::uint32_t
+        root() const {
+            return top;
+        }
+
+        void
+        set_root(std::uint32_t index) {
+            top = index;
+        }
+
+        bool
+        empty() const {
+            return nodes.empty();
+        }
+
+        // Nodes stored, including any left behind by backtracking.
+        std::size_t
+        size() const {
+            return nodes.size();
+        }
+
+        uint
+        operator()(uint n) const {
+            const uint variables[ast::variable_count]{n};
+            return evaluate(top, variables);
+        }
+
+        uint
+        evaluate(std::uint32_t index, uint const* variables) const {
+            node const& at = nodes[index];
+            switch (at.type) {
+            case kind::constant: return at.a;
+            case kind::variable: return variables[at.a];
+            case kind::binary:
+                if (at.c > short_chain) {
+                    return chain(index, variables);
+                }
+                return at.op(
+                    evaluate(at.a, variables), evaluate(at.b, variables));
+            case kind::conditional:
+                return evaluate(at.a, variables) ? evaluate(at.b, variables)
+                                                 : evaluate(at.c, variables);
+            }
+            return 0;
+        }
+
+    private:
+        // Longest chain evaluate() recurses through.
+        static constexpr std::uint32_t short_chain = 64;
+
+        // Evaluates the chain of binary nodes that ends at `index` from
+        // the bottom up.
+        uint
+        chain(std::uint32_t index, uint const* variables) const {
+            std::vector<std::uint32_t> links;
+            links.reserve(nodes[index].c);
+            for (; nodes[index].type == kind::binary; index = nodes[index].a) {
+                links.push_back(index);
+            }
+            uint value = evaluate(index, variables);
+            for (auto link = links.rbegin(); link != links.rend(); ++link) {
+                node const& at = nodes[*link];
+                value = at.op(value, evaluate(at.b, variables));
+            }
+            return value;
+        }
+
+        std::vector<node> nodes;
+        std::uint32_t top = 0;
+    };
+
+    // Parses `text` directly into `out`, without building an ast::operand.
+    bool
+    parse(std::string const& text, tree& out, std::string& error);
+
+    // Flattens an already parsed, typically optimized, operand.
+    void
+    flatten(ast::operand const& ast, tree& out);
+
+} // namespace flat
+} // namespace client
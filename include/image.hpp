@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compiled_rule.hpp"
+
+// Precompiled rules in a file that is mapped into memory and used in place.
+//
+// An image is a header, an array of fixed-size records, one per rule, and
+// the data the records point to: lookup tables, bytecode and divisors, and
+// the name and text of each rule. Every reference is a byte offset from
+// the start of the file, so the image works wherever it is mapped, and all
+// data is aligned for direct use. Loading maps the file, checks the header
+// and checksum, and verifies each record's bounds and bytecode; it parses
+// nothing and allocates nothing. Rules with the same canonical form share
+// their data.
+//
+// Integers are stored in the byte order of the machine that wrote the
+// image, which the header records; an image is refused by a machine with
+// the other order, as is one written with a different `version`.
+
+namespace client {
+namespace image {
+    constexpr char magic[8] = {'P', 'L', 'U', 'R', 'A', 'L', 'S', '\0'};
+    constexpr std::uint32_t version = 1;
+    constexpr std::uint32_t byte_order = 0x01020304;
+
+    struct header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint64_t size;     // of the whole image
+        std::uint64_t checksum; // FNV-1a over every byte after this field
+        std::uint32_t header_size;
+        std::uint32_t record_size;
+        std::uint32_t count;
+        std::uint32_t records; // offset of the records, sorted by name
+        std::uint64_t reserved[2];
+    };
+
+    // One rule. Offsets are from the start of the image; fields that do
+    // not apply to the rule's engine are 0.
+    struct record {
+        std::uint32_t name;
+        std::uint32_t name_size;
+        std::uint32_t text;
+        std::uint32_t text_size;
+        std::uint64_t canonical; // canonical::hash of the rule
+        std::uint32_t target;    // engine::table or engine::vm
+        std::uint32_t threshold; // table: exceptions below it
+        std::uint32_t exceptions;
+        std::uint32_t residues;  // table: one byte per residue of the period
+        std::uint32_t divisors;  // table: the period; vm: mod_const operands
+        std::uint32_t divisor_count;
+        std::uint32_t code;      // vm: instructions
+        std::uint32_t code_size;
+        std::uint32_t slots;     // vm: shared subexpressions
+        std::uint32_t reserved;
+    };
+
+    // A rule to write, named by a locale or left unnamed.
+    struct entry {
+        std::string name;
+        compiled_rule rule;
+    };
+
+    // Compiles `text` for an image: to a table if the rule is periodic,
+    // otherwise to bytecode.
+    bool
+    compile(std::string const& text, compiled_rule& out, std::string& error);
+
+    // Serializes `rules` into `out`. Named rules must have distinct names.
+    bool
+    write(
+        std::vector<entry> const& rules, std::string& out, std::string& error);
+
+    // A rule inside an image. Only valid while the image is.
+    class rule {
+    public:
+        rule() = default;
+
+        std::string_view
+        name() const;
+
+        std::string_view
+        text() const;
+
+        engine
+        selected() const {
+            return static_cast<engine>(self->target);
+        }
+
+        std::uint64_t
+        canonical_hash() const {
+            return self->canonical;
+        }
+
+        uint
+        operator()(uint n) const;
+
+    private:
+        friend class view;
+        rule(char const* base, record const* self) : base(base), self(self) {}
+
+        char const* base = nullptr;
+        record const* self = nullptr;
+    };
+
+    // Validated image bytes, which it does not own.
+    class view {
+    public:
+        view() = default;
+
+        // Checks `bytes`, which must be aligned to 8 bytes, and makes
+        // `out` refer to them.
+        static bool
+        open(std::string_view bytes, view& out, std::string& error);
+
+        std::size_t
+        size() const {
+            return count;
+        }
+
+        std::size_t
+        bytes() const {
+            return length;
+        }
+
+        rule
+        operator[](std::size_t idx) const {
+            return {base, records + idx};
+        }
+
+        // The rule named `name`, by binary search.
+        bool
+        find(std::string_view name, rule& out) const;
+
+    private:
+        char const* base = nullptr;
+        std::size_t length = 0;
+        record const* records = nullptr;
+        std::size_t count = 0;
+    };
+
+    // An image file mapped read-only.
+    class file {
+    public:
+        file() = default;
+        file(file const&) = delete;
+        file& operator=(file const&) = delete;
+        ~file();
+
+        bool
+        open(std::string const& path, std::string& error);
+
+        view const&
+        rules() const {
+            return loaded;
+        }
+
+    private:
+        void* address = nullptr;
+        std::size_t size = 0;
+        view loaded;
+    };
+
+} // namespace image
+} // namespace client
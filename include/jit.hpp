@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace client {
+typedef unsigned int uint;
+namespace ast {
+    struct operand;
+} // namespace ast
+
+namespace jit {
+    typedef uint (*entry_point)(uint);
+
+    // Machine code for one rule, living in its own executable mapping.
+    // The mapping is released when the function is destroyed.
+    class function {
+    public:
+        function() = default;
+        function(function const&) = delete;
+        function& operator=(function const&) = delete;
+        function(function&& other) noexcept;
+        function& operator=(function&& other) noexcept;
+        ~function();
+
+        uint
+        operator()(uint n) const {
+            return entry(n);
+        }
+
+        entry_point
+        get() const {
+            return entry;
+        }
+
+        std::size_t
+        size() const {
+            return code_size;
+        }
+
+    private:
+        friend bool
+        compile(ast::operand const& ast, function& out, std::string& error);
+
+        void
+        release();
+
+        entry_point entry = nullptr;
+        void* mapping = nullptr;
+        std::size_t mapping_size = 0;
+        std::size_t code_size = 0;
+    };
+
+    // True if this build can emit code for the host (x86-64 System V).
+    bool
+    available();
+
+    // Emits x86-64 code for `ast` and maps it executable. Modulo by a
+    // constant becomes a multiply by its reciprocal; conditionals become
+    // branches.
+    bool
+    compile(ast::operand const& ast, function& out, std::string& error);
+
+} // namespace jit
+} // namespace client
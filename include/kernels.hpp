@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace client {
+typedef unsigned int uint;
+namespace ast {
+    struct operand;
+} // namespace ast
+
+namespace kernels {
+    // A hand-written implementation of one of the standard Gettext rules.
+    struct kernel {
+        char const* name;
+        std::uint64_t fingerprint;
+        uint (*evaluate)(uint);
+    };
+
+    // Hashes the shape of a rule: operators, constants and their nesting.
+    // Whitespace, redundant parentheses and variable names do not affect
+    // it, so any spelling of a standard rule maps to the same value.
+    std::uint64_t
+    fingerprint(ast::operand const& ast);
+
+    // The built-in kernel for `ast`, or nullptr if the rule is not one of
+    // the standard ones. A rule must serialize to exactly the bytes of the
+    // built-in one; a matching fingerprint alone is not enough.
+    kernel const*
+    find(ast::operand const& ast);
+
+} // namespace kernels
+} // namespace client
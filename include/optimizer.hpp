@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <boost/foreach.hpp>
+
+#include "ast.hpp"
+
+namespace client {
+namespace ast {
+    struct node_counter {
+        typedef std::size_t result_type;
+
+        result_type
+        operator()(operand const& ast) const {
+            return boost::apply_visitor(*this, ast.get());
+        }
+
+        result_type
+        operator()(nil) const {
+            return 0;
+        }
+
+        result_type
+        operator()(expression const& ast) const {
+            result_type count = 1 + boost::apply_visitor(*this, ast.lhs);
+            BOOST_FOREACH (operation const& op, ast.rhs) {
+                count += 1 + boost::apply_visitor(*this, op.rhs);
+            }
+            return count;
+        }
+
+        result_type
+        operator()(binary_op const& ast) const {
+            return 1 + boost::apply_visitor(*this, ast.lhs) +
+                   boost::apply_visitor(*this, ast.rhs);
+        }
+
+        result_type
+        operator()(conditional_op const& ast) const {
+            return 1 + boost::apply_visitor(*this, ast.lhs) +
+                   boost::apply_visitor(*this, ast.rhs_true) +
+                   boost::apply_visitor(*this, ast.rhs_false);
+        }
+
+        result_type
+        operator()(uint const&) const {
+            return 1;
+        }
+
+        result_type
+        operator()(variable const&) const {
+            return 1;
+        }
+    };
+
+    // Rewrites a parsed operand bottom-up: constant operators other than
+    // `% 0` are folded, expression wrappers without operations are
+    // replaced by their only child, and conditionals with a constant
+    // condition are replaced by the branch they would take.
+    struct optimizer {
+        void
+        operator()(operand& ast) const {
+            auto& node = ast.get();
+            if (auto* expr = boost::get<x3::forward_ast<expression>>(&node)) {
+                simplify(ast, expr->get());
+            } else if (auto* op = boost::get<x3::forward_ast<binary_op>>(&node)) {
+                simplify(ast, op->get());
+            } else if (
+                auto* cond = boost::get<x3::forward_ast<conditional_op>>(&node)) {
+                simplify(ast, cond->get());
+            }
+        }
+
+        static uint const*
+        constant(operand const& ast) {
+            return boost::get<uint>(&ast.get());
+        }
+
+        // Whether an operation by the constant `rhs` can be folded. `% 0`
+        // is left for the compiler, which rejects it as a modulo by
+        // constant zero.
+        static bool
+        foldable(binary_operator op, uint const* rhs) {
+            return rhs && !(op.code == optoken::mod && *rhs == 0);
+        }
+
+        void
+        simplify(operand& ast, expression& expr) const {
+            (*this)(expr.lhs);
+            BOOST_FOREACH (operation& op, expr.rhs) { (*this)(op.rhs); }
+
+            uint const* lhs = constant(expr.lhs);
+            while (lhs && !expr.rhs.empty()) {
+                uint const* rhs = constant(expr.rhs.front().rhs);
+                if (!foldable(expr.rhs.front().op, rhs)) {
+                    break;
+                }
+                expr.lhs = expr.rhs.front().op(*lhs, *rhs);
+                expr.rhs.pop_front();
+                lhs = constant(expr.lhs);
+            }
+
+            if (expr.rhs.empty()) {
+                operand child{std::move(expr.lhs)};
+                ast = std::move(child);
+            }
+        }
+
+        void
+        simplify(operand& ast, binary_op& op) const {
+            (*this)(op.lhs);
+            (*this)(op.rhs);
+
+            uint const* lhs = constant(op.lhs);
+            uint const* rhs = constant(op.rhs);
+            if (lhs && foldable(op.op, rhs)) {
+                ast = op.op(*lhs, *rhs);
+            }
+        }
+
+        void
+        simplify(operand& ast, conditional_op& cond) const {
+            (*this)(cond.lhs);
+            (*this)(cond.rhs_true);
+            (*this)(cond.rhs_false);
+
+            if (uint const* lhs = constant(cond.lhs)) {
+                operand branch{std::move(*lhs ? cond.rhs_true : cond.rhs_false)};
+                ast = std::move(branch);
+            }
+        }
+    };
+
+    // Optimizes `ast` in place and returns the number of nodes removed.
+    inline std::size_t
+    optimize(operand& ast) {
+        const std::size_t before{node_counter{}(ast)};
+        optimizer{}(ast);
+        return before - node_counter{}(ast);
+    }
+
+} // namespace ast
+} // namespace client
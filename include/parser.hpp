@@ -16,7 +16,7 @@ namespace parser {
     using equality_type = x3::rule<class equality, ast::expression>;
     using relational_type = x3::rule<class relational, ast::expression>;
     using multiplicative_type = x3::rule<class multiplicative, ast::expression>;
-    using variable_type = x3::rule<class variable, std::string>;
+    using variable_type = x3::rule<class variable, ast::variable>;
     // clang-format on
 
     BOOST_SPIRIT_DECLARE(expression_type);
@@ -1,8 +1,8 @@
 #pragma once
 
 #include <iostream>
-#include <functional>
 #include <iomanip>
+#include <string_view>
 
 #include <boost/spirit/home/x3.hpp>
 
@@ -23,34 +23,34 @@ namespace parser {
     multiplicative_type const multiplicative{"multiplicative"};
     variable_type const variable{"variable"};
 
-#define add_operation(NAME, OP) this->add(NAME, {NAME, OP});
+#define add_operation(NAME, OP) this->add(NAME, {ast::optoken::OP});
 
     struct multiplicative_op_ : x3::symbols<ast::binary_operator> {
         multiplicative_op_() {
-            add_operation("%", [](uint a, uint b) { return std::fmod(a, b); });
+            add_operation("%", mod);
         }
     } multiplicative_op;
 
     struct logical_op_ : x3::symbols<ast::binary_operator> {
         logical_op_() {
-            add_operation("&&", std::logical_and<uint>{});
-            add_operation("||", std::logical_or<uint>{});
+            add_operation("&&", logical_and);
+            add_operation("||", logical_or);
         }
     } logical_op;
 
     struct relational_op_ : x3::symbols<ast::binary_operator> {
         relational_op_() {
-            add_operation("<", std::less<uint>{});
-            add_operation("<=", std::less_equal<uint>{});
-            add_operation(">", std::greater<uint>{});
-            add_operation(">=", std::greater_equal<uint>{});
+            add_operation("<", less);
+            add_operation("<=", less_equal);
+            add_operation(">", greater);
+            add_operation(">=", greater_equal);
         }
     } relational_op;
 
     struct equality_op_ : x3::symbols<ast::binary_operator> {
         equality_op_() {
-            add_operation("==", std::equal_to<uint>{});
-            add_operation("!=", std::not_equal_to<uint>{});
+            add_operation("==", equal);
+            add_operation("!=", not_equal);
         }
     } equality_op;
 #undef add_operation
@@ -61,6 +61,18 @@ namespace parser {
             x3::_val(ctx), at_c<0>(x3::_attr(ctx)), at_c<1>(x3::_attr(ctx))};
     };
 
+    // Identifiers are resolved to their slot while parsing; an unknown name
+    // fails the parse rather than being read as `n`.
+    auto make_variable = [](auto& ctx) {
+        auto const& name = x3::_attr(ctx);
+        const std::string_view text(&*name.begin(), name.size());
+        if (!ast::find_variable(text, x3::_val(ctx).slot)) {
+            boost::throw_exception(
+                x3::expectation_failure<decltype(name.begin())>(
+                    name.begin(), ast::expected_variable()));
+        }
+    };
+
     // Rule defintions
     auto const expression_def = conditional;
 
@@ -80,7 +92,8 @@ namespace parser {
 
     auto const primary_def = x3::uint_ | ('(' > expression > ')') | variable;
 
-    auto const variable_def = x3::lexeme[x3::alpha >> *x3::alnum];
+    auto const variable_def =
+        x3::lexeme[x3::raw[x3::alpha >> *x3::alnum]][make_variable];
     // clang-format on
 
     BOOST_SPIRIT_DEFINE(
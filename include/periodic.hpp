@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <boost/foreach.hpp>
+
+#include "ast.hpp"
+#include "divisor.hpp"
+
+namespace client {
+namespace periodic {
+    // Largest residue or exception table a rule may be compiled into.
+    constexpr std::uint64_t max_entries = 1 << 16;
+
+    // A rule is periodic when `n` only ever appears as `n % K` with a
+    // constant K, or compared against a constant. Past the largest compared
+    // constant every comparison is settled, so the result depends only on
+    // n modulo the least common multiple of the K.
+    struct analysis {
+        bool periodic = true;
+        std::uint64_t period = 1;
+        std::uint64_t threshold = 0;
+    };
+
+    struct analyzer {
+        typedef void result_type;
+
+        analysis& result;
+
+        static bool
+        is_variable(ast::operand const& ast) {
+            return boost::get<ast::variable>(&ast.get()) != nullptr;
+        }
+
+        static uint const*
+        constant(ast::operand const& ast) {
+            return boost::get<uint>(&ast.get());
+        }
+
+        static std::uint64_t
+        gcd(std::uint64_t a, std::uint64_t b) {
+            while (b) {
+                const std::uint64_t t = a % b;
+                a = b;
+                b = t;
+            }
+            return a;
+        }
+
+        // Accounts for `lhs <op> rhs`; returns false if neither side is a
+        // bare `n` that the pattern explains.
+        bool
+        use(ast::binary_operator const& op,
+            ast::operand const& lhs,
+            ast::operand const& rhs) {
+            if (is_variable(lhs)) {
+                uint const* value = constant(rhs);
+                if (!value) {
+                    result.periodic = false;
+                } else if (op.code == ast::optoken::mod) {
+                    if (*value == 0) {
+                        result.periodic = false;
+                    } else {
+                        result.period = result.period /
+                                        gcd(result.period, *value) * *value;
+                        if (result.period > max_entries) {
+                            result.periodic = false;
+                        }
+                    }
+                } else {
+                    settle(op, *value);
+                }
+                return true;
+            }
+            if (is_variable(rhs)) {
+                uint const* value = constant(lhs);
+                if (!value || op.code == ast::optoken::mod) {
+                    result.periodic = false;
+                } else {
+                    settle(op, *value);
+                }
+                (*this)(lhs);
+                return true;
+            }
+            return false;
+        }
+
+        void
+        settle(ast::binary_operator const& op, uint value) {
+            if (op.code == ast::optoken::logical_and ||
+                op.code == ast::optoken::logical_or) {
+                result.threshold = std::max<std::uint64_t>(
+                    result.threshold, 1);
+                return;
+            }
+            result.threshold = std::max<std::uint64_t>(
+                result.threshold, std::uint64_t{value} + 1);
+        }
+
+        result_type
+        operator()(ast::operand const& ast) {
+            boost::apply_visitor(*this, ast.get());
+        }
+
+        result_type
+        operator()(ast::nil) {
+            result.periodic = false;
+        }
+
+        result_type
+        operator()(ast::expression const& ast) {
+            auto op = ast.rhs.begin();
+            if (op != ast.rhs.end() && use(op->op, ast.lhs, op->rhs)) {
+                ++op;
+            } else {
+                (*this)(ast.lhs);
+            }
+            for (; op != ast.rhs.end(); ++op) {
+                refuse_zero(op->op, op->rhs);
+                (*this)(op->rhs);
+            }
+        }
+
+        result_type
+        operator()(ast::binary_op const& ast) {
+            if (!use(ast.op, ast.lhs, ast.rhs)) {
+                refuse_zero(ast.op, ast.rhs);
+                (*this)(ast.lhs);
+                (*this)(ast.rhs);
+            }
+        }
+
+        // `% 0` by a constant is left for the VM to reject, wherever it
+        // is, as use() does for `n % 0`.
+        void
+        refuse_zero(ast::binary_operator const& op, ast::operand const& rhs) {
+            uint const* value = constant(rhs);
+            if (op.code == ast::optoken::mod && value && *value == 0) {
+                result.periodic = false;
+            }
+        }
+
+        result_type
+        operator()(ast::conditional_op const& ast) {
+            (*this)(ast.lhs);
+            (*this)(ast.rhs_true);
+            (*this)(ast.rhs_false);
+        }
+
+        result_type
+        operator()(uint const&) {}
+
+        // A bare `n` outside of the patterns recognised by use().
+        result_type
+        operator()(ast::variable const&) {
+            result.periodic = false;
+        }
+    };
+
+    inline analysis
+    analyze(ast::operand const& ast) {
+        analysis result;
+        analyzer{result}(ast);
+        if (result.threshold > max_entries) {
+            result.periodic = false;
+        }
+        return result;
+    }
+
+    // Evaluates a periodic rule with at most two table loads: small `n`
+    // index the exception table directly, everything past the threshold
+    // indexes the residue table by n modulo the period.
+    struct table {
+        uint threshold = 0;
+        divisor period;
+        std::vector<std::uint8_t> exceptions;
+        std::vector<std::uint8_t> residues;
+
+        uint
+        operator()(uint n) const {
+            if (n < threshold) {
+                return exceptions[n];
+            }
+            return residues[period.remainder(n)];
+        }
+    };
+
+    // Builds the lookup tables for `ast` by sampling the tree evaluator.
+    // Returns false if the rule is not periodic or a result does not fit
+    // in a byte.
+    inline bool
+    tabulate(ast::operand const& ast, table& out) {
+        const analysis shape{analyze(ast)};
+        if (!shape.periodic) {
+            return false;
+        }
+
+        out.threshold = shape.threshold;
+        out.period = divisor(shape.period);
+        out.exceptions.resize(shape.threshold);
+        out.residues.resize(shape.period);
+
+        auto sample = [&ast](std::uint64_t n, std::uint8_t& entry) {
+            const uint value{ast::evaluator(n)(ast)};
+            entry = value;
+            return value <= 0xFF;
+        };
+        for (std::uint64_t n = 0; n < shape.threshold; ++n) {
+            if (!sample(n, out.exceptions[n])) {
+                return false;
+            }
+        }
+        // The first n at or past the threshold with each residue.
+        const std::uint64_t base{shape.threshold % shape.period};
+        for (std::uint64_t r = 0; r < shape.period; ++r) {
+            const std::uint64_t n{
+                shape.threshold + (r + shape.period - base) % shape.period};
+            if (!sample(n, out.residues[r])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+} // namespace periodic
+} // namespace client
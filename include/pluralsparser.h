@@ -0,0 +1,54 @@
+#ifndef PLURALSPARSER_H
+#define PLURALSPARSER_H
+
+/*
+ * C interface of libpluralsparser.
+ *
+ * A handle is an immutable compiled plural-forms rule. Handles may be used
+ * from several threads at once and freed from any thread. Compiling the
+ * same text twice is cheap: compiled rules are shared through the
+ * library's cache.
+ */
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define PLURALSPARSER_API __attribute__((visibility("default")))
+#else
+#define PLURALSPARSER_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pluralsparser_rule pluralsparser_rule;
+
+/*
+ * Compiles a Gettext plural-forms expression such as "n != 1". Returns NULL
+ * if it is malformed; the reason is then written to `error`, truncated to
+ * `error_size` bytes, unless `error` is NULL.
+ */
+PLURALSPARSER_API pluralsparser_rule*
+pluralsparser_compile(char const* text, char* error, size_t error_size);
+
+PLURALSPARSER_API unsigned int
+pluralsparser_eval(pluralsparser_rule const* rule, unsigned int n);
+
+/* out[i] = pluralsparser_eval(rule, ns[i]) for i in [0, count). */
+PLURALSPARSER_API void
+pluralsparser_eval_batch(
+    pluralsparser_rule const* rule,
+    unsigned int const* ns,
+    unsigned int* out,
+    size_t count);
+
+/* Accepts NULL. */
+PLURALSPARSER_API void
+pluralsparser_free(pluralsparser_rule* rule);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PLURALSPARSER_H */
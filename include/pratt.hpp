@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "ast.hpp"
+#include "flat.hpp"
+
+namespace client {
+namespace pratt {
+    // A hand-written precedence-climbing parser for the grammar in
+    // parser_def.hpp. It builds exactly the tree the X3 grammar does,
+    // including the expression wrapper of every precedence level, and
+    // reports failures at the offset and with the rule name X3 would use,
+    // but scans each token once and never throws on malformed input. Input
+    // nested past scan::max_depth fails with "nesting depth".
+    bool
+    parse(
+        std::string const& text,
+        ast::operand& out,
+        std::size_t& offset,
+        std::string& expected);
+
+    // The same parser building a flat::tree, equal node for node to the one
+    // flat::parse builds, with no allocation beyond the node array.
+    bool
+    parse(
+        std::string const& text,
+        flat::tree& out,
+        std::size_t& offset,
+        std::string& expected);
+
+} // namespace pratt
+} // namespace client
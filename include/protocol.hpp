@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Wire format of the `serve` daemon.
+//
+// Every message is a frame: a little-endian u32 holding the size of the
+// rest of the frame, a one-byte code, then the body. Requests on one
+// connection are answered in order, so clients may pipeline them.
+//
+//     request          body                    ok response body
+//     register_rule    expression text         u32 id
+//     evaluate         u32 id, u32 n           u32 result
+//     evaluate_batch   u32 id, u32 n[count]    u32 result[count]
+//
+// Any request may be answered with `error` and a message instead. Ids are
+// shared by all connections, and registering the same text twice returns
+// the same id.
+
+namespace client {
+namespace protocol {
+    enum class request : std::uint8_t {
+        register_rule = 1,
+        evaluate = 2,
+        evaluate_batch = 3,
+    };
+
+    enum class status : std::uint8_t {
+        ok = 0,
+        error = 1,
+    };
+
+    // Size of the length prefix and of the code.
+    constexpr std::size_t header_size = 5;
+    // Larger frames close the connection.
+    constexpr std::size_t max_frame = 1 << 24;
+
+    inline void
+    put_u32(std::string& out, std::uint32_t value) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            out.push_back(static_cast<char>(value >> shift));
+        }
+    }
+
+    inline std::uint32_t
+    get_u32(char const* in) {
+        std::uint32_t value = 0;
+        for (int idx = 3; idx >= 0; --idx) {
+            value = value << 8 | static_cast<unsigned char>(in[idx]);
+        }
+        return value;
+    }
+
+    // Appends a frame with `code` and `body` to `out`.
+    inline void
+    put_frame(std::string& out, std::uint8_t code, std::string const& body) {
+        put_u32(out, body.size() + 1);
+        out.push_back(static_cast<char>(code));
+        out += body;
+    }
+
+} // namespace protocol
+} // namespace client
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+
+// Static analysis of the values a rule can produce.
+//
+// The rule is interpreted over sets of n rather than single values. A set
+// of n, and the abstract value of every subexpression over it, is an
+// interval intersected with a residue class: [first, last] in steps of
+// `step`. Comparisons that the abstract values decide pick a branch for
+// the whole set; where they cannot, the set is split, by residue for the
+// moduli the undecided test uses or at the constants it compares n with,
+// until every test is decided. The results are then exact. A rule that
+// needs more than `max_regions` sets to settle gets a sound superset.
+//
+// && and || short-circuit and `?:` evaluates one branch, as in gettext, so
+// a `% 0` is only reported where evaluation reaches it.
+
+namespace client {
+namespace range {
+    // Sets of n examined before the analysis settles for a superset.
+    constexpr std::size_t max_regions = 1 << 18;
+
+    // first, first + step, ... up to last; step is 0 for a single value.
+    struct progression {
+        std::uint64_t first;
+        std::uint64_t last;
+        std::uint64_t step;
+    };
+
+    // A result value and the smallest n found producing it.
+    struct sample {
+        std::uint64_t value;
+        std::uint64_t n;
+    };
+
+    // A `%` whose right-hand side is 0 when it is evaluated.
+    struct division {
+        std::string text;
+        bool proven;          // false: could not be ruled out
+        std::uint64_t n = 0;  // reaches it, if proven
+    };
+
+    // A branch of `?:` that no n takes.
+    struct branch {
+        std::string condition;
+        bool when;            // true for `?`, false for `:`
+        std::string text;
+    };
+
+    struct report {
+        // The results over every 32-bit n, in ascending order of first.
+        // Exactly the set of results when `exact`, otherwise a superset.
+        std::vector<progression> values;
+        bool exact = true;
+        std::uint64_t max = 0;
+        // One n for each result that was found as a single value.
+        std::vector<sample> samples;
+        std::vector<division> divisions;
+        // Proven unreachable even when the values are not exact. Branches
+        // inside an unreachable branch are not listed again.
+        std::vector<branch> unreachable;
+        std::size_t regions = 0;
+    };
+
+    // Analyzes a parsed, unoptimized rule: the optimizer would already
+    // have removed the branches and divisions it could prove constant.
+    report
+    analyze(ast::operand const& ast);
+
+} // namespace range
+} // namespace client
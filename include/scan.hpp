@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+
+namespace client {
+namespace scan {
+    // Whether `c` may appear anywhere in a plural-forms expression: digits,
+    // letters, whitespace and the characters of the operators and brackets.
+    constexpr bool
+    allowed(char c) {
+        return (c >= '0' && c <= ':') || (c >= 'a' && c <= 'z') ||
+               (c >= 'A' && c <= 'Z') || (c >= '\t' && c <= '\r') ||
+               (c >= '<' && c <= '?') || c == ' ' || c == '!' || c == '%' ||
+               c == '&' || c == '(' || c == ')' || c == '|';
+    }
+
+    // Offset of the first byte of `text` that is not allowed(), or `size`
+    // if there is none. Checks 16 bytes per step with SSE2 where available,
+    // so untrusted headers with stray bytes are rejected before the parser
+    // runs.
+    std::size_t
+    first_invalid(char const* text, std::size_t size) noexcept;
+
+    // Deepest nesting the parsers accept. Passes over a tree recurse into
+    // brackets, `?:`, `&&` and `||`, so this bounds their stack use there.
+    // It does not bound the length of a chain such as `n % 7 == 1 == 0`:
+    // the parsers keep one as a flat list, and the passes that could
+    // otherwise recurse once per link walk it in a loop instead, so a long
+    // chain costs time but not stack. vm::compile refuses rules that need
+    // more than vm::max_stack values long before max_depth is reached.
+    constexpr std::size_t max_depth = 256;
+
+    // Offset of the first `(`, `?`, `&&` or `||` that takes `text` past
+    // max_depth, or `size` if none does. Each of them is one more level of
+    // recursion in either parser, so this bounds their depth before they
+    // run, without parsing.
+    std::size_t
+    too_deep(char const* text, std::size_t size) noexcept;
+
+} // namespace scan
+} // namespace client
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "protocol.hpp"
+
+namespace client {
+namespace server {
+    struct options {
+        std::string socket_path;
+        std::size_t workers = 4;
+    };
+
+    class registry;
+    class worker;
+
+    // Listens on a Unix domain socket. One thread accepts connections and
+    // hands them out round-robin to a fixed pool of workers, each of which
+    // runs its own epoll loop and answers requests inline. Compiled rules
+    // are kept in a registry shared by all workers until the daemon stops.
+    class daemon {
+    public:
+        daemon();
+        daemon(daemon const&) = delete;
+        daemon& operator=(daemon const&) = delete;
+        ~daemon();
+
+        // Binds the socket and starts the threads.
+        bool
+        start(options const& config, std::string& error);
+
+        // Asks the threads to exit. Only writes to an eventfd, so it may be
+        // called from a signal handler.
+        void
+        stop();
+
+        // Waits for the threads to exit and removes the socket.
+        void
+        wait();
+
+    private:
+        void
+        accept_loop();
+
+        std::string path;
+        int listener = -1;
+        int stop_fd = -1;
+        std::unique_ptr<registry> rules;
+        std::vector<std::unique_ptr<worker>> workers;
+        std::thread acceptor;
+    };
+
+    // A blocking client for the protocol, used by `test` over loopback.
+    class connection {
+    public:
+        connection() = default;
+        connection(connection const&) = delete;
+        connection& operator=(connection const&) = delete;
+        ~connection();
+
+        bool
+        open(std::string const& socket_path, std::string& error);
+
+        // Sends one request. Several may be sent before reading responses.
+        bool
+        send(protocol::request code, std::string const& body);
+
+        // Reads the next response.
+        bool
+        receive(protocol::status& status, std::string& body);
+
+        bool
+        register_rule(
+            std::string const& text, std::uint32_t& id, std::string& error);
+
+        bool
+        evaluate(
+            std::uint32_t id,
+            std::uint32_t n,
+            std::uint32_t& result,
+            std::string& error);
+
+        bool
+        evaluate_batch(
+            std::uint32_t id,
+            std::vector<std::uint32_t> const& ns,
+            std::vector<std::uint32_t>& results,
+            std::string& error);
+
+    private:
+        bool
+        call(
+            protocol::request code,
+            std::string const& body,
+            std::string& response,
+            std::string& error);
+
+        int fd = -1;
+    };
+
+} // namespace server
+} // namespace client
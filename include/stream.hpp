@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "pluralsparser.h"
+
+namespace client {
+namespace stream {
+    // Bytes read from and written to the descriptors per system call.
+    constexpr std::size_t buffer_size = 1 << 20;
+    // Values of n handed to the batch evaluator at a time.
+    constexpr std::size_t batch_size = 4096;
+
+    // Reads newline-separated values of n from `in` and writes the result
+    // for each to `out`, one per line and in the same order, so output line
+    // k is the result for input line k. A line may end in "\r\n"; a blank
+    // line, or a carriage return anywhere else, is malformed. Stops at the
+    // first malformed line, after writing the results of the lines before
+    // it.
+    bool
+    evaluate(
+        pluralsparser_rule const* rule, int in, int out, std::string& error);
+
+} // namespace stream
+} // namespace client
@@ -0,0 +1,675 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/foreach.hpp>
+
+#include "ast.hpp"
+#include "divisor.hpp"
+
+namespace client {
+namespace vm {
+    // The VM keeps the top of the stack in an accumulator, so `push` spills
+    // the accumulator and binary operators combine the spilled value with it.
+    enum class opcode : std::uint8_t {
+        push,
+        load,
+        load_slot,
+        store_slot,
+        mod,
+        mod_const,
+        logical_and,
+        logical_or,
+        less,
+        less_equal,
+        greater,
+        greater_equal,
+        equal,
+        not_equal,
+        jump_if_false,
+        jump,
+        ret,
+    };
+
+    inline char const*
+    opcode_name(opcode op) {
+        switch (op) {
+        case opcode::push: return "push";
+        case opcode::load: return "load";
+        case opcode::load_slot: return "lds";
+        case opcode::store_slot: return "sts";
+        case opcode::mod: return "mod";
+        case opcode::mod_const: return "modc";
+        case opcode::logical_and: return "and";
+        case opcode::logical_or: return "or";
+        case opcode::less: return "lt";
+        case opcode::less_equal: return "le";
+        case opcode::greater: return "gt";
+        case opcode::greater_equal: return "ge";
+        case opcode::equal: return "eq";
+        case opcode::not_equal: return "ne";
+        case opcode::jump_if_false: return "jz";
+        case opcode::jump: return "jmp";
+        case opcode::ret: return "ret";
+        }
+        return "?";
+    }
+
+    struct instruction {
+        opcode op;
+        uint arg;
+    };
+
+    // Maximum number of values a program may keep on the stack at once.
+    constexpr std::size_t max_stack = 256;
+
+    // Maximum number of shared subexpressions hoisted into slots.
+    constexpr std::size_t max_slots = 32;
+
+    struct program {
+        std::vector<instruction> code;
+        std::vector<divisor> divisors;
+        // Printed form of the subexpression held by each slot.
+        std::vector<std::string> slots;
+        std::size_t stack_size = 0;
+    };
+
+    // Numbers structurally identical subtrees alike. A node's number is
+    // looked up from its kind, its operators and the numbers of its
+    // children, so each node is visited once and no subtree is printed or
+    // compared with another.
+    struct subtree_numbers {
+        typedef std::size_t result_type;
+
+        std::unordered_map<ast::operand const*, std::size_t> numbers;
+        std::map<std::vector<std::size_t>, std::size_t> known;
+        // Nodes in the subtrees with each number.
+        std::vector<std::size_t> sizes;
+
+        enum shape : std::size_t {
+            nil_shape,
+            chain_shape,
+            conditional_shape,
+            constant_shape,
+            variable_shape,
+        };
+
+        // The number of `ast`, after numbering every subtree of it.
+        result_type
+        operator()(ast::operand const& ast) {
+            const std::size_t number{boost::apply_visitor(*this, ast.get())};
+            numbers[&ast] = number;
+            return number;
+        }
+
+        std::size_t
+        operator[](ast::operand const& ast) const {
+            return numbers.at(&ast);
+        }
+
+        result_type
+        operator()(ast::nil) {
+            return find({nil_shape}, 1);
+        }
+
+        // A binary operator is numbered as a chain of one operation.
+        result_type
+        operator()(ast::expression const& ast) {
+            std::vector<std::size_t> key{chain_shape};
+            std::size_t size = 1;
+            add(key, size, ast.lhs);
+            BOOST_FOREACH (ast::operation const& op, ast.rhs) {
+                key.push_back(static_cast<std::size_t>(op.op.code));
+                add(key, size, op.rhs);
+            }
+            return find(std::move(key), size);
+        }
+
+        result_type
+        operator()(ast::binary_op const& ast) {
+            std::vector<std::size_t> key{chain_shape};
+            std::size_t size = 1;
+            add(key, size, ast.lhs);
+            key.push_back(static_cast<std::size_t>(ast.op.code));
+            add(key, size, ast.rhs);
+            return find(std::move(key), size);
+        }
+
+        result_type
+        operator()(ast::conditional_op const& ast) {
+            std::vector<std::size_t> key{conditional_shape};
+            std::size_t size = 1;
+            add(key, size, ast.lhs);
+            add(key, size, ast.rhs_true);
+            add(key, size, ast.rhs_false);
+            return find(std::move(key), size);
+        }
+
+        result_type
+        operator()(uint const& ast) {
+            return find({constant_shape, ast}, 1);
+        }
+
+        result_type
+        operator()(ast::variable const& ast) {
+            return find({variable_shape, ast.slot}, 1);
+        }
+
+        void
+        add(std::vector<std::size_t>& key,
+            std::size_t& size,
+            ast::operand const& child) {
+            const std::size_t number{(*this)(child)};
+            key.push_back(number);
+            size += sizes[number];
+        }
+
+        std::size_t
+        find(std::vector<std::size_t> key, std::size_t size) {
+            auto found = known.emplace(std::move(key), sizes.size());
+            if (found.second) {
+                sizes.push_back(size);
+            }
+            return found.first->second;
+        }
+    };
+
+    // Counts the subtrees of a region of a numbered tree, other than
+    // constants and variables, and returns the numbers of those that every
+    // evaluation of the region evaluates. Both operands of every operator
+    // are evaluated, the condition of a `?:` is, and a subtree in a branch
+    // is only if the other branch evaluates it too.
+    struct subtree_counter {
+        typedef std::set<std::size_t> result_type;
+
+        struct entry {
+            std::size_t count = 0;
+            ast::operand const* node = nullptr;
+        };
+        subtree_numbers const& numbers;
+        std::map<std::size_t, entry> subtrees;
+
+        result_type
+        operator()(ast::operand const& ast) {
+            if (boost::get<uint>(&ast.get()) ||
+                boost::get<ast::variable>(&ast.get())) {
+                return {};
+            }
+            const std::size_t number{numbers[ast]};
+            entry& found = subtrees[number];
+            ++found.count;
+            found.node = &ast;
+            result_type always{boost::apply_visitor(*this, ast.get())};
+            always.insert(number);
+            return always;
+        }
+
+        result_type
+        operator()(ast::nil) {
+            return {};
+        }
+
+        result_type
+        operator()(ast::expression const& ast) {
+            result_type always{(*this)(ast.lhs)};
+            BOOST_FOREACH (ast::operation const& op, ast.rhs) {
+                merge(always, (*this)(op.rhs));
+            }
+            return always;
+        }
+
+        result_type
+        operator()(ast::binary_op const& ast) {
+            result_type always{(*this)(ast.lhs)};
+            merge(always, (*this)(ast.rhs));
+            return always;
+        }
+
+        result_type
+        operator()(ast::conditional_op const& ast) {
+            result_type always{(*this)(ast.lhs)};
+            result_type yes{(*this)(ast.rhs_true)};
+            result_type no{(*this)(ast.rhs_false)};
+            if (yes.size() > no.size()) {
+                std::swap(yes, no);
+            }
+            for (std::size_t number : yes) {
+                if (no.count(number)) {
+                    always.insert(number);
+                }
+            }
+            return always;
+        }
+
+        result_type
+        operator()(uint const&) {
+            return {};
+        }
+
+        result_type
+        operator()(ast::variable const&) {
+            return {};
+        }
+
+        // Adds `from` to `into`, inserting the smaller into the larger.
+        static void
+        merge(result_type& into, result_type&& from) {
+            if (into.size() < from.size()) {
+                std::swap(into, from);
+            }
+            into.insert(from.begin(), from.end());
+        }
+    };
+
+    // The subtrees worth computing once at the start of `region`: those
+    // that every evaluation of it evaluates and that it holds more than
+    // once, smallest first, so that larger ones can reuse them.
+    inline std::vector<ast::operand const*>
+    common_subexpressions(
+        ast::operand const& region, subtree_numbers const& numbers) {
+        subtree_counter counter{numbers, {}};
+        const subtree_counter::result_type always{counter(region)};
+        std::vector<std::size_t> common;
+        for (std::size_t number : always) {
+            if (counter.subtrees[number].count > 1) {
+                common.push_back(number);
+            }
+        }
+        std::stable_sort(
+            common.begin(), common.end(), [&](std::size_t a, std::size_t b) {
+                return numbers.sizes[a] < numbers.sizes[b];
+            });
+        std::vector<ast::operand const*> nodes;
+        for (std::size_t number : common) {
+            nodes.push_back(counter.subtrees[number].node);
+        }
+        return nodes;
+    }
+
+    // Lowers an ast::operand into a flat instruction array. Conditionals
+    // become forward jumps, so evaluation never recurses.
+    struct compiler {
+        typedef bool result_type;
+
+        compiler(program& out, std::string& error) : out(out), error(error) {}
+        program& out;
+        std::string& error;
+        std::size_t depth = 0;
+        subtree_numbers numbers;
+        // Slots holding the subtrees with these numbers.
+        std::map<std::size_t, uint> shared;
+
+        result_type
+        operator()(ast::operand const& ast) {
+            if (!shared.empty()) {
+                auto found = shared.find(numbers[ast]);
+                if (found != shared.end()) {
+                    emit(opcode::load_slot, found->second, 1);
+                    return true;
+                }
+            }
+            return boost::apply_visitor(*this, ast.get());
+        }
+
+        // Compiles `region`, the whole rule or a branch of a `?:`, after
+        // storing its common_subexpressions() in slots that the rest of the
+        // region reads instead. A subtree that only some paths evaluate is
+        // thus never computed up front, and the slots are only read where
+        // their store has run.
+        bool
+        region(ast::operand const& ast) {
+            std::vector<std::size_t> hoisted;
+            for (ast::operand const* subtree :
+                 common_subexpressions(ast, numbers)) {
+                const std::size_t number{numbers[*subtree]};
+                if (shared.count(number)) {
+                    continue;
+                }
+                if (out.slots.size() == max_slots) {
+                    break;
+                }
+                if (!(*this)(*subtree)) {
+                    return false;
+                }
+                const uint slot = out.slots.size();
+                emit(opcode::store_slot, slot, -1);
+                shared.emplace(number, slot);
+                out.slots.push_back(ast::to_string(*subtree));
+                hoisted.push_back(number);
+            }
+            if (!(*this)(ast)) {
+                return false;
+            }
+            for (std::size_t number : hoisted) {
+                shared.erase(number);
+            }
+            return true;
+        }
+
+        result_type
+        operator()(ast::nil) {
+            error = "empty operand";
+            return false;
+        }
+
+        result_type
+        operator()(ast::expression const& ast) {
+            if (!(*this)(ast.lhs)) {
+                return false;
+            }
+            BOOST_FOREACH (ast::operation const& op, ast.rhs) {
+                if (!emit_operation(op.op, op.rhs)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        result_type
+        operator()(ast::binary_op const& ast) {
+            return (*this)(ast.lhs) && emit_operation(ast.op, ast.rhs);
+        }
+
+        result_type
+        operator()(ast::conditional_op const& ast) {
+            if (!(*this)(ast.lhs)) {
+                return false;
+            }
+            const std::size_t jump_false{emit(opcode::jump_if_false, 0, -1)};
+            if (!region(ast.rhs_true)) {
+                return false;
+            }
+            const std::size_t jump_end{emit(opcode::jump, 0, -1)};
+            out.code[jump_false].arg = out.code.size();
+            if (!region(ast.rhs_false)) {
+                return false;
+            }
+            out.code[jump_end].arg = out.code.size();
+            return true;
+        }
+
+        result_type
+        operator()(uint const& ast) {
+            emit(opcode::push, ast, 1);
+            return true;
+        }
+
+        result_type
+        operator()(ast::variable const& ast) {
+            emit(opcode::load, ast.slot, 1);
+            return true;
+        }
+
+        // Emits `acc = acc <op> rhs`. A constant modulus is strength-reduced
+        // to a multiply by its precomputed reciprocal; zero is rejected.
+        bool
+        emit_operation(
+            ast::binary_operator const& op, ast::operand const& rhs) {
+            uint const* constant = boost::get<uint>(&rhs.get());
+            if (op.code == ast::optoken::mod && constant) {
+                if (*constant == 0) {
+                    error = "modulo by constant zero";
+                    return false;
+                }
+                emit(opcode::mod_const, divisor_index(*constant), 0);
+                return true;
+            }
+            return (*this)(rhs) && emit_operator(op);
+        }
+
+        bool
+        emit_operator(ast::binary_operator const& op) {
+            switch (op.code) {
+            case ast::optoken::mod: emit(opcode::mod, 0, -1); return true;
+            case ast::optoken::logical_and:
+                emit(opcode::logical_and, 0, -1);
+                return true;
+            case ast::optoken::logical_or:
+                emit(opcode::logical_or, 0, -1);
+                return true;
+            case ast::optoken::less: emit(opcode::less, 0, -1); return true;
+            case ast::optoken::less_equal:
+                emit(opcode::less_equal, 0, -1);
+                return true;
+            case ast::optoken::greater:
+                emit(opcode::greater, 0, -1);
+                return true;
+            case ast::optoken::greater_equal:
+                emit(opcode::greater_equal, 0, -1);
+                return true;
+            case ast::optoken::equal: emit(opcode::equal, 0, -1); return true;
+            case ast::optoken::not_equal:
+                emit(opcode::not_equal, 0, -1);
+                return true;
+            }
+            error = std::string("unknown operator '") + op.name() + "'";
+            return false;
+        }
+
+        uint
+        divisor_index(uint value) {
+            for (std::size_t idx = 0; idx < out.divisors.size(); ++idx) {
+                if (out.divisors[idx].value == value) {
+                    return idx;
+                }
+            }
+            out.divisors.emplace_back(value);
+            return out.divisors.size() - 1;
+        }
+
+        std::size_t
+        emit(opcode op, uint arg, int stack_effect) {
+            out.code.push_back({op, arg});
+            depth += stack_effect;
+            if (depth > out.stack_size) {
+                out.stack_size = depth;
+            }
+            return out.code.size() - 1;
+        }
+    };
+
+    inline bool
+    compile(ast::operand const& ast, program& out, std::string& error) {
+        out = program{};
+        compiler compile(out, error);
+        compile.numbers(ast);
+        if (!compile.region(ast)) {
+            return false;
+        }
+        if (out.stack_size > max_stack) {
+            error = "expression is nested too deeply";
+            return false;
+        }
+        compile.emit(opcode::ret, 0, -1);
+        return true;
+    }
+
+    // Runs compiled code. The accumulator holds the top of the stack;
+    // `stack` only ever holds values spilled by `push` and `load`.
+    inline uint
+    run(instruction const* code, divisor const* divisors, uint n) {
+        const uint variables[ast::variable_count]{n};
+        uint stack[max_stack];
+        uint slots[max_slots];
+        uint* sp = stack;
+        uint acc = 0;
+        instruction const* pc = code;
+
+        for (;;) {
+            instruction const& ins = *pc++;
+            switch (ins.op) {
+            case opcode::push:
+                *sp++ = acc;
+                acc = ins.arg;
+                break;
+            case opcode::load:
+                *sp++ = acc;
+                acc = variables[ins.arg];
+                break;
+            case opcode::load_slot:
+                *sp++ = acc;
+                acc = slots[ins.arg];
+                break;
+            case opcode::store_slot:
+                slots[ins.arg] = acc;
+                acc = *--sp;
+                break;
+            case opcode::mod: {
+                const uint lhs = *--sp;
+                acc = acc ? lhs % acc : 0;
+                break;
+            }
+            case opcode::mod_const:
+                acc = divisors[ins.arg].remainder(acc);
+                break;
+            case opcode::logical_and: acc = *--sp && acc; break;
+            case opcode::logical_or: acc = *--sp || acc; break;
+            case opcode::less: acc = *--sp < acc; break;
+            case opcode::less_equal: acc = *--sp <= acc; break;
+            case opcode::greater: acc = *--sp > acc; break;
+            case opcode::greater_equal: acc = *--sp >= acc; break;
+            case opcode::equal: acc = *--sp == acc; break;
+            case opcode::not_equal: acc = *--sp != acc; break;
+            case opcode::jump_if_false: {
+                const uint cond = acc;
+                acc = *--sp;
+                if (!cond) {
+                    pc = code + ins.arg;
+                }
+                break;
+            }
+            case opcode::jump: pc = code + ins.arg; break;
+            case opcode::ret: return acc;
+            }
+        }
+    }
+
+    inline uint
+    run(program const& prog, uint n) {
+        return run(prog.code.data(), prog.divisors.data(), n);
+    }
+
+    // How an instruction changes the stack depth as the compiler counts
+    // it. run() moves its stack pointer by the same amount, except after
+    // `jump`, which keeps the value of the branch just finished that the
+    // count drops, and `ret`.
+    inline int
+    stack_effect(opcode op) {
+        switch (op) {
+        case opcode::push:
+        case opcode::load:
+        case opcode::load_slot: return 1;
+        case opcode::mod_const: return 0;
+        default: return -1;
+        }
+    }
+
+    // Checks code that compile() did not produce in this process, such as
+    // code read from a file, before it is run: operands in range, jumps
+    // forward onto an instruction, a `ret` last, and the same stack depth
+    // on every path into an instruction, within `max_stack`. Allocates
+    // nothing unless it fails.
+    inline bool
+    verify(
+        instruction const* code,
+        std::size_t size,
+        std::size_t divisors,
+        std::size_t slots,
+        std::string& error) {
+        if (size == 0 || code[size - 1].op != opcode::ret) {
+            error = "code does not end in ret";
+            return false;
+        }
+        if (slots > max_slots) {
+            error = "too many slots";
+            return false;
+        }
+        std::size_t depth = 0;
+        for (std::size_t idx = 0; idx < size; ++idx) {
+            instruction const& ins = code[idx];
+            const bool jumps{
+                ins.op == opcode::jump_if_false || ins.op == opcode::jump};
+            bool in_range{true};
+            switch (ins.op) {
+            case opcode::load: in_range = ins.arg < ast::variable_count; break;
+            case opcode::mod_const: in_range = ins.arg < divisors; break;
+            case opcode::load_slot:
+            case opcode::store_slot: in_range = ins.arg < slots; break;
+            case opcode::jump_if_false:
+            case opcode::jump:
+                in_range = ins.arg > idx && ins.arg < size;
+                break;
+            default: in_range = ins.op <= opcode::ret; break;
+            }
+            if (!in_range) {
+                error = "bad operand at " + std::to_string(idx);
+                return false;
+            }
+            const int effect{stack_effect(ins.op)};
+            if (effect < 0 && depth == 0) {
+                error = "stack underflow at " + std::to_string(idx);
+                return false;
+            }
+            depth += effect;
+            if (depth > max_stack) {
+                error = "stack overflow at " + std::to_string(idx);
+                return false;
+            }
+            // The code a jump skips must leave the count where the jump
+            // lands: unchanged past `jump_if_false`, which has popped the
+            // condition already, and one deeper past `jump`.
+            if (jumps) {
+                int skipped = 0;
+                for (std::size_t next = idx + 1; next < ins.arg; ++next) {
+                    skipped += stack_effect(code[next].op);
+                }
+                if (skipped != (ins.op == opcode::jump ? 1 : 0)) {
+                    error = "inconsistent stack at " + std::to_string(ins.arg);
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    struct disassembler {
+        typedef void result_type;
+
+        result_type
+        operator()(program const& prog) const {
+            for (std::size_t idx = 0; idx < prog.slots.size(); ++idx) {
+                std::cout << "  slot " << idx << " = " << prog.slots[idx]
+                          << std::endl;
+            }
+            for (std::size_t idx = 0; idx < prog.code.size(); ++idx) {
+                instruction const& ins = prog.code[idx];
+                std::cout << std::setw(4) << idx << "  "
+                          << opcode_name(ins.op);
+                switch (ins.op) {
+                case opcode::mod_const:
+                    std::cout << ' ' << prog.divisors[ins.arg].value;
+                    break;
+                case opcode::load:
+                    std::cout << ' ' << ast::variable_names[ins.arg];
+                    break;
+                case opcode::push:
+                case opcode::load_slot:
+                case opcode::store_slot:
+                case opcode::jump_if_false:
+                case opcode::jump: std::cout << ' ' << ins.arg; break;
+                default: break;
+                }
+                std::cout << std::endl;
+            }
+        }
+    };
+
+} // namespace vm
+} // namespace client
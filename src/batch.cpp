@@ -0,0 +1,253 @@
+#include <map>
+#include <tuple>
+#include <boost/foreach.hpp>
+
+#include "ast.hpp"
+#include "batch_kernel.hpp"
+
+namespace client {
+namespace batch {
+    divisor32
+    make_divisor32(uint value) {
+        uint log2 = 0;
+        while ((value >> log2) > 1) {
+            ++log2;
+        }
+        if ((value & (value - 1)) == 0) {
+            // With a zero magic the quotient is (n >> 1) >> (log2 - 1).
+            return {value, 0, log2 - 1};
+        }
+        const std::uint64_t numerator{std::uint64_t{1} << (32 + log2)};
+        uint magic = numerator / value;
+        const uint rem = numerator % value;
+        const uint twice_rem = rem + rem;
+        magic += magic;
+        if (twice_rem >= value || twice_rem < rem) {
+            magic += 1;
+        }
+        return {value, magic + 1, log2};
+    }
+
+    // Lowers the AST into registers. Identical instructions are emitted
+    // once, which also shares repeated subexpressions such as `n % 100`.
+    struct compiler {
+        typedef bool result_type;
+
+        compiler(program& out, std::string& error) : out(out), error(error) {}
+        program& out;
+        std::string& error;
+        uint result = 0;
+        std::map<std::tuple<opcode, uint, uint, uint>, uint> emitted;
+
+        result_type
+        operator()(ast::operand const& ast) {
+            return boost::apply_visitor(*this, ast.get());
+        }
+
+        result_type
+        operator()(ast::nil) {
+            error = "empty operand";
+            return false;
+        }
+
+        result_type
+        operator()(ast::expression const& ast) {
+            if (!(*this)(ast.lhs)) {
+                return false;
+            }
+            BOOST_FOREACH (ast::operation const& op, ast.rhs) {
+                if (!emit_operation(op.op, op.rhs)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        result_type
+        operator()(ast::binary_op const& ast) {
+            return (*this)(ast.lhs) && emit_operation(ast.op, ast.rhs);
+        }
+
+        result_type
+        operator()(ast::conditional_op const& ast) {
+            if (!(*this)(ast.lhs)) {
+                return false;
+            }
+            const uint condition{result};
+            if (!(*this)(ast.rhs_true)) {
+                return false;
+            }
+            const uint if_true{result};
+            if (!(*this)(ast.rhs_false)) {
+                return false;
+            }
+            return emit(opcode::select, condition, if_true, result);
+        }
+
+        result_type
+        operator()(uint const& ast) {
+            return emit(opcode::constant, ast);
+        }
+
+        // opcode::variable loads the block of n, so every slot is n.
+        result_type
+        operator()(ast::variable const&) {
+            static_assert(
+                ast::variable_count == 1, "batches only carry values of n");
+            return emit(opcode::variable);
+        }
+
+        bool
+        emit_operation(
+            ast::binary_operator const& op, ast::operand const& rhs) {
+            const uint lhs{result};
+            uint const* constant = boost::get<uint>(&rhs.get());
+            if (op.code == ast::optoken::mod && constant) {
+                if (*constant == 0) {
+                    error = "modulo by constant zero";
+                    return false;
+                }
+                if (*constant == 1) {
+                    return emit(opcode::constant, 0);
+                }
+                return emit(opcode::mod_const, lhs, divisor_index(*constant));
+            }
+            if (!(*this)(rhs)) {
+                return false;
+            }
+            switch (op.code) {
+            case ast::optoken::mod: return emit(opcode::mod, lhs, result);
+            case ast::optoken::logical_and:
+                return emit(opcode::logical_and, lhs, result);
+            case ast::optoken::logical_or:
+                return emit(opcode::logical_or, lhs, result);
+            case ast::optoken::less: return emit(opcode::less, lhs, result);
+            case ast::optoken::less_equal:
+                return emit(opcode::less_equal, lhs, result);
+            case ast::optoken::greater:
+                return emit(opcode::greater, lhs, result);
+            case ast::optoken::greater_equal:
+                return emit(opcode::greater_equal, lhs, result);
+            case ast::optoken::equal: return emit(opcode::equal, lhs, result);
+            case ast::optoken::not_equal:
+                return emit(opcode::not_equal, lhs, result);
+            }
+            error = std::string("unknown operator '") + op.name() + "'";
+            return false;
+        }
+
+        uint
+        divisor_index(uint value) {
+            for (std::size_t idx = 0; idx < out.divisors.size(); ++idx) {
+                if (out.divisors[idx].value == value) {
+                    return idx;
+                }
+            }
+            out.divisors.push_back(make_divisor32(value));
+            return out.divisors.size() - 1;
+        }
+
+        bool
+        emit(opcode op, uint a = 0, uint b = 0, uint c = 0) {
+            auto found = emitted.find(std::make_tuple(op, a, b, c));
+            if (found != emitted.end()) {
+                result = found->second;
+                return true;
+            }
+            if (out.code.size() == max_registers) {
+                error = "expression is too large for batch evaluation";
+                return false;
+            }
+            result = out.code.size();
+            out.code.push_back({op, a, b, c});
+            emitted.emplace(std::make_tuple(op, a, b, c), result);
+            return true;
+        }
+    };
+
+    bool
+    compile(ast::operand const& ast, program& out, std::string& error) {
+        out = program{};
+        compiler compile(out, error);
+        if (!compile(ast)) {
+            return false;
+        }
+        // The kernels read the result from the last register.
+        if (compile.result != out.code.size() - 1) {
+            if (out.code.size() == max_registers) {
+                error = "expression is too large for batch evaluation";
+                return false;
+            }
+            const instruction last = out.code[compile.result];
+            out.code.push_back(last);
+        }
+        return true;
+    }
+
+    char const*
+    isa_name(isa target) {
+        switch (target) {
+        case isa::scalar: return "scalar";
+        case isa::sse4: return "sse4.1";
+        case isa::avx2: return "avx2";
+        case isa::best: return isa_name(detect_isa());
+        }
+        return "?";
+    }
+
+    isa
+    detect_isa() {
+#if defined(__x86_64__) || defined(__i386__)
+        static const isa detected = [] {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) {
+                return isa::avx2;
+            }
+            if (__builtin_cpu_supports("sse4.1")) {
+                return isa::sse4;
+            }
+            return isa::scalar;
+        }();
+        return detected;
+#else
+        return isa::scalar;
+#endif
+    }
+
+    void
+    evaluate_scalar(
+        instruction const* code,
+        std::size_t size,
+        divisor32 const* divisors,
+        uint const* ns,
+        std::uint8_t* out,
+        std::size_t count) {
+        run<scalar_lanes>(code, size, divisors, ns, out, count);
+    }
+
+    void
+    evaluate(
+        program const& prog,
+        uint const* ns,
+        std::uint8_t* out,
+        std::size_t count,
+        isa target) {
+        if (target == isa::best) {
+            target = detect_isa();
+        }
+        auto kernel = evaluate_scalar;
+        if (target == isa::avx2) {
+            kernel = evaluate_avx2;
+        } else if (target == isa::sse4) {
+            kernel = evaluate_sse4;
+        }
+        kernel(prog.code.data(),
+               prog.code.size(),
+               prog.divisors.data(),
+               ns,
+               out,
+               count);
+    }
+
+} // namespace batch
+} // namespace client
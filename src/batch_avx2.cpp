@@ -0,0 +1,145 @@
+#include "batch_kernel.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+namespace client {
+namespace batch {
+    namespace {
+        struct avx2_lanes {
+            typedef __m256i vector;
+            static constexpr std::size_t width = 8;
+
+            static vector
+            load(uint const* src) {
+                return _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const*>(src));
+            }
+
+            static void
+            store(uint* dst, vector v) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), v);
+            }
+
+            static vector
+            set1(uint v) {
+                return _mm256_set1_epi32(v);
+            }
+
+            static vector
+            add(vector a, vector b) {
+                return _mm256_add_epi32(a, b);
+            }
+
+            static vector
+            sub(vector a, vector b) {
+                return _mm256_sub_epi32(a, b);
+            }
+
+            static vector
+            shift_right(vector a, uint s) {
+                return _mm256_srl_epi32(a, _mm_cvtsi32_si128(s));
+            }
+
+            static vector
+            mullo(vector a, vector b) {
+                return _mm256_mullo_epi32(a, b);
+            }
+
+            static vector
+            min(vector a, vector b) {
+                return _mm256_min_epu32(a, b);
+            }
+
+            static vector
+            max(vector a, vector b) {
+                return _mm256_max_epu32(a, b);
+            }
+
+            static vector
+            bit_and(vector a, vector b) {
+                return _mm256_and_si256(a, b);
+            }
+
+            static vector
+            bit_or(vector a, vector b) {
+                return _mm256_or_si256(a, b);
+            }
+
+            static vector
+            bit_andnot(vector a, vector b) {
+                return _mm256_andnot_si256(a, b);
+            }
+
+            // High halves of the even and odd lane products, interleaved.
+            static vector
+            mulhi(vector a, vector b) {
+                const vector even{
+                    _mm256_srli_epi64(_mm256_mul_epu32(a, b), 32)};
+                const vector odd{_mm256_mul_epu32(
+                    _mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32))};
+                return _mm256_blend_epi32(even, odd, 0xAA);
+            }
+
+            static vector
+            equal(vector a, vector b) {
+                return _mm256_cmpeq_epi32(a, b);
+            }
+
+            static vector
+            blend(vector is_false, vector if_true, vector if_false) {
+                return _mm256_blendv_epi8(if_true, if_false, is_false);
+            }
+
+            // packus works within 128-bit halves, so the packed dwords come
+            // out as v0.lo v1.lo v2.lo v3.lo v0.hi ...; permute them back.
+            static void
+            pack(vector const* v, std::uint8_t* out) {
+                const vector limit{_mm256_set1_epi32(255)};
+                const vector lo{_mm256_packus_epi32(
+                    _mm256_min_epu32(v[0], limit),
+                    _mm256_min_epu32(v[1], limit))};
+                const vector hi{_mm256_packus_epi32(
+                    _mm256_min_epu32(v[2], limit),
+                    _mm256_min_epu32(v[3], limit))};
+                const vector bytes{_mm256_permutevar8x32_epi32(
+                    _mm256_packus_epi16(lo, hi),
+                    _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7))};
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), bytes);
+            }
+        };
+    } // namespace
+
+    void
+    evaluate_avx2(
+        instruction const* code,
+        std::size_t size,
+        divisor32 const* divisors,
+        uint const* ns,
+        std::uint8_t* out,
+        std::size_t count) {
+        run<avx2_lanes>(code, size, divisors, ns, out, count);
+    }
+
+} // namespace batch
+} // namespace client
+
+#else
+
+namespace client {
+namespace batch {
+    void
+    evaluate_avx2(
+        instruction const* code,
+        std::size_t size,
+        divisor32 const* divisors,
+        uint const* ns,
+        std::uint8_t* out,
+        std::size_t count) {
+        run<scalar_lanes>(code, size, divisors, ns, out, count);
+    }
+
+} // namespace batch
+} // namespace client
+
+#endif
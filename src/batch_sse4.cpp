@@ -0,0 +1,137 @@
+#include "batch_kernel.hpp"
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+
+namespace client {
+namespace batch {
+    namespace {
+        struct sse4_lanes {
+            typedef __m128i vector;
+            static constexpr std::size_t width = 4;
+
+            static vector
+            load(uint const* src) {
+                return _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+            }
+
+            static void
+            store(uint* dst, vector v) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+            }
+
+            static vector
+            set1(uint v) {
+                return _mm_set1_epi32(v);
+            }
+
+            static vector
+            add(vector a, vector b) {
+                return _mm_add_epi32(a, b);
+            }
+
+            static vector
+            sub(vector a, vector b) {
+                return _mm_sub_epi32(a, b);
+            }
+
+            static vector
+            shift_right(vector a, uint s) {
+                return _mm_srl_epi32(a, _mm_cvtsi32_si128(s));
+            }
+
+            static vector
+            mullo(vector a, vector b) {
+                return _mm_mullo_epi32(a, b);
+            }
+
+            static vector
+            min(vector a, vector b) {
+                return _mm_min_epu32(a, b);
+            }
+
+            static vector
+            max(vector a, vector b) {
+                return _mm_max_epu32(a, b);
+            }
+
+            static vector
+            bit_and(vector a, vector b) {
+                return _mm_and_si128(a, b);
+            }
+
+            static vector
+            bit_or(vector a, vector b) {
+                return _mm_or_si128(a, b);
+            }
+
+            static vector
+            bit_andnot(vector a, vector b) {
+                return _mm_andnot_si128(a, b);
+            }
+
+            // High halves of the even and odd lane products, interleaved.
+            static vector
+            mulhi(vector a, vector b) {
+                const vector even{_mm_srli_epi64(_mm_mul_epu32(a, b), 32)};
+                const vector odd{_mm_mul_epu32(
+                    _mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32))};
+                return _mm_blend_epi16(even, odd, 0xCC);
+            }
+
+            static vector
+            equal(vector a, vector b) {
+                return _mm_cmpeq_epi32(a, b);
+            }
+
+            static vector
+            blend(vector is_false, vector if_true, vector if_false) {
+                return _mm_blendv_epi8(if_true, if_false, is_false);
+            }
+
+            static void
+            pack(vector const* v, std::uint8_t* out) {
+                const vector limit{_mm_set1_epi32(255)};
+                const vector lo{_mm_packus_epi32(
+                    _mm_min_epu32(v[0], limit), _mm_min_epu32(v[1], limit))};
+                const vector hi{_mm_packus_epi32(
+                    _mm_min_epu32(v[2], limit), _mm_min_epu32(v[3], limit))};
+                _mm_storeu_si128(
+                    reinterpret_cast<__m128i*>(out), _mm_packus_epi16(lo, hi));
+            }
+        };
+    } // namespace
+
+    void
+    evaluate_sse4(
+        instruction const* code,
+        std::size_t size,
+        divisor32 const* divisors,
+        uint const* ns,
+        std::uint8_t* out,
+        std::size_t count) {
+        run<sse4_lanes>(code, size, divisors, ns, out, count);
+    }
+
+} // namespace batch
+} // namespace client
+
+#else
+
+namespace client {
+namespace batch {
+    void
+    evaluate_sse4(
+        instruction const* code,
+        std::size_t size,
+        divisor32 const* divisors,
+        uint const* ns,
+        std::uint8_t* out,
+        std::size_t count) {
+        run<scalar_lanes>(code, size, divisors, ns, out, count);
+    }
+
+} // namespace batch
+} // namespace client
+
+#endif
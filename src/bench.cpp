@@ -0,0 +1,540 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/spirit/home/x3.hpp>
+
+#include "CLI/App.hpp"
+#include "CLI/Formatter.hpp"
+#include "CLI/Config.hpp"
+
+#include "ast.hpp"
+#include "ast_adapted.hpp"
+#include "batch.hpp"
+#include "compiled_rule.hpp"
+#include "corpus.hpp"
+#include "flat.hpp"
+#include "kernels.hpp"
+#include "parser.hpp"
+#include "pratt.hpp"
+
+// Microbenchmarks for every corpus rule: parse time, allocations per parse,
+// and ns per evaluation for each engine over several distributions of n.
+// Every measurement is warmed up once and repeated; the median and the
+// median absolute deviation are reported, so a few descheduled runs do not
+// move the result.
+
+typedef unsigned int uint;
+namespace x3 = boost::spirit::x3;
+
+namespace {
+    std::atomic<std::size_t> allocations{0};
+} // namespace
+
+void*
+operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void
+operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void
+operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+    typedef std::chrono::steady_clock clock;
+
+    volatile std::uint64_t sink;
+
+    struct statistics {
+        double median = 0;
+        double mad = 0;
+        double min = 0;
+    };
+
+    double
+    median_of(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        const std::size_t middle{values.size() / 2};
+        return values.size() % 2
+                   ? values[middle]
+                   : (values[middle - 1] + values[middle]) / 2;
+    }
+
+    statistics
+    summarize(std::vector<double> const& samples) {
+        statistics out;
+        out.median = median_of(samples);
+        out.min = *std::min_element(samples.begin(), samples.end());
+        std::vector<double> deviations;
+        for (double sample : samples) {
+            deviations.push_back(std::fabs(sample - out.median));
+        }
+        out.mad = median_of(deviations);
+        return out;
+    }
+
+    // How many times faster `candidate` is than `baseline`, by median. Only
+    // meaningful between parses into the same kind of tree.
+    double
+    speedup(statistics const& baseline, statistics const& candidate) {
+        return candidate.median > 0 ? baseline.median / candidate.median : 0;
+    }
+
+    // Runs `body` once to warm up, then `repetitions` times, and returns
+    // the time per call divided by `items`, in nanoseconds.
+    template <typename Body>
+    statistics
+    measure(std::size_t repetitions, std::size_t items, Body const& body) {
+        body();
+        std::vector<double> samples;
+        for (std::size_t rep = 0; rep < repetitions; ++rep) {
+            const clock::time_point start{clock::now()};
+            body();
+            const std::chrono::duration<double, std::nano> elapsed{
+                clock::now() - start};
+            samples.push_back(elapsed.count() / items);
+        }
+        return summarize(samples);
+    }
+
+    struct distribution {
+        char const* name;
+        std::vector<uint> ns;
+    };
+
+    std::vector<distribution>
+    make_distributions(std::size_t size) {
+        std::mt19937 random(42);
+        std::vector<distribution> out;
+
+        out.push_back({"sequential", std::vector<uint>(size)});
+        std::iota(out.back().ns.begin(), out.back().ns.end(), 0);
+
+        out.push_back({"uniform", std::vector<uint>(size)});
+        std::uniform_int_distribution<uint> uniform;
+        for (uint& n : out.back().ns) {
+            n = uniform(random);
+        }
+
+        // Zipf with s = 1 over 1..1000: small counts dominate, as in the
+        // messages real programs print.
+        constexpr std::size_t ranks = 1000;
+        std::vector<double> cdf(ranks);
+        double total = 0;
+        for (std::size_t rank = 1; rank <= ranks; ++rank) {
+            total += 1.0 / rank;
+            cdf[rank - 1] = total;
+        }
+        out.push_back({"zipf", std::vector<uint>(size)});
+        std::uniform_real_distribution<double> unit(0, total);
+        for (uint& n : out.back().ns) {
+            n = std::lower_bound(cdf.begin(), cdf.end(), unit(random)) -
+                cdf.begin() + 1;
+        }
+        return out;
+    }
+
+    struct engine_result {
+        std::string engine;
+        std::vector<statistics> per_distribution;
+    };
+
+    struct rule_result {
+        std::size_t index;
+        std::string name;
+        std::string expression;
+        statistics parse;
+        std::size_t allocations = 0;
+        statistics flat_parse;
+        std::size_t flat_allocations = 0;
+        statistics pratt_parse;
+        std::size_t pratt_allocations = 0;
+        statistics pratt_flat_parse;
+        std::size_t pratt_flat_allocations = 0;
+        std::vector<engine_result> engines;
+    };
+
+    // Rejecting malformed headers, as found in third-party catalogs.
+    struct invalid_result {
+        char const* name;
+        std::string text;
+        std::string expected;
+        statistics reject;
+    };
+
+    std::vector<invalid_result>
+    make_invalid_inputs() {
+        std::vector<invalid_result> out;
+        out.push_back(
+            {"header line",
+             "nplurals=3; plural=(n%10==1 && n%100!=11 ? 0 : n != 0 ? 1 : 2);",
+             "",
+             {}});
+        std::string binary(64, '\0');
+        std::mt19937 random(7);
+        for (char& c : binary) {
+            c = static_cast<char>(random() | 0x80);
+        }
+        out.push_back({"binary", binary, "", {}});
+        const std::string polish{client::corpus::rules[17].expression};
+        out.push_back(
+            {"truncated", polish.substr(0, polish.size() / 2), "", {}});
+        out.push_back({"unknown variable", "(x == 1) ? 0 : 1", "", {}});
+        out.push_back({"trailing text", polish + " 1", "", {}});
+        return out;
+    }
+
+    std::string
+    quoted(std::string const& text) {
+        std::string out{"\""};
+        for (char c : text) {
+            const unsigned char byte = c;
+            if (byte < 0x20 || byte >= 0x7F) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", byte);
+                out += escaped;
+                continue;
+            }
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + '"';
+    }
+
+    void
+    print_json(
+        std::ostream& out,
+        std::vector<rule_result> const& results,
+        std::vector<distribution> const& distributions,
+        std::vector<invalid_result> const& invalid,
+        std::size_t repetitions) {
+        auto stats = [&](statistics const& value) {
+            out << "{\"median\": " << value.median << ", \"mad\": "
+                << value.mad << ", \"min\": " << value.min << '}';
+        };
+
+        out << "{\"repetitions\": " << repetitions
+            << ", \"values_per_distribution\": "
+            << distributions.front().ns.size() << ", \"rules\": [";
+        for (std::size_t idx = 0; idx < results.size(); ++idx) {
+            rule_result const& rule = results[idx];
+            out << (idx ? "," : "") << "\n  {\"index\": " << rule.index
+                << ", \"kernel\": " << quoted(rule.name)
+                << ", \"expression\": " << quoted(rule.expression)
+                << ", \"parse_ns\": ";
+            stats(rule.parse);
+            out << ", \"allocations_per_parse\": " << rule.allocations
+                << ", \"flat_parse_ns\": ";
+            stats(rule.flat_parse);
+            out << ", \"flat_allocations_per_parse\": "
+                << rule.flat_allocations << ", \"pratt_parse_ns\": ";
+            stats(rule.pratt_parse);
+            out << ", \"pratt_allocations_per_parse\": "
+                << rule.pratt_allocations << ", \"pratt_flat_parse_ns\": ";
+            stats(rule.pratt_flat_parse);
+            out << ", \"pratt_flat_allocations_per_parse\": "
+                << rule.pratt_flat_allocations << ", \"pratt_speedup\": "
+                << speedup(rule.parse, rule.pratt_parse)
+                << ", \"pratt_flat_speedup\": "
+                << speedup(rule.flat_parse, rule.pratt_flat_parse)
+                << ", \"eval_ns\": {";
+            for (std::size_t dist = 0; dist < distributions.size(); ++dist) {
+                out << (dist ? ", " : "") << quoted(distributions[dist].name)
+                    << ": {";
+                for (std::size_t eng = 0; eng < rule.engines.size(); ++eng) {
+                    out << (eng ? ", " : "")
+                        << quoted(rule.engines[eng].engine) << ": ";
+                    stats(rule.engines[eng].per_distribution[dist]);
+                }
+                out << '}';
+            }
+            out << "}}";
+        }
+        out << "\n], \"invalid\": [";
+        for (std::size_t idx = 0; idx < invalid.size(); ++idx) {
+            out << (idx ? "," : "") << "\n  {\"name\": "
+                << quoted(invalid[idx].name)
+                << ", \"text\": " << quoted(invalid[idx].text)
+                << ", \"expected\": " << quoted(invalid[idx].expected)
+                << ", \"reject_ns\": ";
+            stats(invalid[idx].reject);
+            out << '}';
+        }
+        out << "\n]}" << std::endl;
+    }
+
+    void
+    print_table(
+        std::ostream& out,
+        std::vector<rule_result> const& results,
+        std::vector<distribution> const& distributions,
+        std::vector<invalid_result> const& invalid) {
+        out << std::fixed;
+        for (rule_result const& rule : results) {
+            out << "rule " << rule.index << ' ' << rule.name << ": "
+                << rule.expression << std::endl;
+            out << "  parse " << std::setprecision(2) << rule.parse.median / 1e3
+                << " us +- " << rule.parse.mad / 1e3 << ", "
+                << rule.allocations << " allocations" << std::endl;
+            out << "  flat  " << std::setprecision(2)
+                << rule.flat_parse.median / 1e3 << " us +- "
+                << rule.flat_parse.mad / 1e3 << ", " << rule.flat_allocations
+                << " allocations" << std::endl;
+            out << "  pratt " << std::setprecision(2)
+                << rule.pratt_parse.median / 1e3 << " us +- "
+                << rule.pratt_parse.mad / 1e3 << ", " << rule.pratt_allocations
+                << " allocations, " << std::setprecision(1)
+                << speedup(rule.parse, rule.pratt_parse) << "x over parse"
+                << std::endl;
+            out << "  pratt flat " << std::setprecision(2)
+                << rule.pratt_flat_parse.median / 1e3 << " us +- "
+                << rule.pratt_flat_parse.mad / 1e3 << ", "
+                << rule.pratt_flat_allocations << " allocations, "
+                << std::setprecision(1)
+                << speedup(rule.flat_parse, rule.pratt_flat_parse)
+                << "x over flat" << std::endl;
+            out << "  ns/eval     ";
+            for (engine_result const& engine : rule.engines) {
+                out << std::setw(12) << engine.engine;
+            }
+            out << std::endl;
+            for (std::size_t dist = 0; dist < distributions.size(); ++dist) {
+                out << "  " << std::left << std::setw(12)
+                    << distributions[dist].name << std::right;
+                for (engine_result const& engine : rule.engines) {
+                    out << std::setw(12) << std::setprecision(2)
+                        << engine.per_distribution[dist].median;
+                }
+                out << std::endl;
+            }
+        }
+        out << "invalid input    bytes   expected      ns/reject      MB/s"
+            << std::endl;
+        for (invalid_result const& input : invalid) {
+            out << "  " << std::left << std::setw(16) << input.name
+                << std::right << std::setw(5) << input.text.size() << "   "
+                << std::left << std::setw(12) << input.expected << std::right
+                << std::setw(12) << std::setprecision(1)
+                << input.reject.median << std::setw(10)
+                << input.text.size() * 1e3 / input.reject.median << std::endl;
+        }
+    }
+} // namespace
+
+int
+main(int argc, char** argv) {
+    CLI::App app{
+        "plurals-bench measures parsing and evaluation of the standard "
+        "Gettext plural-forms rules."};
+
+    bool json{false};
+    app.add_flag("--json", json, "Print JSON instead of tables.")
+        ->required(false);
+    std::size_t repetitions{11};
+    app.add_option(
+           "--repetitions",
+           repetitions,
+           "Timed runs per measurement (default 11).")
+        ->required(false);
+    std::size_t size{16384};
+    app.add_option(
+           "--size", size, "Values of n per distribution (default 16384).")
+        ->required(false);
+    std::string only;
+    app.add_option(
+           "--engine",
+           only,
+           "Only measure this engine: kernel, table, jit, batch, vm or tree.")
+        ->required(false);
+
+    CLI11_PARSE(app, argc, argv);
+    repetitions = std::max<std::size_t>(repetitions, 1);
+    size = std::max<std::size_t>(size, 1);
+
+    const std::vector<distribution> distributions{make_distributions(size)};
+    std::vector<rule_result> results;
+
+    for (std::size_t idx = 0; idx < client::corpus::size; ++idx) {
+        const std::string text{client::corpus::rules[idx].expression};
+        rule_result result;
+        result.index = idx;
+        result.expression = text;
+
+        std::size_t before = allocations.load();
+        {
+            client::ast::operand program;
+            std::string::const_iterator iter = text.begin();
+            phrase_parse(
+                iter, text.end(), client::expression(), x3::space, program);
+            result.allocations = allocations.load() - before;
+        }
+        constexpr std::size_t parses = 100;
+        result.parse = measure(repetitions, parses, [&] {
+            for (std::size_t rep = 0; rep < parses; ++rep) {
+                client::ast::operand program;
+                std::string::const_iterator iter = text.begin();
+                phrase_parse(
+                    iter, text.end(), client::expression(), x3::space, program);
+                sink = sink + iter - text.begin();
+            }
+        });
+
+        before = allocations.load();
+        {
+            client::flat::tree program;
+            std::string error;
+            client::flat::parse(text, program, error);
+            result.flat_allocations = allocations.load() - before;
+        }
+        result.flat_parse = measure(repetitions, parses, [&] {
+            for (std::size_t rep = 0; rep < parses; ++rep) {
+                client::flat::tree program;
+                std::string error;
+                client::flat::parse(text, program, error);
+                sink = sink + program.size();
+            }
+        });
+
+        before = allocations.load();
+        {
+            client::ast::operand program;
+            std::size_t offset;
+            std::string expected;
+            client::pratt::parse(text, program, offset, expected);
+            result.pratt_allocations = allocations.load() - before;
+        }
+        result.pratt_parse = measure(repetitions, parses, [&] {
+            for (std::size_t rep = 0; rep < parses; ++rep) {
+                client::ast::operand program;
+                std::size_t offset;
+                std::string expected;
+                sink = sink +
+                       client::pratt::parse(text, program, offset, expected);
+            }
+        });
+
+        before = allocations.load();
+        {
+            client::flat::tree program;
+            std::size_t offset;
+            std::string expected;
+            client::pratt::parse(text, program, offset, expected);
+            result.pratt_flat_allocations = allocations.load() - before;
+        }
+        result.pratt_flat_parse = measure(repetitions, parses, [&] {
+            for (std::size_t rep = 0; rep < parses; ++rep) {
+                client::flat::tree program;
+                std::size_t offset;
+                std::string expected;
+                client::pratt::parse(text, program, offset, expected);
+                sink = sink + program.size();
+            }
+        });
+
+        for (client::engine target :
+             {client::engine::kernel,
+              client::engine::table,
+              client::engine::jit,
+              client::engine::vm,
+              client::engine::tree}) {
+            char const* name{client::engine_name(target)};
+            client::compiled_rule rule;
+            std::string error;
+            if (!client::compiled_rule::compile(text, target, rule, error)) {
+                continue;
+            }
+            if (auto kernel = client::kernels::find(rule.program())) {
+                result.name = kernel->name;
+            }
+            if (!only.empty() && only != name) {
+                continue;
+            }
+            engine_result engine{name, {}};
+            for (distribution const& dist : distributions) {
+                engine.per_distribution.push_back(
+                    measure(repetitions, dist.ns.size(), [&] {
+                        std::uint64_t sum = 0;
+                        for (uint n : dist.ns) {
+                            sum += rule(n);
+                        }
+                        sink = sink + sum;
+                    }));
+            }
+            result.engines.push_back(engine);
+        }
+
+        client::compiled_rule tree;
+        client::batch::program batch;
+        std::string error;
+        if ((only.empty() || only == "batch") &&
+            client::compiled_rule::compile(
+                text, client::engine::tree, tree, error) &&
+            client::batch::compile(tree.program(), batch, error)) {
+            std::vector<std::uint8_t> out(size);
+            engine_result engine{
+                std::string("batch-") +
+                    client::batch::isa_name(client::batch::detect_isa()),
+                {}};
+            for (distribution const& dist : distributions) {
+                engine.per_distribution.push_back(
+                    measure(repetitions, dist.ns.size(), [&] {
+                        client::batch::evaluate(
+                            batch, dist.ns.data(), out.data(), dist.ns.size());
+                        sink = sink + out[dist.ns.size() / 2];
+                    }));
+            }
+            result.engines.push_back(engine);
+        }
+
+        results.push_back(result);
+    }
+
+    std::vector<invalid_result> invalid{make_invalid_inputs()};
+    for (invalid_result& input : invalid) {
+        client::compiled_rule rule;
+        client::compile_error error;
+        client::compiled_rule::compile(
+            input.text, client::engine::automatic, rule, error);
+        input.expected = error.expected;
+        constexpr std::size_t rejections = 100;
+        input.reject = measure(repetitions, rejections, [&] {
+            for (std::size_t rep = 0; rep < rejections; ++rep) {
+                sink = sink + client::compiled_rule::compile(
+                                  input.text,
+                                  client::engine::automatic,
+                                  rule,
+                                  error);
+            }
+        });
+    }
+
+    if (json) {
+        print_json(std::cout, results, distributions, invalid, repetitions);
+    } else {
+        print_table(std::cout, results, distributions, invalid);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+#include <atomic>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "cache.hpp"
+#include "canonical.hpp"
+#include "optimizer.hpp"
+#include "pratt.hpp"
+#include "scan.hpp"
+
+namespace client {
+namespace cache {
+    namespace {
+        struct front;
+
+        struct shared_state {
+            typedef std::shared_ptr<compiled_rule const> pointer;
+
+            // A text and its rule, which other texts with the same
+            // canonical form share.
+            struct entry {
+                std::string text;
+                pointer rule;
+            };
+
+            // A rule and the number of entries that hold it.
+            struct program {
+                pointer rule;
+                std::size_t texts = 0;
+            };
+
+            std::mutex mutex;
+            // Most recently used first. Keys view the text of the entries.
+            std::list<entry> recent;
+            std::unordered_map<std::string_view, std::list<entry>::iterator>
+                index;
+            // Keys view the canonical key of the rules.
+            std::unordered_map<std::string_view, program> programs;
+            std::size_t capacity = default_capacity;
+            std::uint64_t evictions = 0;
+            std::uint64_t shared = 0;
+            // Counters of threads that have exited.
+            std::uint64_t hits = 0;
+            std::uint64_t misses = 0;
+            std::vector<front const*> fronts;
+
+            // Makes `text`, which is not in the index, the most recently
+            // used entry and returns its rule.
+            pointer
+            insert(std::string const& text, pointer rule) {
+                recent.push_front({text, rule});
+                index.emplace(recent.front().text, recent.begin());
+                ++programs.emplace(rule->canonical(), program{rule, 0})
+                      .first->second.texts;
+                trim();
+                return rule;
+            }
+
+            void
+            trim() {
+                while (recent.size() > capacity) {
+                    entry const& last = recent.back();
+                    auto found = programs.find(last.rule->canonical());
+                    if (--found->second.texts == 0) {
+                        programs.erase(found);
+                    }
+                    index.erase(last.text);
+                    recent.pop_back();
+                    ++evictions;
+                }
+            }
+        };
+
+        shared_state&
+        shared() {
+            static shared_state state;
+            return state;
+        }
+
+        struct front {
+            // The text is kept, since the rule may be shared by several.
+            struct slot {
+                std::size_t hash = 0;
+                std::string text;
+                std::shared_ptr<compiled_rule const> rule;
+            };
+
+            slot slots[front_size];
+            // Written only by the owning thread, so plain loads and stores
+            // suffice; they are atomic only so that stats() may read them.
+            std::atomic<std::uint64_t> hits{0};
+            std::atomic<std::uint64_t> misses{0};
+
+            front() {
+                shared_state& state = shared();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.fronts.push_back(this);
+            }
+
+            ~front() {
+                shared_state& state = shared();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.hits += hits.load(std::memory_order_relaxed);
+                state.misses += misses.load(std::memory_order_relaxed);
+                for (std::size_t idx = 0; idx < state.fronts.size(); ++idx) {
+                    if (state.fronts[idx] == this) {
+                        state.fronts.erase(state.fronts.begin() + idx);
+                        break;
+                    }
+                }
+            }
+
+            static void
+            count(std::atomic<std::uint64_t>& counter) {
+                counter.store(
+                    counter.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+            }
+        };
+
+        thread_local front local;
+
+        // The canonical key of `text`, or an empty string if it does not
+        // parse; compiling it then reports why.
+        std::string
+        canonical_key(std::string const& text) {
+            ast::operand tree;
+            std::size_t offset = 0;
+            std::string expected;
+            if (scan::first_invalid(text.data(), text.size()) != text.size() ||
+                !pratt::parse(text, tree, offset, expected)) {
+                return {};
+            }
+            ast::optimize(tree);
+            return canonical::key(tree);
+        }
+
+        // The shared path: finds the rule for `text`, or for an equivalent
+        // text, or compiles it, and makes it the most recently used one.
+        std::shared_ptr<compiled_rule const>
+        fetch(std::string const& text, std::string& error) {
+            shared_state& state = shared();
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                auto found = state.index.find(text);
+                if (found != state.index.end()) {
+                    state.recent.splice(
+                        state.recent.begin(), state.recent, found->second);
+                    front::count(local.hits);
+                    return found->second->rule;
+                }
+            }
+
+            // Parsing is cheap next to compiling, so the canonical form is
+            // looked up before a rule is compiled for a new spelling.
+            const std::string key{canonical_key(text)};
+            if (!key.empty()) {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                auto program = state.programs.find(key);
+                if (program != state.programs.end()) {
+                    front::count(local.hits);
+                    auto found = state.index.find(text);
+                    if (found != state.index.end()) {
+                        state.recent.splice(
+                            state.recent.begin(), state.recent, found->second);
+                        return found->second->rule;
+                    }
+                    ++state.shared;
+                    return state.insert(text, program->second.rule);
+                }
+            }
+
+            // Compile without holding the lock; if another thread gets
+            // there first, its rule is kept and this one is dropped.
+            front::count(local.misses);
+            compiled_rule rule;
+            if (!compiled_rule::compile(text, engine::automatic, rule, error)) {
+                return nullptr;
+            }
+            std::shared_ptr<compiled_rule const> compiled{
+                std::make_shared<compiled_rule const>(std::move(rule))};
+
+            std::lock_guard<std::mutex> lock(state.mutex);
+            auto found = state.index.find(text);
+            if (found != state.index.end()) {
+                state.recent.splice(
+                    state.recent.begin(), state.recent, found->second);
+                return found->second->rule;
+            }
+            auto program = state.programs.find(compiled->canonical());
+            if (program != state.programs.end()) {
+                compiled = program->second.rule;
+            }
+            return state.insert(text, std::move(compiled));
+        }
+
+        // The thread's slot holding the rule for `text`, or nullptr if it
+        // does not compile.
+        front::slot const*
+        find(std::string const& text, std::string& error) {
+            const std::size_t hash{std::hash<std::string>{}(text)};
+            front::slot& slot = local.slots[hash % front_size];
+            if (slot.rule && slot.hash == hash && slot.text == text) {
+                front::count(local.hits);
+                return &slot;
+            }
+            std::shared_ptr<compiled_rule const> rule{fetch(text, error)};
+            if (!rule) {
+                return nullptr;
+            }
+            slot.hash = hash;
+            slot.text = text;
+            slot.rule = std::move(rule);
+            return &slot;
+        }
+    } // namespace
+
+    std::shared_ptr<compiled_rule const>
+    lookup(std::string const& text, std::string& error) {
+        front::slot const* slot = find(text, error);
+        return slot ? slot->rule : nullptr;
+    }
+
+    bool
+    evaluate(
+        std::string const& text, uint n, uint& result, std::string& error) {
+        front::slot const* slot = find(text, error);
+        if (!slot) {
+            return false;
+        }
+        result = (*slot->rule)(n);
+        return true;
+    }
+
+    void
+    set_capacity(std::size_t capacity) {
+        shared_state& state = shared();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.capacity = capacity;
+        state.trim();
+    }
+
+    statistics
+    stats() {
+        shared_state& state = shared();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        statistics out;
+        out.hits = state.hits;
+        out.misses = state.misses;
+        for (front const* thread : state.fronts) {
+            out.hits += thread->hits.load(std::memory_order_relaxed);
+            out.misses += thread->misses.load(std::memory_order_relaxed);
+        }
+        out.evictions = state.evictions;
+        out.shared = state.shared;
+        out.size = state.recent.size();
+        out.programs = state.programs.size();
+        out.capacity = state.capacity;
+        return out;
+    }
+
+} // namespace cache
+} // namespace client
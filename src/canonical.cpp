@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <list>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "canonical.hpp"
+
+namespace client {
+namespace canonical {
+    namespace {
+        namespace x3 = boost::spirit::x3;
+
+        // The first byte of every serialized node. Compound nodes sort
+        // before variables and variables before constants.
+        enum tag : char {
+            nil_tag,
+            binary_tag,
+            conditional_tag,
+            variable_tag,
+            constant_tag,
+        };
+
+        // Big-endian, so that constants sort by value.
+        void
+        append(std::string& key, std::uint32_t value) {
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                key += static_cast<char>(value >> shift);
+            }
+        }
+
+        bool
+        commutes(ast::optoken op) {
+            return op == ast::optoken::equal || op == ast::optoken::not_equal;
+        }
+
+        bool
+        associative(ast::optoken op) {
+            return op == ast::optoken::logical_and ||
+                   op == ast::optoken::logical_or;
+        }
+
+        // The operator that compares the same way with its operands
+        // swapped.
+        ast::optoken
+        mirror(ast::optoken op) {
+            switch (op) {
+            case ast::optoken::less: return ast::optoken::greater;
+            case ast::optoken::less_equal: return ast::optoken::greater_equal;
+            case ast::optoken::greater: return ast::optoken::less;
+            case ast::optoken::greater_equal: return ast::optoken::less_equal;
+            default: return op;
+            }
+        }
+
+        bool
+        ordered(ast::optoken op) {
+            return mirror(op) != op;
+        }
+
+        struct part {
+            ast::operand tree;
+            std::string key;
+        };
+
+        // Whether `key` sorts before the concatenation of `segments`.
+        // Only as many bytes as `key` has are compared, so a chain's key
+        // is never joined just to compare it with an operand.
+        bool
+        before(
+            std::string const& key, std::deque<std::string> const& segments) {
+            std::size_t idx = 0;
+            for (std::string const& segment : segments) {
+                for (char byte : segment) {
+                    if (idx == key.size()) {
+                        return true;
+                    }
+                    // Unsigned, as std::string compares.
+                    const auto lhs = static_cast<unsigned char>(key[idx++]);
+                    const auto rhs = static_cast<unsigned char>(byte);
+                    if (lhs != rhs) {
+                        return lhs < rhs;
+                    }
+                }
+            }
+            return false;
+        }
+
+        // The operand a chain of operations stands for: its first operand
+        // alone if there are none.
+        ast::operand
+        unwrap(ast::expression& chain) {
+            if (chain.rhs.empty()) {
+                return std::move(chain.lhs);
+            }
+            return ast::operand{std::move(chain)};
+        }
+
+        // Puts a tree into canonical form and returns its key. A chain of
+        // operations is keyed as if its links nested to the left, but is
+        // rewritten one link at a time and stays a chain, so only nesting
+        // recurses here; scan::max_depth bounds that. A link whose operand
+        // sorts before the rest of its chain nests that rest in the
+        // canonical tree, so a long chain can make a deep tree; without
+        // `rewrite`, links stay where they are and only the key is exact.
+        struct rewriter {
+            bool rewrite;
+
+            std::string
+            operator()(ast::operand& ast) const {
+                auto& node = ast.get();
+                if (auto* expr =
+                        boost::get<x3::forward_ast<ast::expression>>(&node)) {
+                    return chain(ast, expr->get());
+                }
+                if (auto* op =
+                        boost::get<x3::forward_ast<ast::binary_op>>(&node)) {
+                    ast::expression expr{std::move(op->get().lhs), {}};
+                    expr.rhs.push_back(
+                        {op->get().op, std::move(op->get().rhs)});
+                    ast = std::move(expr);
+                    return (*this)(ast);
+                }
+                std::string key;
+                if (auto* cond =
+                        boost::get<x3::forward_ast<ast::conditional_op>>(
+                            &node)) {
+                    key += conditional_tag;
+                    key += (*this)(cond->get().lhs);
+                    key += (*this)(cond->get().rhs_true);
+                    key += (*this)(cond->get().rhs_false);
+                } else if (uint const* value = boost::get<uint>(&node)) {
+                    key += constant_tag;
+                    append(key, *value);
+                } else if (
+                    ast::variable const* var =
+                        boost::get<ast::variable>(&node)) {
+                    key += variable_tag;
+                    append(key, var->slot);
+                } else {
+                    key += nil_tag;
+                }
+                return key;
+            }
+
+            // Collects the operands of a run of `op` into `out`, however
+            // they nest.
+            void
+            gather(ast::optoken op, ast::operand ast, std::vector<part>& out)
+                const {
+                std::vector<ast::operand> pending;
+                pending.push_back(std::move(ast));
+                while (!pending.empty()) {
+                    ast::operand next{std::move(pending.back())};
+                    pending.pop_back();
+                    auto& node = next.get();
+                    if (auto* bin =
+                            boost::get<x3::forward_ast<ast::binary_op>>(
+                                &node);
+                        bin && bin->get().op.code == op) {
+                        pending.push_back(std::move(bin->get().lhs));
+                        pending.push_back(std::move(bin->get().rhs));
+                        continue;
+                    }
+                    if (auto* expr =
+                            boost::get<x3::forward_ast<ast::expression>>(
+                                &node)) {
+                        std::list<ast::operation>& ops = expr->get().rhs;
+                        if (ops.empty()) {
+                            pending.push_back(std::move(expr->get().lhs));
+                            continue;
+                        }
+                        if (ops.back().op.code == op) {
+                            pending.push_back(std::move(ops.back().rhs));
+                            ops.pop_back();
+                            pending.push_back(std::move(next));
+                            continue;
+                        }
+                    }
+                    out.push_back({std::move(next), {}});
+                    out.back().key = (*this)(out.back().tree);
+                }
+            }
+
+            // Sorts the operands of a run of `op` and chains them. The key
+            // nests the run to the left, in order. The tree lists it in
+            // reverse, since the parsers nest `&&` and `||` to the right:
+            // printed and parsed again, the innermost pair then holds the
+            // least operand, which is a constant only if all of them are,
+            // so the optimizer folds nothing the canonical form did not.
+            static part
+            sorted(ast::binary_operator op, std::vector<part>& parts) {
+                std::sort(
+                    parts.begin(),
+                    parts.end(),
+                    [](part const& a, part const& b) { return a.key < b.key; });
+                part run;
+                for (std::size_t idx = 1; idx < parts.size(); ++idx) {
+                    run.key += binary_tag;
+                    run.key += static_cast<char>(op.code);
+                }
+                for (part const& each : parts) {
+                    run.key += each.key;
+                }
+                ast::expression chain{std::move(parts.back().tree), {}};
+                for (std::size_t idx = parts.size() - 1; idx-- > 0;) {
+                    chain.rhs.push_back({op, std::move(parts[idx].tree)});
+                }
+                run.tree = unwrap(chain);
+                parts.clear();
+                return run;
+            }
+
+            std::string
+            chain(ast::operand& ast, ast::expression& expr) const {
+                ast::operand first{std::move(expr.lhs)};
+                std::list<ast::operation> ops;
+                ops.swap(expr.rhs);
+                if (ops.empty()) {
+                    ast = std::move(first);
+                    return (*this)(ast);
+                }
+
+                // Outside a run of `&&` or `||`: the links so far and their
+                // key, in pieces. A link puts its header in front and its
+                // operand's key in front of or after the rest.
+                ast::expression links{{}, {}};
+                std::deque<std::string> key;
+                // Inside one: its operator and its operands so far.
+                std::vector<part> parts;
+                ast::binary_operator run{ops.front().op};
+                bool running{associative(run.code)};
+                if (running) {
+                    gather(run.code, std::move(first), parts);
+                } else {
+                    key.push_back((*this)(first));
+                    links.lhs = std::move(first);
+                }
+
+                for (ast::operation& op : ops) {
+                    const ast::optoken code{op.op.code};
+                    if (associative(code)) {
+                        if (!running || run.code != code) {
+                            if (running) {
+                                part done{sorted(run, parts)};
+                                parts.push_back(std::move(done));
+                            } else {
+                                parts.push_back(
+                                    {unwrap(links), join(key)});
+                            }
+                            running = true;
+                            run = op.op;
+                        }
+                        gather(code, std::move(op.rhs), parts);
+                        continue;
+                    }
+                    if (running) {
+                        part done{sorted(run, parts)};
+                        links = ast::expression{std::move(done.tree), {}};
+                        key.assign(1, std::move(done.key));
+                        running = false;
+                    }
+                    std::string rhs{(*this)(op.rhs)};
+                    ast::binary_operator link{op.op};
+                    const bool swap{
+                        (commutes(code) || ordered(code)) && before(rhs, key)};
+                    if (swap) {
+                        link.code = mirror(code);
+                        key.push_front(std::move(rhs));
+                    } else {
+                        key.push_back(std::move(rhs));
+                    }
+                    if (swap && rewrite) {
+                        ast::expression swapped{std::move(op.rhs), {}};
+                        swapped.rhs.push_back({link, unwrap(links)});
+                        links = std::move(swapped);
+                    } else {
+                        links.rhs.push_back({op.op, std::move(op.rhs)});
+                    }
+                    key.push_front({binary_tag, static_cast<char>(link.code)});
+                }
+
+                if (running) {
+                    part done{sorted(run, parts)};
+                    ast = std::move(done.tree);
+                    return std::move(done.key);
+                }
+                ast = unwrap(links);
+                return join(key);
+            }
+
+            static std::string
+            join(std::deque<std::string> const& segments) {
+                std::size_t size = 0;
+                for (std::string const& segment : segments) {
+                    size += segment.size();
+                }
+                std::string key;
+                key.reserve(size);
+                for (std::string const& segment : segments) {
+                    key += segment;
+                }
+                return key;
+            }
+        };
+    } // namespace
+
+    std::string
+    canonicalize(ast::operand& ast) {
+        return rewriter{true}(ast);
+    }
+
+    std::string
+    key(ast::operand const& ast) {
+        ast::operand copy{ast};
+        return rewriter{false}(copy);
+    }
+
+    std::uint64_t
+    hash(std::string_view key) {
+        std::uint64_t state = 0xcbf29ce484222325;
+        for (char byte : key) {
+            state = (state ^ static_cast<std::uint8_t>(byte)) * 0x100000001b3;
+        }
+        return state;
+    }
+
+} // namespace canonical
+} // namespace client
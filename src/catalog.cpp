@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "catalog.hpp"
+#include "exhaustive.hpp"
+
+namespace client {
+namespace catalog {
+    namespace {
+        typedef std::chrono::steady_clock clock;
+
+        // Files handed to a worker at a time.
+        constexpr std::uint64_t files_per_chunk = 8;
+
+        // A read-only private mapping of a whole file.
+        class mapping {
+        public:
+            mapping() = default;
+            mapping(mapping const&) = delete;
+            mapping& operator=(mapping const&) = delete;
+
+            ~mapping() {
+                if (address) {
+                    munmap(address, size);
+                }
+            }
+
+            bool
+            open(std::string const& path, std::string& error) {
+                const int fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+                if (fd < 0) {
+                    error = std::strerror(errno);
+                    return false;
+                }
+                struct stat info;
+                if (fstat(fd, &info) != 0) {
+                    error = std::strerror(errno);
+                    close(fd);
+                    return false;
+                }
+                size = info.st_size;
+                if (size) {
+                    void* mapped{
+                        mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+                    if (mapped == MAP_FAILED) {
+                        error = std::strerror(errno);
+                        close(fd);
+                        return false;
+                    }
+                    address = mapped;
+                }
+                close(fd);
+                return true;
+            }
+
+            std::string_view
+            view() const {
+                return {static_cast<char const*>(address), size};
+            }
+
+        private:
+            void* address = nullptr;
+            std::size_t size = 0;
+        };
+
+        bool
+        is_space(char c) {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        std::string_view
+        trim(std::string_view text) {
+            while (!text.empty() && is_space(text.front())) {
+                text.remove_prefix(1);
+            }
+            while (!text.empty() && is_space(text.back())) {
+                text.remove_suffix(1);
+            }
+            return text;
+        }
+
+        bool
+        has_extension(std::string const& path, char const* extension) {
+            const std::size_t length{std::strlen(extension)};
+            return path.size() > length &&
+                   path.compare(path.size() - length, length, extension) == 0;
+        }
+
+        // Splits off the line at `pos`, trimmed, and moves past it.
+        std::string_view
+        next_line(std::string_view text, std::size_t& pos) {
+            const std::size_t end{std::min(text.find('\n', pos), text.size())};
+            std::string_view line{trim(text.substr(pos, end - pos))};
+            pos = std::min(end + 1, text.size());
+            return line;
+        }
+
+        // Appends the C string literal that `line` starts with to `out`.
+        bool
+        append_literal(
+            std::string_view line, std::string& out, std::string& error) {
+            if (line.empty() || line.front() != '"') {
+                error = "expected a string";
+                return false;
+            }
+            for (std::size_t at = 1; at < line.size(); ++at) {
+                char c{line[at]};
+                if (c == '"') {
+                    if (!trim(line.substr(at + 1)).empty()) {
+                        error = "unexpected text after a string";
+                        return false;
+                    }
+                    return true;
+                }
+                if (c == '\\' && ++at < line.size()) {
+                    c = line[at];
+                    switch (c) {
+                    case 'n': c = '\n'; break;
+                    case 't': c = '\t'; break;
+                    case 'r': c = '\r'; break;
+                    }
+                }
+                out += c;
+            }
+            error = "unterminated string";
+            return false;
+        }
+
+        // Reads `keyword "..."` and any string lines continuing it, after
+        // skipping blank lines and comments.
+        bool
+        read_field(
+            std::string_view text,
+            std::size_t& pos,
+            std::string_view keyword,
+            std::string& value,
+            std::string& error) {
+            std::string_view line;
+            do {
+                if (pos == text.size()) {
+                    error = "expected " + std::string(keyword);
+                    return false;
+                }
+                line = next_line(text, pos);
+            } while (line.empty() || line.front() == '#');
+
+            if (line.substr(0, keyword.size()) != keyword ||
+                line.size() == keyword.size() ||
+                !is_space(line[keyword.size()])) {
+                error = "expected " + std::string(keyword);
+                return false;
+            }
+            if (!append_literal(
+                    trim(line.substr(keyword.size())), value, error)) {
+                return false;
+            }
+            for (;;) {
+                const std::size_t before{pos};
+                line = next_line(text, pos);
+                if (line.empty() || line.front() != '"') {
+                    pos = before;
+                    return true;
+                }
+                if (!append_literal(line, value, error)) {
+                    return false;
+                }
+            }
+        }
+
+        std::uint32_t
+        read32(std::string_view image, std::size_t at, bool swapped) {
+            std::uint32_t value;
+            std::memcpy(&value, image.data() + at, sizeof(value));
+            return swapped ? __builtin_bswap32(value) : value;
+        }
+
+        bool
+        extract(entry& out) {
+            mapping file;
+            if (!file.open(out.path, out.error)) {
+                return false;
+            }
+            std::string_view header;
+            std::string unescaped;
+            if (has_extension(out.path, ".mo")) {
+                if (!mo_header(file.view(), header, out.error)) {
+                    return false;
+                }
+            } else if (has_extension(out.path, ".po")) {
+                if (!po_header(file.view(), unescaped, out.error)) {
+                    return false;
+                }
+                header = unescaped;
+            } else {
+                out.error = "not a .mo or .po file";
+                return false;
+            }
+
+            std::string_view plural;
+            if (!find_plural_forms(
+                    header, out.nplurals, plural, out.defaulted, out.error)) {
+                return false;
+            }
+            out.plural.assign(plural);
+            out.rule = cache::lookup(out.plural, out.error);
+            return out.rule != nullptr;
+        }
+
+        void
+        collect(
+            std::string const& path,
+            std::vector<std::string>& files,
+            std::string& error) {
+            namespace fs = std::filesystem;
+            std::error_code code;
+            if (!fs::is_directory(path, code)) {
+                files.push_back(path);
+                return;
+            }
+            fs::recursive_directory_iterator iter{
+                path, fs::directory_options::skip_permission_denied, code};
+            for (; !code && iter != fs::recursive_directory_iterator();
+                 iter.increment(code)) {
+                std::string name{iter->path().string()};
+                if (iter->is_regular_file(code) &&
+                    (has_extension(name, ".mo") ||
+                     has_extension(name, ".po"))) {
+                    files.push_back(std::move(name));
+                }
+            }
+            if (code) {
+                error = path + ": " + code.message();
+            }
+        }
+    } // namespace
+
+    bool
+    find_plural_forms(
+        std::string_view header,
+        std::uint32_t& nplurals,
+        std::string_view& plural,
+        bool& defaulted,
+        std::string& error) {
+        static constexpr std::string_view field{"Plural-Forms:"};
+        std::string_view value;
+        bool found{false};
+        for (std::size_t pos = 0; !found && pos < header.size();) {
+            const std::string_view line{next_line(header, pos)};
+            if (line.substr(0, field.size()) == field) {
+                value = line.substr(field.size());
+                found = true;
+            }
+        }
+        defaulted = !found;
+        if (defaulted) {
+            nplurals = default_nplurals;
+            plural = default_plural;
+            return true;
+        }
+
+        // Finds `name =` as a whole word and returns the offset past '='.
+        auto assignment = [&](std::string_view name, std::size_t& at) {
+            for (at = value.find(name); at != value.npos;
+                 at = value.find(name, at + 1)) {
+                if (at && std::isalnum(static_cast<unsigned char>(
+                              value[at - 1]))) {
+                    continue;
+                }
+                std::size_t next{at + name.size()};
+                while (next < value.size() && is_space(value[next])) {
+                    ++next;
+                }
+                if (next < value.size() && value[next] == '=') {
+                    at = next + 1;
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        std::size_t at;
+        if (!assignment("nplurals", at)) {
+            error = "no nplurals in Plural-Forms";
+            return false;
+        }
+        while (at < value.size() && is_space(value[at])) {
+            ++at;
+        }
+        std::uint64_t count = 0;
+        const std::size_t digits{at};
+        while (at < value.size() && value[at] >= '0' && value[at] <= '9' &&
+               count <= 0xFFFFFFFF) {
+            count = count * 10 + (value[at++] - '0');
+        }
+        if (at == digits || count == 0 || count > 0xFFFFFFFF) {
+            error = "nplurals is not a positive number";
+            return false;
+        }
+        nplurals = static_cast<std::uint32_t>(count);
+
+        if (!assignment("plural", at)) {
+            error = "no plural in Plural-Forms";
+            return false;
+        }
+        plural = trim(value.substr(at, value.find(';', at) - at));
+        if (plural.empty()) {
+            error = "empty plural expression";
+            return false;
+        }
+        return true;
+    }
+
+    bool
+    mo_header(
+        std::string_view image, std::string_view& header, std::string& error) {
+        // magic, revision, message count, offsets of the original and
+        // translated string tables, whose entries are (length, offset).
+        if (image.size() < 20) {
+            error = "too short for a .mo file";
+            return false;
+        }
+        const std::uint32_t magic{read32(image, 0, false)};
+        const bool swapped{magic == 0xde120495};
+        if (!swapped && magic != 0x950412de) {
+            error = "not a .mo file";
+            return false;
+        }
+        const std::uint32_t count{read32(image, 8, swapped)};
+        const std::uint32_t originals{read32(image, 12, swapped)};
+        const std::uint32_t translations{read32(image, 16, swapped)};
+        if (originals > image.size() - 8 || translations > image.size() - 8) {
+            error = "string table out of bounds";
+            return false;
+        }
+        // Originals are sorted, so the empty msgid comes first.
+        if (!count || read32(image, originals, swapped) != 0) {
+            error = "no header entry";
+            return false;
+        }
+        const std::uint32_t length{read32(image, translations, swapped)};
+        const std::uint32_t offset{read32(image, translations + 4, swapped)};
+        if (offset > image.size() || length > image.size() - offset) {
+            error = "header entry out of bounds";
+            return false;
+        }
+        header = image.substr(offset, length);
+        return true;
+    }
+
+    bool
+    po_header(std::string_view text, std::string& header, std::string& error) {
+        std::size_t pos{text.substr(0, 3) == "\xEF\xBB\xBF" ? 3u : 0u};
+        std::string msgid;
+        if (!read_field(text, pos, "msgid", msgid, error)) {
+            return false;
+        }
+        if (!msgid.empty()) {
+            error = "no header entry";
+            return false;
+        }
+        return read_field(text, pos, "msgstr", header, error);
+    }
+
+    bool
+    load(entry& out) {
+        const clock::time_point start{clock::now()};
+        const bool loaded{extract(out)};
+        out.seconds =
+            std::chrono::duration<double>(clock::now() - start).count();
+        return loaded;
+    }
+
+    bool
+    run(options const& config) {
+        std::vector<std::string> files;
+        for (std::string const& path : config.paths) {
+            std::string error;
+            collect(path, files, error);
+            if (!error.empty()) {
+                std::cout << error << std::endl;
+                return false;
+            }
+        }
+        if (files.empty()) {
+            std::cout << "No .mo or .po files found" << std::endl;
+            return false;
+        }
+        std::sort(files.begin(), files.end());
+
+        std::vector<entry> entries(files.size());
+        for (std::size_t idx = 0; idx < files.size(); ++idx) {
+            entries[idx].path = std::move(files[idx]);
+        }
+        const std::size_t threads{
+            config.threads ? config.threads
+                           : std::max(1u, std::thread::hardware_concurrency())};
+        const clock::time_point start{clock::now()};
+        exhaustive::parallel_for(
+            threads,
+            0,
+            entries.size() - 1,
+            files_per_chunk,
+            [&](std::size_t, std::uint64_t first, std::uint64_t last) {
+                for (std::uint64_t idx = first; idx <= last; ++idx) {
+                    load(entries[idx]);
+                }
+                return true;
+            },
+            [](std::uint64_t) {});
+        const double elapsed{
+            std::chrono::duration<double>(clock::now() - start).count()};
+
+        std::size_t failed = 0;
+        std::size_t defaulted = 0;
+        double busy = 0;
+        std::set<std::string_view> texts;
+        std::set<std::string_view> rules;
+        std::cout << std::fixed << std::setprecision(1);
+        for (entry const& file : entries) {
+            busy += file.seconds;
+            if (!file.rule) {
+                ++failed;
+                std::cout << std::setw(10) << file.seconds * 1e6 << " us  "
+                          << file.path << ": " << file.error << std::endl;
+                continue;
+            }
+            defaulted += file.defaulted;
+            texts.insert(file.plural);
+            rules.insert(file.rule->canonical());
+            if (!config.quiet) {
+                std::cout << std::setw(10) << file.seconds * 1e6 << " us  "
+                          << file.path << ": nplurals=" << file.nplurals
+                          << "; plural=" << file.plural
+                          << (file.defaulted ? " (default)" : "") << std::endl;
+            }
+        }
+        std::cout << "Loaded " << entries.size() - failed << " of "
+                  << entries.size() << " files in " << std::setprecision(3)
+                  << elapsed << " s on " << threads << " threads, "
+                  << std::setprecision(1) << busy / entries.size() * 1e6
+                  << " us per file" << std::endl;
+        if (defaulted) {
+            std::cout << defaulted << " without Plural-Forms used the "
+                      << "default, nplurals=" << default_nplurals
+                      << "; plural=" << default_plural << std::endl;
+        }
+        std::cout << texts.size() << " distinct plural expressions, "
+                  << rules.size() << " distinct rules, dedup ratio "
+                  << std::setprecision(2)
+                  << static_cast<double>(texts.size()) /
+                         std::max<std::size_t>(rules.size(), 1)
+                  << std::endl;
+        return failed == 0;
+    }
+
+} // namespace catalog
+} // namespace client
@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <sstream>
+#include <utility>
+
+#include "codegen.hpp"
+#include "compiled_rule.hpp"
+#include "vm.hpp"
+
+namespace client {
+namespace codegen {
+    namespace {
+        // One generated function, for the first spelling of a rule, and
+        // the locales that use it.
+        struct function {
+            std::string text;
+            ast::operand tree;
+            std::vector<std::string> locales;
+        };
+
+        // Prints an optimized tree as a C++ expression over `unsigned`.
+        // Every operation is parenthesized, comparisons yield bool, which
+        // converts to 0 or 1 as the rule's result would, and subtrees whose
+        // number is in `shared` are replaced by the local holding them.
+        struct emitter {
+            typedef void result_type;
+
+            // Operations that associate to the left, with their operands.
+            typedef std::vector<
+                std::pair<ast::binary_operator, ast::operand const*>>
+                links;
+
+            std::ostream& out;
+            vm::subtree_numbers const& numbers;
+            std::map<std::size_t, std::string> const& shared;
+
+            result_type
+            operator()(ast::operand const& ast) const {
+                if (!shared.empty()) {
+                    auto found = shared.find(numbers[ast]);
+                    if (found != shared.end()) {
+                        out << found->second;
+                        return;
+                    }
+                }
+                boost::apply_visitor(*this, ast.get());
+            }
+
+            result_type
+            operator()(ast::nil) const {
+                out << "0u";
+            }
+
+            result_type
+            operator()(ast::expression const& ast) const {
+                links ops;
+                for (ast::operation const& op : ast.rhs) {
+                    ops.emplace_back(op.op, &op.rhs);
+                }
+                chain(ast.lhs, ops);
+            }
+
+            result_type
+            operator()(ast::binary_op const& ast) const {
+                chain(ast.lhs, {{ast.op, &ast.rhs}});
+            }
+
+            static uint const*
+            divisor(ast::binary_operator op, ast::operand const& rhs) {
+                return op.code == ast::optoken::mod
+                           ? boost::get<uint>(&rhs.get())
+                           : nullptr;
+            }
+
+            // Writes every opening parenthesis first, outermost first, then
+            // the operands in order, so a chain takes a loop, not a level
+            // of recursion per link. `%` by a constant stays integer
+            // modulo, which the compiler strength-reduces; any other
+            // divisor may be 0. `% 0` is 0 whatever it divides, so the
+            // chain starts over after the last one.
+            void
+            chain(ast::operand const& first, links const& ops) const {
+                std::size_t begin = 0;
+                for (std::size_t idx = 0; idx < ops.size(); ++idx) {
+                    uint const* value{
+                        divisor(ops[idx].first, *ops[idx].second)};
+                    if (value && *value == 0) {
+                        begin = idx + 1;
+                    }
+                }
+                for (std::size_t idx = ops.size(); idx-- > begin;) {
+                    const bool modulo{
+                        ops[idx].first.code == ast::optoken::mod &&
+                        !divisor(ops[idx].first, *ops[idx].second)};
+                    out << (modulo ? "detail::mod(" : "(");
+                }
+                if (begin) {
+                    out << "0u";
+                } else {
+                    (*this)(first);
+                }
+                for (std::size_t idx = begin; idx < ops.size(); ++idx) {
+                    const ast::binary_operator op{ops[idx].first};
+                    ast::operand const& rhs = *ops[idx].second;
+                    if (uint const* value = divisor(op, rhs)) {
+                        out << " % " << *value << "u)";
+                    } else if (op.code == ast::optoken::mod) {
+                        out << ", ";
+                        (*this)(rhs);
+                        out << ')';
+                    } else {
+                        out << ' ' << op.name() << ' ';
+                        (*this)(rhs);
+                        out << ')';
+                    }
+                }
+            }
+
+            result_type
+            operator()(ast::conditional_op const& ast) const {
+                out << '(';
+                (*this)(ast.lhs);
+                out << " ? ";
+                (*this)(ast.rhs_true);
+                out << " : ";
+                (*this)(ast.rhs_false);
+                out << ')';
+            }
+
+            result_type
+            operator()(uint const& ast) const {
+                out << ast << 'u';
+            }
+
+            result_type
+            operator()(ast::variable const& ast) const {
+                out << ast::variable_names[ast.slot];
+            }
+        };
+
+        bool
+        is_identifier(std::string const& name) {
+            return !name.empty() &&
+                   !std::isdigit(static_cast<unsigned char>(name[0])) &&
+                   std::all_of(name.begin(), name.end(), [](char c) {
+                       return std::isalnum(static_cast<unsigned char>(c)) ||
+                              c == '_';
+                   });
+        }
+
+        // Rule text on one comment line. Compiled rules hold no backslash,
+        // so only line breaks and other spacing need replacing.
+        std::string
+        comment(std::string text) {
+            for (char& c : text) {
+                if (std::iscntrl(static_cast<unsigned char>(c))) {
+                    c = ' ';
+                }
+            }
+            return text;
+        }
+
+        // Letters, digits and `_@.-`, as in "pt_BR" or "sr@latin", which
+        // need no escaping in a string literal or a comment.
+        bool
+        is_locale(std::string const& name) {
+            return !name.empty() &&
+                   std::all_of(name.begin(), name.end(), [](char c) {
+                       return std::isalnum(static_cast<unsigned char>(c)) ||
+                              c == '_' || c == '@' || c == '.' || c == '-';
+                   });
+        }
+
+        void
+        emit_function(
+            std::ostream& out, function const& rule, std::size_t idx) {
+            out << "    // " << comment(rule.text) << '\n';
+            for (std::size_t locale = 0; locale < rule.locales.size();
+                 ++locale) {
+                out << (locale ? ", " : "    // Locales: ")
+                    << rule.locales[locale]
+                    << (locale + 1 == rule.locales.size() ? "\n" : "");
+            }
+            out << "    inline constexpr unsigned\n"
+                << "    plural_" << idx << "([[maybe_unused]] unsigned "
+                << ast::variable_names[0] << ") {\n";
+
+            // Subtrees used more than once on every path, smallest first,
+            // so that larger ones are written in terms of the smaller.
+            vm::subtree_numbers numbers;
+            numbers(rule.tree);
+            std::map<std::size_t, std::string> shared;
+            for (ast::operand const* subtree :
+                 vm::common_subexpressions(rule.tree, numbers)) {
+                const std::string name{"t" + std::to_string(shared.size())};
+                out << "        const unsigned " << name << " = ";
+                boost::apply_visitor(
+                    emitter{out, numbers, shared}, subtree->get());
+                out << ";\n";
+                shared.emplace(numbers[*subtree], name);
+            }
+            out << "        return ";
+            emitter{out, numbers, shared}(rule.tree);
+            out << ";\n    }\n\n";
+        }
+    } // namespace
+
+    bool
+    generate(
+        std::vector<source> const& rules,
+        options const& config,
+        std::ostream& out,
+        std::string& error) {
+        if (!is_identifier(config.name_space)) {
+            error =
+                "namespace " + config.name_space + " is not an identifier";
+            return false;
+        }
+
+        std::vector<function> functions;
+        std::map<std::string, std::size_t> by_key;
+        // Locale and the function it uses, sorted by locale.
+        std::map<std::string, std::size_t> locales;
+        for (source const& rule : rules) {
+            compiled_rule compiled;
+            if (!compiled_rule::compile(
+                    rule.text, engine::tree, compiled, error)) {
+                error = rule.text + ": " + error;
+                return false;
+            }
+            auto found = by_key.find(compiled.canonical());
+            if (found == by_key.end()) {
+                functions.push_back({rule.text, compiled.program(), {}});
+                found = by_key.emplace(
+                    compiled.canonical(), functions.size() - 1).first;
+            }
+            if (rule.locale.empty()) {
+                continue;
+            }
+            if (!is_locale(rule.locale)) {
+                error = "invalid locale " + rule.locale;
+                return false;
+            }
+            if (!locales.emplace(rule.locale, found->second).second) {
+                error = "duplicate locale " + rule.locale;
+                return false;
+            }
+            functions[found->second].locales.push_back(rule.locale);
+        }
+
+        std::ostringstream header;
+        header << "// Plural-forms rules compiled by plurals-parser codegen.\n"
+               << "#pragma once\n\n"
+               << "#include <cstddef>\n"
+               << "#include <string_view>\n\n"
+               << "namespace " << config.name_space << " {\n"
+               << "    namespace detail {\n"
+               << "        // `%` as plural-forms rules define it.\n"
+               << "        constexpr unsigned\n"
+               << "        mod(unsigned lhs, unsigned rhs) {\n"
+               << "            return rhs ? lhs % rhs : 0;\n"
+               << "        }\n"
+               << "    } // namespace detail\n\n";
+        for (std::size_t idx = 0; idx < functions.size(); ++idx) {
+            emit_function(header, functions[idx], idx);
+        }
+
+        if (!locales.empty()) {
+            header << "    struct locale_rule {\n"
+                   << "        std::string_view locale;\n"
+                   << "        unsigned (*plural)(unsigned);\n"
+                   << "    };\n\n"
+                   << "    // Sorted by locale.\n"
+                   << "    inline constexpr locale_rule locales[] = {\n";
+            for (auto const& locale : locales) {
+                header << "        {\"" << locale.first << "\", plural_"
+                       << locale.second << "},\n";
+            }
+            header
+                << "    };\n\n"
+                << "    // The rule for exactly `locale`, or nullptr.\n"
+                << "    constexpr auto\n"
+                << "    find(std::string_view locale)\n"
+                << "        -> unsigned (*)(unsigned) {\n"
+                << "        std::size_t first = 0;\n"
+                << "        std::size_t last = sizeof(locales) / "
+                   "sizeof(locales[0]);\n"
+                << "        const std::size_t count = last;\n"
+                << "        while (first < last) {\n"
+                << "            const std::size_t middle = first + (last - "
+                   "first) / 2;\n"
+                << "            if (locales[middle].locale < locale) {\n"
+                << "                first = middle + 1;\n"
+                << "            } else {\n"
+                << "                last = middle;\n"
+                << "            }\n"
+                << "        }\n"
+                << "        return first < count && locales[first].locale == "
+                   "locale\n"
+                << "                   ? locales[first].plural\n"
+                << "                   : nullptr;\n"
+                << "    }\n";
+        }
+        header << "} // namespace " << config.name_space << '\n';
+        out << header.str();
+        return true;
+    }
+
+} // namespace codegen
+} // namespace client
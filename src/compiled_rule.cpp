@@ -0,0 +1,254 @@
+#include <exception>
+#include <utility>
+#include <boost/spirit/home/x3.hpp>
+
+#include "ast_adapted.hpp"
+#include "canonical.hpp"
+#include "compiled_rule.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "pratt.hpp"
+#include "scan.hpp"
+
+namespace client {
+    namespace x3 = boost::spirit::x3;
+
+    namespace {
+        void
+        syntax_error(
+            std::string const& text,
+            std::size_t offset,
+            std::string const& expected,
+            compile_error& error) {
+            const std::string rest{text.substr(offset)};
+            error.offset = offset;
+            error.expected = expected;
+            if (expected == "end of input") {
+                error.message = "parsing stopped at \"" + rest + "\"";
+            } else if (expected == "character") {
+                error.message = "invalid character at \"" + rest + "\"";
+            } else if (expected == "nesting depth") {
+                error.message = "nested too deeply at \"" + rest + "\"";
+            } else {
+                error.message = "expected " + expected + " at \"" + rest + "\"";
+            }
+        }
+
+        // The X3 frontend, with the interface of pratt::parse.
+        bool
+        parse_x3(
+            std::string const& text,
+            ast::operand& out,
+            std::size_t& offset,
+            std::string& expected) {
+            std::string::const_iterator iter = text.begin();
+            std::string::const_iterator end = text.end();
+            try {
+                if (!phrase_parse(
+                        iter, end, client::expression(), x3::space, out)) {
+                    offset = 0;
+                    expected = "expression";
+                    return false;
+                }
+            } catch (
+                x3::expectation_failure<std::string::const_iterator> const&
+                    failure) {
+                offset = failure.where() - text.begin();
+                expected = failure.which();
+                return false;
+            }
+            if (iter != end) {
+                offset = iter - text.begin();
+                expected = "end of input";
+                return false;
+            }
+            return true;
+        }
+
+        void
+        engine_error(std::string const& message, compile_error& error) {
+            error.offset = 0;
+            error.expected.clear();
+            error.message = message;
+        }
+    } // namespace
+
+    char const*
+    engine_name(engine target) {
+        switch (target) {
+        case engine::automatic: return "auto";
+        case engine::kernel: return "kernel";
+        case engine::table: return "table";
+        case engine::jit: return "jit";
+        case engine::vm: return "vm";
+        case engine::tree: return "tree";
+        }
+        return "?";
+    }
+
+    bool
+    parse_engine(std::string const& name, engine& out) {
+        for (engine target :
+             {engine::automatic,
+              engine::kernel,
+              engine::table,
+              engine::jit,
+              engine::vm,
+              engine::tree}) {
+            if (name == engine_name(target)) {
+                out = target;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    char const*
+    frontend_name(frontend parser) {
+        switch (parser) {
+        case frontend::pratt: return "pratt";
+        case frontend::x3: return "x3";
+        }
+        return "?";
+    }
+
+    bool
+    parse_frontend(std::string const& name, frontend& out) {
+        for (frontend parser : {frontend::pratt, frontend::x3}) {
+            if (name == frontend_name(parser)) {
+                out = parser;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool
+    compiled_rule::compile(
+        std::string const& text,
+        engine preferred,
+        compiled_rule& out,
+        compile_error& error,
+        frontend parser) noexcept try {
+        const std::size_t invalid{
+            scan::first_invalid(text.data(), text.size())};
+        if (invalid != text.size()) {
+            syntax_error(text, invalid, "character", error);
+            return false;
+        }
+        const std::size_t deep{scan::too_deep(text.data(), text.size())};
+        if (deep != text.size()) {
+            syntax_error(text, deep, "nesting depth", error);
+            return false;
+        }
+
+        compiled_rule rule;
+        rule.source = text;
+
+        std::size_t offset = 0;
+        std::string expected;
+        const bool parsed{
+            parser == frontend::pratt
+                ? pratt::parse(text, rule.tree, offset, expected)
+                : parse_x3(text, rule.tree, offset, expected)};
+        if (!parsed) {
+            syntax_error(text, offset, expected, error);
+            return false;
+        }
+        rule.parsed_nodes = ast::node_counter{}(rule.tree);
+        rule.removed_nodes = ast::optimize(rule.tree);
+        rule.hash = kernels::fingerprint(rule.tree);
+        rule.key = canonical::key(rule.tree);
+        rule.identity = canonical::hash(rule.key);
+
+        std::string message;
+        switch (preferred) {
+        case engine::automatic:
+        case engine::kernel:
+            rule.builtin = kernels::find(rule.tree);
+            if (rule.builtin) {
+                rule.target = engine::kernel;
+                break;
+            }
+            if (preferred == engine::kernel) {
+                engine_error("not one of the standard rules", error);
+                return false;
+            }
+            // fall through
+        case engine::table:
+            if (periodic::tabulate(rule.tree, rule.lookup)) {
+                rule.target = engine::table;
+                break;
+            }
+            if (preferred == engine::table) {
+                engine_error("not periodic", error);
+                return false;
+            }
+            // fall through
+        case engine::vm:
+            if (!vm::compile(rule.tree, rule.code, message)) {
+                engine_error(message, error);
+                return false;
+            }
+            rule.target = engine::vm;
+            break;
+        case engine::jit:
+            if (!jit::compile(rule.tree, rule.native, message)) {
+                engine_error(message, error);
+                return false;
+            }
+            rule.target = engine::jit;
+            break;
+        case engine::tree:
+            flat::flatten(rule.tree, rule.flattened);
+            rule.target = engine::tree;
+            break;
+        }
+
+        out = std::move(rule);
+        return true;
+    } catch (std::exception const& failure) {
+        // Only allocation failures are expected here; reporting them may
+        // itself fail, in which case the message is left empty.
+        try {
+            engine_error(failure.what(), error);
+        } catch (...) {
+        }
+        return false;
+    } catch (...) {
+        try {
+            engine_error("unknown error", error);
+        } catch (...) {
+        }
+        return false;
+    }
+
+    bool
+    compiled_rule::compile(
+        std::string const& text,
+        engine preferred,
+        compiled_rule& out,
+        std::string& error,
+        frontend parser) {
+        compile_error failure;
+        if (!compile(text, preferred, out, failure, parser)) {
+            error = failure.message;
+            return false;
+        }
+        return true;
+    }
+
+    uint
+    compiled_rule::operator()(uint n) const {
+        switch (target) {
+        case engine::kernel: return builtin->evaluate(n);
+        case engine::table: return lookup(n);
+        case engine::vm: return vm::run(code, n);
+        case engine::jit: return native(n);
+        case engine::automatic:
+        case engine::tree: break;
+        }
+        return flattened(n);
+    }
+
+} // namespace client
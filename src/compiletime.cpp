@@ -0,0 +1,62 @@
+#include <utility>
+
+#include "compiletime.hpp"
+#include "corpus.hpp"
+
+// Build-time verification: every rule in the test corpus is parsed by the
+// constexpr parser and compared with its truth function for n in
+// [0, 1000]. The range is split so that no single constant evaluation
+// exceeds the compilers' default constexpr step limits.
+
+namespace client {
+namespace compiletime {
+    namespace {
+        constexpr uint last = 1000;
+        constexpr uint step = 50;
+
+        template <std::size_t Index>
+        struct parsed {
+            static constexpr auto prog{parse(corpus::rules[Index].expression)};
+            static_assert(prog.valid(), "corpus rule failed to parse");
+            static_assert(
+                rule<prog>::evaluate(last) == corpus::rules[Index].truth(last),
+                "inlined rule does not match its truth function");
+        };
+
+        template <std::size_t Index, uint First>
+        struct verified {
+            static_assert(
+                matches(
+                    parsed<Index>::prog,
+                    corpus::rules[Index].truth,
+                    First,
+                    First + step - 1),
+                "corpus rule does not match its truth function");
+            static constexpr bool value = true;
+        };
+
+        template <std::size_t Index, std::size_t... Chunk>
+        constexpr bool
+        verify_rule(std::index_sequence<Chunk...>) {
+            return (verified<Index, Chunk * step>::value && ...);
+        }
+
+        template <std::size_t... Index>
+        constexpr bool
+        verify(std::index_sequence<Index...>) {
+            return (verify_rule<Index>(
+                        std::make_index_sequence<last / step + 1>()) &&
+                    ...);
+        }
+
+        static_assert(verify(std::make_index_sequence<corpus::size>()));
+
+        static_assert(!parse("n ==").valid());
+        static_assert(!parse("(n % 10").valid());
+        static_assert(!parse("n ? 1").valid());
+        static_assert(!parse("x % 10").valid());
+        static_assert(!parse("nn == 1").valid());
+        static_assert(parse("n != 1 ?").error == 8);
+    } // namespace
+} // namespace compiletime
+} // namespace client
@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "ast.hpp"
+#include "batch.hpp"
+#include "compiled_rule.hpp"
+#include "corpus.hpp"
+#include "exhaustive.hpp"
+#include "jit.hpp"
+#include "kernels.hpp"
+#include "periodic.hpp"
+#include "vm.hpp"
+
+namespace client {
+namespace exhaustive {
+    namespace {
+        struct chunk {
+            std::uint64_t first;
+            std::uint64_t last;
+        };
+
+        struct queue {
+            std::mutex mutex;
+            std::deque<chunk> chunks;
+        };
+
+        // Values of n per chunk handed to a worker.
+        constexpr std::uint64_t chunk_size = 1 << 16;
+        // Values of n per call into the batch kernels.
+        constexpr std::size_t block = 4096;
+
+        typedef std::chrono::steady_clock clock;
+
+        double
+        seconds_since(clock::time_point start) {
+            return std::max(
+                std::chrono::duration<double>(clock::now() - start).count(),
+                1e-9);
+        }
+    } // namespace
+
+    bool
+    parallel_for(
+        std::size_t threads,
+        std::uint64_t first,
+        std::uint64_t last,
+        std::uint64_t grain,
+        std::function<bool(std::size_t, std::uint64_t, std::uint64_t)> const&
+            task,
+        std::function<void(std::uint64_t)> const& progress) {
+        threads = std::max<std::size_t>(threads, 1);
+        std::vector<queue> queues(threads);
+        const std::uint64_t chunks{(last - first) / grain + 1};
+        for (std::uint64_t idx = 0; idx < chunks; ++idx) {
+            const std::uint64_t begin{first + idx * grain};
+            const std::uint64_t end{std::min(last, begin + grain - 1)};
+            queues[idx * threads / chunks].chunks.push_back({begin, end});
+        }
+
+        std::atomic<std::uint64_t> done{0};
+        std::atomic<bool> failed{false};
+        std::atomic<std::size_t> running{threads};
+        std::mutex mutex;
+        std::condition_variable finished;
+
+        auto take = [&](std::size_t self, chunk& out) {
+            for (std::size_t offset = 0; offset < threads; ++offset) {
+                queue& victim = queues[(self + offset) % threads];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.chunks.empty()) {
+                    continue;
+                }
+                // Own work from the back, stolen work from the front.
+                if (offset == 0) {
+                    out = victim.chunks.back();
+                    victim.chunks.pop_back();
+                } else {
+                    out = victim.chunks.front();
+                    victim.chunks.pop_front();
+                }
+                return true;
+            }
+            return false;
+        };
+
+        std::vector<std::thread> workers;
+        for (std::size_t self = 0; self < threads; ++self) {
+            workers.emplace_back([&, self] {
+                chunk next;
+                while (!failed.load(std::memory_order_relaxed) &&
+                       take(self, next)) {
+                    if (!task(self, next.first, next.last)) {
+                        failed.store(true, std::memory_order_relaxed);
+                    }
+                    done.fetch_add(
+                        next.last - next.first + 1, std::memory_order_relaxed);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--running == 0) {
+                    finished.notify_one();
+                }
+            });
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!finished.wait_for(
+                lock, std::chrono::milliseconds(500), [&] {
+                    return running == 0;
+                })) {
+                progress(done.load(std::memory_order_relaxed));
+            }
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        return !failed.load();
+    }
+
+    namespace {
+        // Runs one engine over [0, config.last] for one rule. `check`
+        // tests a chunk and reports the n of a mismatch through `bad`.
+        template <typename Check>
+        bool
+        sweep(
+            std::string const& label,
+            options const& config,
+            std::size_t threads,
+            uint (*truth)(uint),
+            Check const& check) {
+            const double total{config.last + 1.0};
+            std::atomic<std::uint64_t> mismatch{0};
+            const clock::time_point start{clock::now()};
+
+            auto task = [&](std::size_t worker,
+                            std::uint64_t first,
+                            std::uint64_t last) {
+                std::uint64_t bad;
+                if (check(worker, first, last, bad)) {
+                    return true;
+                }
+                mismatch.store(bad);
+                return false;
+            };
+            auto progress = [&](std::uint64_t done) {
+                std::cout << '\r' << label << std::fixed
+                          << std::setprecision(1) << std::setw(6)
+                          << 100.0 * done / total << '%' << std::setw(8)
+                          << std::setprecision(2)
+                          << done / seconds_since(start) / 1e9 << " Gn/s"
+                          << std::flush;
+            };
+            const bool passed{parallel_for(
+                threads, 0, config.last, chunk_size, task, progress)};
+
+            const double elapsed{seconds_since(start)};
+            std::cout << '\r' << label << (passed ? "     ok" : "   FAIL")
+                      << std::fixed << std::setprecision(2) << std::setw(8)
+                      << total / elapsed / 1e9 << " Gn/s" << std::setw(9)
+                      << elapsed << " s" << std::endl;
+            if (!passed) {
+                const uint n = mismatch.load();
+                std::cout << "  mismatch at n = " << n << ", truth is "
+                          << truth(n) << std::endl;
+            }
+            return passed;
+        }
+
+        // A chunk check for engines that evaluate one n at a time.
+        template <typename Evaluate>
+        auto
+        scalar(uint (*truth)(uint), Evaluate const& evaluate) {
+            return [truth, &evaluate](
+                       std::size_t,
+                       std::uint64_t first,
+                       std::uint64_t last,
+                       std::uint64_t& bad) {
+                for (std::uint64_t n = first; n <= last; ++n) {
+                    if (evaluate(static_cast<uint>(n)) !=
+                        truth(static_cast<uint>(n))) {
+                        bad = n;
+                        return false;
+                    }
+                }
+                return true;
+            };
+        }
+    } // namespace
+
+    bool
+    verify(options const& config) {
+        static char const* const engines[]{
+            "all", "kernel", "table", "jit", "batch", "vm", "tree"};
+        if (std::find(std::begin(engines), std::end(engines), config.engine) ==
+            std::end(engines)) {
+            std::cout << "Unknown engine " << std::quoted(config.engine)
+                      << std::endl;
+            return false;
+        }
+        auto wanted = [&](std::string const& name) {
+            return config.engine == name ||
+                   (config.engine == "all" && name != "tree");
+        };
+
+        const std::size_t threads{
+            config.threads ? config.threads
+                           : std::max(1u, std::thread::hardware_concurrency())};
+        std::cout << "Checking n in [0, " << config.last << "] on " << threads
+                  << " threads" << std::endl;
+
+        bool success{true};
+        for (std::size_t idx = 0; idx < corpus::size; ++idx) {
+            corpus::entry const& test = corpus::rules[idx];
+            uint (*truth)(uint) = test.truth;
+
+            compiled_rule rule;
+            std::string error;
+            if (!compiled_rule::compile(
+                    test.expression, engine::tree, rule, error)) {
+                std::cout << "rule " << idx << ": " << error << std::endl;
+                success = false;
+                continue;
+            }
+            ast::operand const& program = rule.program();
+            kernels::kernel const* kernel{kernels::find(program)};
+
+            auto label = [&](char const* engine) {
+                std::ostringstream out;
+                out << "rule " << std::setw(2) << idx << "  " << std::left
+                    << std::setw(16) << (kernel ? kernel->name : "")
+                    << std::setw(8) << engine;
+                return out.str();
+            };
+
+            if (wanted("kernel") && kernel) {
+                auto evaluate = [kernel](uint n) {
+                    return kernel->evaluate(n);
+                };
+                success &= sweep(
+                    label("kernel"),
+                    config,
+                    threads,
+                    truth,
+                    scalar(truth, evaluate));
+            }
+
+            periodic::table table;
+            if (wanted("table") && periodic::tabulate(program, table)) {
+                success &= sweep(
+                    label("table"),
+                    config,
+                    threads,
+                    truth,
+                    scalar(truth, table));
+            }
+
+            jit::function function;
+            if (wanted("jit") && jit::available() &&
+                jit::compile(program, function, error)) {
+                success &= sweep(
+                    label("jit"),
+                    config,
+                    threads,
+                    truth,
+                    scalar(truth, function));
+            }
+
+            batch::program batch;
+            if (wanted("batch") && batch::compile(program, batch, error)) {
+                std::vector<std::vector<uint>> ns(
+                    threads, std::vector<uint>(block));
+                std::vector<std::vector<std::uint8_t>> results(
+                    threads, std::vector<std::uint8_t>(block));
+                auto check = [&](std::size_t worker,
+                                 std::uint64_t first,
+                                 std::uint64_t last,
+                                 std::uint64_t& bad) {
+                    uint* in = ns[worker].data();
+                    std::uint8_t* out = results[worker].data();
+                    for (std::uint64_t base = first; base <= last;
+                         base += block) {
+                        const std::size_t count{static_cast<std::size_t>(
+                            std::min<std::uint64_t>(block, last - base + 1))};
+                        for (std::size_t lane = 0; lane < count; ++lane) {
+                            in[lane] = base + lane;
+                        }
+                        batch::evaluate(batch, in, out, count);
+                        for (std::size_t lane = 0; lane < count; ++lane) {
+                            if (out[lane] != std::min(truth(in[lane]), 255u)) {
+                                bad = in[lane];
+                                return false;
+                            }
+                        }
+                    }
+                    return true;
+                };
+                success &= sweep(label("batch"), config, threads, truth, check);
+            }
+
+            vm::program bytecode;
+            if (wanted("vm") && vm::compile(program, bytecode, error)) {
+                auto evaluate = [&bytecode](uint n) {
+                    return vm::run(bytecode, n);
+                };
+                success &= sweep(
+                    label("vm"),
+                    config,
+                    threads,
+                    truth,
+                    scalar(truth, evaluate));
+            }
+
+            // `rule` was compiled for engine::tree, so this sweeps the flat
+            // tree that engine evaluates.
+            if (wanted("tree")) {
+                auto evaluate = [&rule](uint n) { return rule(n); };
+                success &= sweep(
+                    label("tree"),
+                    config,
+                    threads,
+                    truth,
+                    scalar(truth, evaluate));
+            }
+        }
+        return success;
+    }
+
+} // namespace exhaustive
+} // namespace client
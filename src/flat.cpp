@@ -0,0 +1,236 @@
+#include <functional>
+#include <boost/spirit/home/x3.hpp>
+
+#include "flat.hpp"
+#include "scan.hpp"
+
+namespace client {
+namespace flat {
+    namespace x3 = boost::spirit::x3;
+
+    namespace {
+        // The same grammar as parser_def.hpp, except that every rule
+        // synthesizes the index of the node it added to the tree passed in
+        // through the context, so nothing but the node array is allocated.
+        struct tree_tag;
+
+#define add_operation(NAME, OP) this->add(NAME, {ast::optoken::OP});
+
+        struct multiplicative_op_ : x3::symbols<ast::binary_operator> {
+            multiplicative_op_() {
+                add_operation("%", mod);
+            }
+        } const multiplicative_op;
+
+        struct logical_op_ : x3::symbols<ast::binary_operator> {
+            logical_op_() {
+                add_operation("&&", logical_and);
+                add_operation("||", logical_or);
+            }
+        } const logical_op;
+
+        struct relational_op_ : x3::symbols<ast::binary_operator> {
+            relational_op_() {
+                add_operation("<", less);
+                add_operation("<=", less_equal);
+                add_operation(">", greater);
+                add_operation(">=", greater_equal);
+            }
+        } const relational_op;
+
+        struct equality_op_ : x3::symbols<ast::binary_operator> {
+            equality_op_() {
+                add_operation("==", equal);
+                add_operation("!=", not_equal);
+            }
+        } const equality_op;
+#undef add_operation
+
+        template <typename Context>
+        std::uint32_t
+        add(Context const& ctx, node const& value) {
+            return x3::get<tree_tag>(ctx).get().add(value);
+        }
+
+        auto pass = [](auto& ctx) { x3::_val(ctx) = x3::_attr(ctx); };
+
+        auto make_constant = [](auto& ctx) {
+            x3::_val(ctx) =
+                add(ctx, {kind::constant, {}, x3::_attr(ctx), 0, 0});
+        };
+
+        auto make_variable = [](auto& ctx) {
+            auto const& name = x3::_attr(ctx);
+            std::uint32_t slot = 0;
+            if (!ast::find_variable({&*name.begin(), name.size()}, slot)) {
+                boost::throw_exception(
+                    x3::expectation_failure<decltype(name.begin())>(
+                        name.begin(), ast::expected_variable()));
+            }
+            x3::_val(ctx) = add(ctx, {kind::variable, {}, slot, 0, 0});
+        };
+
+        auto make_binary_op = [](auto& ctx) {
+            using boost::fusion::at_c;
+            x3::_val(ctx) = add(
+                ctx,
+                {kind::binary,
+                 at_c<0>(x3::_attr(ctx)),
+                 x3::_val(ctx),
+                 at_c<1>(x3::_attr(ctx)),
+                 0});
+        };
+
+        auto make_conditional_op = [](auto& ctx) {
+            using boost::fusion::at_c;
+            x3::_val(ctx) = add(
+                ctx,
+                {kind::conditional,
+                 {},
+                 x3::_val(ctx),
+                 at_c<0>(x3::_attr(ctx)),
+                 at_c<1>(x3::_attr(ctx))});
+        };
+
+        x3::rule<class expression, std::uint32_t> const expression{
+            "expression"};
+        x3::rule<class conditional, std::uint32_t> const conditional{
+            "conditional"};
+        x3::rule<class primary, std::uint32_t> const primary{"primary"};
+        x3::rule<class logical, std::uint32_t> const logical{"logical"};
+        x3::rule<class equality, std::uint32_t> const equality{"equality"};
+        x3::rule<class relational, std::uint32_t> const relational{
+            "relational"};
+        x3::rule<class multiplicative, std::uint32_t> const multiplicative{
+            "multiplicative"};
+
+        auto const expression_def = conditional;
+
+        auto const conditional_def =
+            logical[pass] >>
+            -('?' > expression > ':' > expression)[make_conditional_op];
+
+        // `logical > logical` consumes every following logical operator,
+        // so this matches parser_def.hpp's right-nested && and ||.
+        auto const logical_def =
+            equality[pass] >> *(logical_op > logical)[make_binary_op];
+
+        auto const equality_def =
+            relational[pass] >> *(equality_op > relational)[make_binary_op];
+
+        auto const relational_def =
+            multiplicative[pass] >>
+            *(relational_op > multiplicative)[make_binary_op];
+
+        auto const multiplicative_def =
+            primary[pass] >> *(multiplicative_op > primary)[make_binary_op];
+
+        auto const primary_def =
+            x3::uint_[make_constant] | ('(' > expression > ')')[pass] |
+            x3::lexeme[x3::raw[x3::alpha >> *x3::alnum]][make_variable];
+
+        BOOST_SPIRIT_DEFINE(
+            expression,
+            conditional,
+            primary,
+            logical,
+            equality,
+            relational,
+            multiplicative);
+
+        struct flattener {
+            typedef std::uint32_t result_type;
+
+            tree& out;
+
+            result_type
+            operator()(ast::operand const& ast) const {
+                return boost::apply_visitor(*this, ast.get());
+            }
+
+            result_type
+            operator()(ast::nil) const {
+                return out.add({kind::constant, {}, 0, 0, 0});
+            }
+
+            result_type
+            operator()(ast::expression const& ast) const {
+                std::uint32_t lhs = boost::apply_visitor(*this, ast.lhs);
+                for (ast::operation const& op : ast.rhs) {
+                    std::uint32_t rhs = boost::apply_visitor(*this, op.rhs);
+                    lhs = out.add({kind::binary, op.op, lhs, rhs, 0});
+                }
+                return lhs;
+            }
+
+            result_type
+            operator()(ast::binary_op const& ast) const {
+                std::uint32_t lhs = boost::apply_visitor(*this, ast.lhs);
+                std::uint32_t rhs = boost::apply_visitor(*this, ast.rhs);
+                return out.add({kind::binary, ast.op, lhs, rhs, 0});
+            }
+
+            result_type
+            operator()(ast::conditional_op const& ast) const {
+                std::uint32_t lhs = boost::apply_visitor(*this, ast.lhs);
+                std::uint32_t yes = boost::apply_visitor(*this, ast.rhs_true);
+                std::uint32_t no = boost::apply_visitor(*this, ast.rhs_false);
+                return out.add({kind::conditional, {}, lhs, yes, no});
+            }
+
+            result_type
+            operator()(uint const& ast) const {
+                return out.add({kind::constant, {}, ast, 0, 0});
+            }
+
+            result_type
+            operator()(ast::variable const& ast) const {
+                return out.add({kind::variable, {}, ast.slot, 0, 0});
+            }
+        };
+    } // namespace
+
+    bool
+    parse(std::string const& text, tree& out, std::string& error) {
+        out.clear();
+        out.reserve(text.size());
+
+        const std::size_t deep{scan::too_deep(text.data(), text.size())};
+        if (deep != text.size()) {
+            error = "nested too deeply at \"" + text.substr(deep) + "\"";
+            return false;
+        }
+
+        std::string::const_iterator iter = text.begin();
+        std::string::const_iterator end = text.end();
+        std::uint32_t root = 0;
+        try {
+            if (!phrase_parse(
+                    iter,
+                    end,
+                    x3::with<tree_tag>(std::ref(out))[expression],
+                    x3::space,
+                    root) ||
+                iter != end) {
+                error =
+                    "parsing stopped at \"" + std::string(iter, end) + "\"";
+                return false;
+            }
+        } catch (x3::expectation_failure<std::string::const_iterator> const&
+                     failure) {
+            error = "expected " + failure.which() + " at \"" +
+                    std::string(failure.where(), end) + "\"";
+            return false;
+        }
+        out.set_root(root);
+        return true;
+    }
+
+    void
+    flatten(ast::operand const& ast, tree& out) {
+        out.clear();
+        out.set_root(flattener{out}(ast));
+    }
+
+} // namespace flat
+} // namespace client
@@ -0,0 +1,436 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image.hpp"
+
+namespace client {
+namespace image {
+    namespace {
+        // Instructions and divisors are used in place, so their layout is
+        // part of the format.
+        static_assert(sizeof(header) == 64 && sizeof(record) == 64);
+        static_assert(
+            std::is_trivially_copyable<vm::instruction>::value &&
+            sizeof(vm::instruction) == 8 &&
+            offsetof(vm::instruction, arg) == 4);
+        static_assert(
+            std::is_trivially_copyable<divisor>::value &&
+            sizeof(divisor) == 16 && offsetof(divisor, magic) == 8);
+
+        // Where the bytes covered by the checksum start.
+        constexpr std::size_t checked{
+            offsetof(header, checksum) + sizeof(std::uint64_t)};
+
+        std::uint64_t
+        checksum(char const* data, std::size_t size) {
+            std::uint64_t state = 0xcbf29ce484222325;
+            for (std::size_t idx = 0; idx < size; ++idx) {
+                state = (state ^ static_cast<std::uint8_t>(data[idx])) *
+                        0x100000001b3;
+            }
+            return state;
+        }
+
+        // Appends `size` bytes at the next multiple of 8 and returns their
+        // offset. Padding is zeroed so that images are reproducible.
+        std::uint32_t
+        append(std::string& out, void const* data, std::size_t size) {
+            out.resize((out.size() + 7) & ~std::size_t{7}, '\0');
+            const std::uint32_t offset = out.size();
+            out.append(static_cast<char const*>(data), size);
+            return offset;
+        }
+
+        // Copies the fields of `in`, leaving padding bytes zero.
+        void
+        put(std::string& out, vm::instruction const& in) {
+            char bytes[sizeof(vm::instruction)]{};
+            std::memcpy(bytes, &in.op, sizeof(in.op));
+            std::memcpy(
+                bytes + offsetof(vm::instruction, arg),
+                &in.arg,
+                sizeof(in.arg));
+            out.append(bytes, sizeof(bytes));
+        }
+
+        void
+        put(std::string& out, divisor const& in) {
+            char bytes[sizeof(divisor)]{};
+            std::memcpy(bytes, &in.value, sizeof(in.value));
+            std::memcpy(
+                bytes + offsetof(divisor, magic), &in.magic, sizeof(in.magic));
+            out.append(bytes, sizeof(bytes));
+        }
+
+        template <typename T>
+        std::uint32_t
+        append_all(std::string& out, std::vector<T> const& items) {
+            const std::uint32_t offset{append(out, nullptr, 0)};
+            for (T const& item : items) {
+                put(out, item);
+            }
+            return offset;
+        }
+
+        // Appends the tables or code of `rule` and points `to` at them.
+        void
+        append_rule(std::string& out, compiled_rule const& rule, record& to) {
+            to.target = static_cast<std::uint32_t>(rule.selected());
+            if (rule.selected() == engine::table) {
+                periodic::table const& table = rule.table();
+                to.threshold = table.threshold;
+                to.exceptions = append(
+                    out, table.exceptions.data(), table.exceptions.size());
+                to.residues = append(
+                    out, table.residues.data(), table.residues.size());
+                to.divisors = append(out, nullptr, 0);
+                put(out, table.period);
+                to.divisor_count = 1;
+                return;
+            }
+            vm::program const& code = rule.bytecode();
+            to.divisors = append_all(out, code.divisors);
+            to.divisor_count = code.divisors.size();
+            to.code = append_all(out, code.code);
+            to.code_size = code.code.size();
+            to.slots = code.slots.size();
+        }
+
+        bool
+        in_bounds(
+            std::size_t length,
+            std::uint64_t offset,
+            std::uint64_t size,
+            std::size_t alignment = 1) {
+            return offset % alignment == 0 && offset <= length &&
+                   size <= length - offset;
+        }
+
+        bool
+        check_divisors(
+            std::string_view bytes, record const& self, std::string& error) {
+            if (!in_bounds(
+                    bytes.size(),
+                    self.divisors,
+                    std::uint64_t{self.divisor_count} * sizeof(divisor),
+                    alignof(divisor))) {
+                error = "divisors out of bounds";
+                return false;
+            }
+            divisor const* divisors{
+                reinterpret_cast<divisor const*>(bytes.data() + self.divisors)};
+            for (std::size_t idx = 0; idx < self.divisor_count; ++idx) {
+                if (divisors[idx].value == 0 ||
+                    divisors[idx].magic != divisor(divisors[idx].value).magic) {
+                    error = "corrupt divisor";
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool
+        check(std::string_view bytes, record const& self, std::string& error) {
+            if (!in_bounds(bytes.size(), self.name, self.name_size) ||
+                !in_bounds(bytes.size(), self.text, self.text_size)) {
+                error = "name or text out of bounds";
+                return false;
+            }
+            if (!check_divisors(bytes, self, error)) {
+                return false;
+            }
+            switch (static_cast<engine>(self.target)) {
+            case engine::table: {
+                if (self.divisor_count != 1) {
+                    error = "table without a period";
+                    return false;
+                }
+                divisor const& period{*reinterpret_cast<divisor const*>(
+                    bytes.data() + self.divisors)};
+                if (self.threshold > periodic::max_entries ||
+                    period.value > periodic::max_entries ||
+                    !in_bounds(bytes.size(), self.exceptions, self.threshold) ||
+                    !in_bounds(bytes.size(), self.residues, period.value)) {
+                    error = "table out of bounds";
+                    return false;
+                }
+                return true;
+            }
+            case engine::vm:
+                if (!in_bounds(
+                        bytes.size(),
+                        self.code,
+                        std::uint64_t{self.code_size} *
+                            sizeof(vm::instruction),
+                        alignof(vm::instruction))) {
+                    error = "code out of bounds";
+                    return false;
+                }
+                return vm::verify(
+                    reinterpret_cast<vm::instruction const*>(
+                        bytes.data() + self.code),
+                    self.code_size,
+                    self.divisor_count,
+                    self.slots,
+                    error);
+            default: error = "unknown engine"; return false;
+            }
+        }
+    } // namespace
+
+    bool
+    compile(std::string const& text, compiled_rule& out, std::string& error) {
+        return compiled_rule::compile(text, engine::table, out, error) ||
+               compiled_rule::compile(text, engine::vm, out, error);
+    }
+
+    bool
+    write(
+        std::vector<entry> const& rules, std::string& out, std::string& error) {
+        std::vector<entry const*> sorted;
+        for (entry const& rule : rules) {
+            if (rule.rule.selected() != engine::table &&
+                rule.rule.selected() != engine::vm) {
+                error = "rule " + std::string(rule.name) +
+                        " was not compiled for an image";
+                return false;
+            }
+            sorted.push_back(&rule);
+        }
+        std::stable_sort(
+            sorted.begin(),
+            sorted.end(),
+            [](entry const* a, entry const* b) { return a->name < b->name; });
+        for (std::size_t idx = 1; idx < sorted.size(); ++idx) {
+            if (!sorted[idx]->name.empty() &&
+                sorted[idx]->name == sorted[idx - 1]->name) {
+                error = "duplicate rule " + sorted[idx]->name;
+                return false;
+            }
+        }
+
+        std::vector<record> records(sorted.size(), record{});
+        out.assign(sizeof(header) + records.size() * sizeof(record), '\0');
+        // The data of the first rule with each canonical form.
+        std::map<std::string, record const*> shared;
+        for (std::size_t idx = 0; idx < sorted.size(); ++idx) {
+            compiled_rule const& rule = sorted[idx]->rule;
+            record& self = records[idx];
+            auto found = shared.find(rule.canonical());
+            if (found != shared.end()) {
+                self = *found->second;
+            } else {
+                append_rule(out, rule, self);
+                shared.emplace(rule.canonical(), &self);
+            }
+            self.name = append(
+                out, sorted[idx]->name.data(), sorted[idx]->name.size());
+            self.name_size = sorted[idx]->name.size();
+            self.text = append(out, rule.text().data(), rule.text().size());
+            self.text_size = rule.text().size();
+            self.canonical = rule.canonical_hash();
+        }
+        append(out, nullptr, 0);
+        if (out.size() > UINT32_MAX) {
+            error = "image larger than 4 GiB";
+            return false;
+        }
+
+        header head{};
+        std::memcpy(head.magic, magic, sizeof(magic));
+        head.version = version;
+        head.byte_order = byte_order;
+        head.size = out.size();
+        head.header_size = sizeof(header);
+        head.record_size = sizeof(record);
+        head.count = records.size();
+        head.records = sizeof(header);
+        std::memcpy(&out[0], &head, sizeof(head));
+        if (!records.empty()) {
+            std::memcpy(
+                &out[head.records],
+                records.data(),
+                records.size() * sizeof(record));
+        }
+        head.checksum = checksum(out.data() + checked, out.size() - checked);
+        std::memcpy(
+            &out[offsetof(header, checksum)],
+            &head.checksum,
+            sizeof(head.checksum));
+        return true;
+    }
+
+    std::string_view
+    rule::name() const {
+        return {base + self->name, self->name_size};
+    }
+
+    std::string_view
+    rule::text() const {
+        return {base + self->text, self->text_size};
+    }
+
+    uint
+    rule::operator()(uint n) const {
+        divisor const* divisors{
+            reinterpret_cast<divisor const*>(base + self->divisors)};
+        if (self->target == static_cast<std::uint32_t>(engine::table)) {
+            if (n < self->threshold) {
+                return static_cast<std::uint8_t>(base[self->exceptions + n]);
+            }
+            return static_cast<std::uint8_t>(
+                base[self->residues + divisors->remainder(n)]);
+        }
+        return vm::run(
+            reinterpret_cast<vm::instruction const*>(base + self->code),
+            divisors,
+            n);
+    }
+
+    bool
+    view::open(std::string_view bytes, view& out, std::string& error) {
+        if (reinterpret_cast<std::uintptr_t>(bytes.data()) % 8 != 0) {
+            error = "image is not aligned";
+            return false;
+        }
+        if (bytes.size() < sizeof(header)) {
+            error = "image is truncated";
+            return false;
+        }
+        header const& head{*reinterpret_cast<header const*>(bytes.data())};
+        if (std::memcmp(head.magic, magic, sizeof(magic)) != 0) {
+            error = "not an image of plural rules";
+            return false;
+        }
+        if (head.byte_order != byte_order) {
+            error = "image has the other byte order";
+            return false;
+        }
+        if (head.version != version) {
+            error = "image version " + std::to_string(head.version) +
+                    ", expected " + std::to_string(version);
+            return false;
+        }
+        if (head.header_size != sizeof(header) ||
+            head.record_size != sizeof(record)) {
+            error = "unexpected header or record size";
+            return false;
+        }
+        if (head.size != bytes.size()) {
+            error = "image is " + std::to_string(bytes.size()) +
+                    " bytes, its header says " + std::to_string(head.size);
+            return false;
+        }
+        if (checksum(bytes.data() + checked, bytes.size() - checked) !=
+            head.checksum) {
+            error = "checksum mismatch";
+            return false;
+        }
+        if (!in_bounds(
+                bytes.size(),
+                head.records,
+                std::uint64_t{head.count} * sizeof(record),
+                alignof(record))) {
+            error = "records out of bounds";
+            return false;
+        }
+
+        view checked_view;
+        checked_view.base = bytes.data();
+        checked_view.length = bytes.size();
+        checked_view.records =
+            reinterpret_cast<record const*>(bytes.data() + head.records);
+        checked_view.count = head.count;
+        for (std::size_t idx = 0; idx < head.count; ++idx) {
+            if (!check(bytes, checked_view.records[idx], error)) {
+                error = "rule " + std::to_string(idx) + ": " + error;
+                return false;
+            }
+            if (idx &&
+                checked_view[idx].name() < checked_view[idx - 1].name()) {
+                error = "rules are not sorted by name";
+                return false;
+            }
+        }
+        out = checked_view;
+        return true;
+    }
+
+    bool
+    view::find(std::string_view name, rule& out) const {
+        std::size_t first = 0;
+        std::size_t last = count;
+        while (first < last) {
+            const std::size_t middle{first + (last - first) / 2};
+            if ((*this)[middle].name() < name) {
+                first = middle + 1;
+            } else {
+                last = middle;
+            }
+        }
+        if (first == count || (*this)[first].name() != name) {
+            return false;
+        }
+        out = (*this)[first];
+        return true;
+    }
+
+    file::~file() {
+        if (address) {
+            munmap(address, size);
+        }
+    }
+
+    bool
+    file::open(std::string const& path, std::string& error) {
+        const int fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (fd < 0) {
+            error = std::strerror(errno);
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            error = std::strerror(errno);
+            close(fd);
+            return false;
+        }
+        if (info.st_size < static_cast<off_t>(sizeof(header))) {
+            error = "image is truncated";
+            close(fd);
+            return false;
+        }
+        void* mapped{
+            mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            error = std::strerror(errno);
+            return false;
+        }
+        view checked_view;
+        if (!view::open(
+                {static_cast<char const*>(mapped),
+                 static_cast<std::size_t>(info.st_size)},
+                checked_view,
+                error)) {
+            munmap(mapped, info.st_size);
+            return false;
+        }
+        if (address) {
+            munmap(address, size);
+        }
+        address = mapped;
+        size = info.st_size;
+        loaded = checked_view;
+        return true;
+    }
+
+} // namespace image
+} // namespace client
@@ -0,0 +1,301 @@
+#include <cstring>
+#include <utility>
+#include <boost/foreach.hpp>
+
+#include "ast.hpp"
+#include "divisor.hpp"
+#include "jit.hpp"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#define PLURALS_JIT_X86_64 1
+#endif
+
+namespace client {
+namespace jit {
+#if defined(PLURALS_JIT_X86_64)
+    // Register use: n arrives in edi and the result is left in eax. Right
+    // operands are materialized in ecx; nested right operands spill the
+    // left one with push/pop. edx is clobbered by mul and div.
+    struct emitter {
+        typedef bool result_type;
+
+        emitter(std::vector<std::uint8_t>& code, std::string& error)
+            : code(code), error(error) {}
+        std::vector<std::uint8_t>& code;
+        std::string& error;
+
+        result_type
+        operator()(ast::operand const& ast) {
+            return boost::apply_visitor(*this, ast.get());
+        }
+
+        result_type
+        operator()(ast::nil) {
+            error = "empty operand";
+            return false;
+        }
+
+        result_type
+        operator()(ast::expression const& ast) {
+            if (!(*this)(ast.lhs)) {
+                return false;
+            }
+            BOOST_FOREACH (ast::operation const& op, ast.rhs) {
+                if (!operation(op.op, op.rhs)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        result_type
+        operator()(ast::binary_op const& ast) {
+            return (*this)(ast.lhs) && operation(ast.op, ast.rhs);
+        }
+
+        result_type
+        operator()(ast::conditional_op const& ast) {
+            if (!(*this)(ast.lhs)) {
+                return false;
+            }
+            bytes({0x85, 0xC0});       // test eax, eax
+            bytes({0x0F, 0x84});       // jz else
+            const std::size_t to_else{placeholder()};
+            if (!(*this)(ast.rhs_true)) {
+                return false;
+            }
+            bytes({0xE9});             // jmp end
+            const std::size_t to_end{placeholder()};
+            patch(to_else);
+            if (!(*this)(ast.rhs_false)) {
+                return false;
+            }
+            patch(to_end);
+            return true;
+        }
+
+        result_type
+        operator()(uint const& ast) {
+            bytes({0xB8});             // mov eax, imm32
+            imm32(ast);
+            return true;
+        }
+
+        // The function's only argument, so every slot is n.
+        result_type
+        operator()(ast::variable const&) {
+            static_assert(
+                ast::variable_count == 1, "the JIT passes only n to rules");
+            bytes({0x89, 0xF8});       // mov eax, edi
+            return true;
+        }
+
+        // eax = eax <op> rhs
+        bool
+        operation(ast::binary_operator const& op, ast::operand const& rhs) {
+            uint const* constant = boost::get<uint>(&rhs.get());
+            if (op.code == ast::optoken::mod && constant) {
+                if (*constant == 0) {
+                    error = "modulo by constant zero";
+                    return false;
+                }
+                modulo(divisor(*constant));
+                return true;
+            }
+
+            if (constant) {
+                bytes({0xB9});         // mov ecx, imm32
+                imm32(*constant);
+            } else if (boost::get<ast::variable>(&rhs.get())) {
+                bytes({0x89, 0xF9});   // mov ecx, edi
+            } else {
+                bytes({0x50});         // push rax
+                if (!(*this)(rhs)) {
+                    return false;
+                }
+                bytes({0x89, 0xC1});   // mov ecx, eax
+                bytes({0x58});         // pop rax
+            }
+
+            switch (op.code) {
+            case ast::optoken::mod:
+                bytes({0x85, 0xC9});   // test ecx, ecx
+                bytes({0x75, 0x04});   // jnz +4
+                bytes({0x31, 0xC0});   // xor eax, eax
+                bytes({0xEB, 0x06});   // jmp +6
+                bytes({0x31, 0xD2});   // xor edx, edx
+                bytes({0xF7, 0xF1});   // div ecx
+                bytes({0x89, 0xD0});   // mov eax, edx
+                return true;
+            case ast::optoken::logical_and:
+            case ast::optoken::logical_or:
+                bytes({0x85, 0xC0});       // test eax, eax
+                bytes({0x0F, 0x95, 0xC0}); // setne al
+                bytes({0x85, 0xC9});       // test ecx, ecx
+                bytes({0x0F, 0x95, 0xC1}); // setne cl
+                if (op.code == ast::optoken::logical_and) {
+                    bytes({0x20, 0xC8});   // and al, cl
+                } else {
+                    bytes({0x08, 0xC8});   // or al, cl
+                }
+                bytes({0x0F, 0xB6, 0xC0}); // movzx eax, al
+                return true;
+            case ast::optoken::less: return compare(0x92);          // setb
+            case ast::optoken::less_equal: return compare(0x96);    // setbe
+            case ast::optoken::greater: return compare(0x97);       // seta
+            case ast::optoken::greater_equal: return compare(0x93); // setae
+            case ast::optoken::equal: return compare(0x94);         // sete
+            case ast::optoken::not_equal: return compare(0x95);     // setne
+            }
+            error = std::string("unknown operator '") + op.name() + "'";
+            return false;
+        }
+
+        bool
+        compare(std::uint8_t setcc) {
+            bytes({0x39, 0xC8});           // cmp eax, ecx
+            bytes({0x0F, setcc, 0xC0});    // setcc al
+            bytes({0x0F, 0xB6, 0xC0});     // movzx eax, al
+            return true;
+        }
+
+        // See client::divisor: eax = hi64(lo64(magic * eax) * d).
+        void
+        modulo(divisor const& d) {
+            bytes({0x89, 0xC1});               // mov ecx, eax
+            bytes({0x48, 0xB8});               // mov rax, imm64
+            imm64(d.magic);
+            bytes({0x48, 0x0F, 0xAF, 0xC1});   // imul rax, rcx
+            bytes({0xB9});                     // mov ecx, imm32
+            imm32(d.value);
+            bytes({0x48, 0xF7, 0xE1});         // mul rcx
+            bytes({0x89, 0xD0});               // mov eax, edx
+        }
+
+        void
+        bytes(std::initializer_list<std::uint8_t> values) {
+            code.insert(code.end(), values);
+        }
+
+        void
+        imm32(std::uint32_t value) {
+            for (int shift = 0; shift < 32; shift += 8) {
+                code.push_back(value >> shift);
+            }
+        }
+
+        void
+        imm64(std::uint64_t value) {
+            for (int shift = 0; shift < 64; shift += 8) {
+                code.push_back(value >> shift);
+            }
+        }
+
+        std::size_t
+        placeholder() {
+            imm32(0);
+            return code.size();
+        }
+
+        // Points the rel32 ending at `end` to the current position.
+        void
+        patch(std::size_t end) {
+            const std::uint32_t rel = code.size() - end;
+            for (int idx = 0; idx < 4; ++idx) {
+                code[end - 4 + idx] = rel >> (8 * idx);
+            }
+        }
+    };
+
+    bool
+    available() {
+        return true;
+    }
+
+    bool
+    compile(ast::operand const& ast, function& out, std::string& error) {
+        std::vector<std::uint8_t> code;
+        emitter emit(code, error);
+        if (!emit(ast)) {
+            return false;
+        }
+        code.push_back(0xC3); // ret
+
+        const std::size_t page = sysconf(_SC_PAGESIZE);
+        const std::size_t size = (code.size() + page - 1) / page * page;
+        void* mapping = mmap(
+            nullptr,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+        if (mapping == MAP_FAILED) {
+            error = "mmap failed";
+            return false;
+        }
+        std::memcpy(mapping, code.data(), code.size());
+        if (mprotect(mapping, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(mapping, size);
+            error = "mprotect failed";
+            return false;
+        }
+
+        out.release();
+        out.entry = reinterpret_cast<entry_point>(mapping);
+        out.mapping = mapping;
+        out.mapping_size = size;
+        out.code_size = code.size();
+        return true;
+    }
+
+    void
+    function::release() {
+        if (mapping) {
+            munmap(mapping, mapping_size);
+        }
+        entry = nullptr;
+        mapping = nullptr;
+        mapping_size = 0;
+        code_size = 0;
+    }
+#else
+    bool
+    available() {
+        return false;
+    }
+
+    bool
+    compile(ast::operand const& ast, function& out, std::string& error) {
+        error = "the JIT backend only supports x86-64 System V targets";
+        return false;
+    }
+
+    void
+    function::release() {}
+#endif
+
+    function::function(function&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    function&
+    function::operator=(function&& other) noexcept {
+        if (this != &other) {
+            release();
+            std::swap(entry, other.entry);
+            std::swap(mapping, other.mapping);
+            std::swap(mapping_size, other.mapping_size);
+            std::swap(code_size, other.code_size);
+        }
+        return *this;
+    }
+
+    function::~function() {
+        release();
+    }
+
+} // namespace jit
+} // namespace client
@@ -0,0 +1,621 @@
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <boost/foreach.hpp>
+
+#include "ast.hpp"
+#include "compiletime.hpp"
+#include "kernels.hpp"
+
+namespace client {
+namespace kernels {
+    namespace {
+        // A postfix serialization of a rule, so that nesting is captured
+        // without recording any parentheses, written a byte at a time to
+        // `Out`.
+        template <typename Out>
+        class writer {
+        public:
+            constexpr explicit writer(Out& out) : out(out) {}
+
+            constexpr void
+            constant(uint value) {
+                out.byte(1);
+                for (int shift = 0; shift < 32; shift += 8) {
+                    out.byte(value >> shift);
+                }
+            }
+
+            constexpr void
+            variable() {
+                out.byte(2);
+            }
+
+            constexpr void
+            binary(ast::optoken op) {
+                out.byte(3);
+                out.byte(static_cast<std::uint8_t>(op));
+            }
+
+            constexpr void
+            conditional() {
+                out.byte(4);
+            }
+
+        private:
+            Out& out;
+        };
+
+        // Counts the bytes of a serialization.
+        struct counter {
+            std::size_t size = 0;
+
+            constexpr void
+            byte(std::uint8_t) {
+                ++size;
+            }
+        };
+
+        // Keeps the bytes of a serialization of known size.
+        template <std::size_t Size>
+        struct signature {
+            char data[Size]{};
+            std::size_t size = 0;
+
+            constexpr void
+            byte(std::uint8_t value) {
+                data[size++] = static_cast<char>(value);
+            }
+        };
+
+        // Keeps the bytes of a rule's serialization at run time.
+        struct buffer {
+            std::string data;
+
+            void
+            byte(std::uint8_t value) {
+                data.push_back(static_cast<char>(value));
+            }
+        };
+
+        constexpr std::uint64_t
+        hash(std::string_view bytes) {
+            std::uint64_t state = 0xcbf29ce484222325;
+            for (char c : bytes) {
+                state = (state ^ static_cast<std::uint8_t>(c)) * 0x100000001b3;
+            }
+            return state;
+        }
+
+        struct serializer {
+            typedef void result_type;
+
+            explicit serializer(writer<buffer>& out) : out(out) {}
+            writer<buffer>& out;
+
+            result_type
+            operator()(ast::operand const& ast) {
+                boost::apply_visitor(*this, ast.get());
+            }
+
+            result_type
+            operator()(ast::nil) {}
+
+            result_type
+            operator()(ast::expression const& ast) {
+                (*this)(ast.lhs);
+                BOOST_FOREACH (ast::operation const& op, ast.rhs) {
+                    (*this)(op.rhs);
+                    out.binary(op.op.code);
+                }
+            }
+
+            result_type
+            operator()(ast::binary_op const& ast) {
+                (*this)(ast.lhs);
+                (*this)(ast.rhs);
+                out.binary(ast.op.code);
+            }
+
+            result_type
+            operator()(ast::conditional_op const& ast) {
+                (*this)(ast.lhs);
+                (*this)(ast.rhs_true);
+                (*this)(ast.rhs_false);
+                out.conditional();
+            }
+
+            result_type
+            operator()(uint const& ast) {
+                out.constant(ast);
+            }
+
+            result_type
+            operator()(ast::variable const&) {
+                out.variable();
+            }
+        };
+
+        // The same serialization for a rule parsed at compile time.
+        template <std::size_t Capacity, typename Out>
+        constexpr void
+        serialize(
+            compiletime::program<Capacity> const& prog,
+            std::size_t idx,
+            writer<Out>& out) {
+            compiletime::node const& self = prog.nodes[idx];
+            switch (self.type) {
+            case compiletime::kind::constant: out.constant(self.value); break;
+            case compiletime::kind::variable: out.variable(); break;
+            case compiletime::kind::binary:
+                serialize(prog, self.lhs, out);
+                serialize(prog, self.rhs, out);
+                out.binary(self.op);
+                break;
+            case compiletime::kind::conditional:
+                serialize(prog, self.lhs, out);
+                serialize(prog, self.rhs, out);
+                serialize(prog, self.alt, out);
+                out.conditional();
+                break;
+            }
+        }
+
+        // lo <= x <= hi in one comparison.
+        constexpr bool
+        between(uint x, uint lo, uint hi) {
+            return x - lo <= hi - lo;
+        }
+
+        // The kernels below compute each residue once and use the
+        // structure of the rule (e.g. n % 100 in {2, 22, 42, 62, 82} is
+        // n % 20 == 2) instead of following the expression literally.
+        // `test` checks each of them against the corpus.
+
+        uint
+        single(uint) {
+            return 0;
+        }
+
+        uint
+        zero_one_other(uint n) {
+            return n < 2 ? n : 2;
+        }
+
+        uint
+        cornish(uint n) {
+            if (n < 2) {
+                return n;
+            }
+            const uint n100{n % 100};
+            const uint n100000{n % 100000};
+            if (n100 % 20 == 2 ||
+                (n % 1000 == 0 &&
+                 (between(n100000, 1000, 20000) ||
+                  (n100000 != 0 && n100000 % 20000 == 0))) ||
+                n % 1000000 == 100000) {
+                return 2;
+            }
+            if (n100 % 20 == 3) {
+                return 3;
+            }
+            return n100 % 20 == 1 ? 4 : 5;
+        }
+
+        uint
+        arabic(uint n) {
+            if (n < 3) {
+                return n;
+            }
+            const uint n100{n % 100};
+            if (between(n100, 3, 10)) {
+                return 3;
+            }
+            return n100 >= 11 ? 4 : 5;
+        }
+
+        uint
+        welsh(uint n) {
+            switch (n) {
+            case 0:
+            case 1:
+            case 2:
+            case 3: return n;
+            case 6: return 4;
+            default: return 5;
+            }
+        }
+
+        uint
+        tachelhit(uint n) {
+            return n < 2 ? 0 : (n <= 10 ? 1 : 2);
+        }
+
+        uint
+        one_other(uint n) {
+            return n != 1;
+        }
+
+        uint
+        french(uint n) {
+            return n > 1;
+        }
+
+        uint
+        slovenian(uint n) {
+            switch (n % 100) {
+            case 1: return 0;
+            case 2: return 1;
+            case 3:
+            case 4: return 2;
+            default: return 3;
+            }
+        }
+
+        uint
+        latvian(uint n) {
+            const uint n10{n % 10};
+            if (n10 == 0 || between(n % 100, 11, 19)) {
+                return 0;
+            }
+            return n10 == 1 ? 1 : 2;
+        }
+
+        uint
+        manx(uint n) {
+            const uint n10{n % 10};
+            if (n10 == 1) {
+                return 0;
+            }
+            if (n10 == 2) {
+                return 1;
+            }
+            return n % 20 == 0 ? 2 : 3;
+        }
+
+        uint
+        icelandic(uint n) {
+            return n % 10 != 1 || n % 100 == 11;
+        }
+
+        uint
+        russian(uint n) {
+            const uint n10{n % 10};
+            const uint n100{n % 100};
+            if (n10 == 1 && n100 != 11) {
+                return 0;
+            }
+            return between(n10, 2, 4) && !between(n100, 12, 14) ? 1 : 2;
+        }
+
+        uint
+        lithuanian(uint n) {
+            const uint n10{n % 10};
+            if (between(n % 100, 11, 19) || n10 == 0) {
+                return 2;
+            }
+            return n10 == 1 ? 0 : 1;
+        }
+
+        uint
+        breton(uint n) {
+            const uint n10{n % 10};
+            const uint tens{n % 100 / 10};
+            if (tens != 1 && tens != 7 && tens != 9) {
+                if (n10 == 1) {
+                    return 0;
+                }
+                if (n10 == 2) {
+                    return 1;
+                }
+                if (n10 == 3 || n10 == 4 || n10 == 9) {
+                    return 2;
+                }
+            }
+            return n != 0 && n % 1000000 == 0 ? 3 : 4;
+        }
+
+        uint
+        maltese(uint n) {
+            if (n == 1) {
+                return 0;
+            }
+            const uint n100{n % 100};
+            if (n == 0 || between(n100, 2, 10)) {
+                return 1;
+            }
+            return between(n100, 11, 19) ? 2 : 3;
+        }
+
+        uint
+        romanian(uint n) {
+            if (n == 1) {
+                return 0;
+            }
+            return n == 0 || between(n % 100, 2, 19) ? 1 : 2;
+        }
+
+        uint
+        polish(uint n) {
+            if (n == 1) {
+                return 0;
+            }
+            return between(n % 10, 2, 4) && !between(n % 100, 12, 14) ? 1 : 2;
+        }
+
+        uint
+        one_two_other(uint n) {
+            return n == 1 ? 0 : (n == 2 ? 1 : 2);
+        }
+
+        uint
+        hebrew(uint n) {
+            if (n == 1) {
+                return 0;
+            }
+            if (n == 2) {
+                return 1;
+            }
+            return n > 10 && n % 10 == 0 ? 2 : 3;
+        }
+
+        uint
+        irish(uint n) {
+            if (n < 3) {
+                return n == 1 ? 0 : (n == 2 ? 1 : 4);
+            }
+            if (n <= 6) {
+                return 2;
+            }
+            return n <= 10 ? 3 : 4;
+        }
+
+        uint
+        czech(uint n) {
+            return n == 1 ? 0 : (between(n, 2, 4) ? 1 : 2);
+        }
+
+        uint
+        scottish_gaelic(uint n) {
+            switch (n) {
+            case 1:
+            case 11: return 0;
+            case 2:
+            case 12: return 1;
+            default:
+                return between(n, 3, 10) || between(n, 13, 19) ? 2 : 3;
+            }
+        }
+
+        uint
+        filipino(uint n) {
+            const uint n10{n % 10};
+            return n > 3 && (n10 == 4 || n10 == 6 || n10 == 9);
+        }
+
+        uint
+        tamazight(uint n) {
+            return n >= 2 && !between(n, 11, 99);
+        }
+
+        struct builtin {
+            char const* name;
+            char const* expression;
+            uint (*evaluate)(uint);
+        };
+
+        constexpr builtin builtins[]{
+            builtin{"single", "0", single},
+            builtin{
+                "zero_one_other",
+                "(n == 0) ? 0 : ((n == 1) ? 1 : 2)",
+                zero_one_other},
+            builtin{
+                "cornish",
+                "(n == 0) ? 0 : ((n == 1) ? 1 : (((n % 100 == 2 || n % 100 == "
+                "22 || n % 100 == 42 || n % 100 == 62 || n % 100 == 82) || n % "
+                "1000 == 0 && (n % 100000 >= 1000 && n % 100000 <= 20000 || n "
+                "% 100000 == 40000 || n % 100000 == 60000 || n % 100000 == "
+                "80000) || n != 0 && n % 1000000 == 100000) ? 2 : ((n % 100 == "
+                "3 || n % 100 == 23 || n % 100 == 43 || n % 100 == 63 || n % "
+                "100 == 83) ? 3 : ((n != 1 && (n % 100 == 1 || n % 100 == 21 "
+                "|| n % 100 == 41 || n % 100 == 61 || n % 100 == 81)) ? 4 : "
+                "5))))",
+                cornish},
+            builtin{
+                "arabic",
+                "(n == 0) ? 0 : ((n == 1) ? 1 : ((n == 2) ? 2 : ((n % 100 >= 3 "
+                "&& n % 100 <= 10) ? 3 : ((n % 100 >= 11 && n % 100 <= 99) ? 4 "
+                ": 5))))",
+                arabic},
+            builtin{
+                "welsh",
+                "(n == 0) ? 0 : ((n == 1) ? 1 : ((n == 2) ? 2 : ((n == 3) ? 3 "
+                ": ((n == 6) ? 4 : 5))))",
+                welsh},
+            builtin{
+                "tachelhit",
+                "(n == 0 || n == 1) ? 0 : ((n >= 2 && n <= 10) ? 1 : 2)",
+                tachelhit},
+            builtin{"one_other", "n != 1", one_other},
+            builtin{"french", "n > 1", french},
+            builtin{
+                "slovenian",
+                "(n % 100 == 1) ? 0 : ((n % 100 == 2) ? 1 : ((n % 100 == 3 || "
+                "n % 100 == 4) ? 2 : 3))",
+                slovenian},
+            builtin{
+                "latvian",
+                "(n % 10 == 0 || n % 100 >= 11 && n % 100 <= 19) ? 0 : ((n % "
+                "10 == 1 && n % 100 != 11) ? 1 : 2)",
+                latvian},
+            builtin{
+                "manx",
+                "(n % 10 == 1) ? 0 : ((n % 10 == 2) ? 1 : ((n % 100 == 0 || n "
+                "% 100 == 20 || n % 100 == 40 || n % 100 == 60 || n % 100 == "
+                "80) ? 2 : 3))",
+                manx},
+            builtin{"icelandic", "n % 10 != 1 || n % 100 == 11", icelandic},
+            builtin{
+                "russian",
+                "(n % 10 == 1 && n % 100 != 11) ? 0 : ((n % 10 >= 2 && n % 10 "
+                "<= 4 && (n % 100 < 12 || n % 100 > 14)) ? 1 : 2)",
+                russian},
+            builtin{
+                "lithuanian",
+                "(n % 10 == 1 && (n % 100 < 11 || n % 100 > 19)) ? 0 : ((n % "
+                "10 >= 2 && n % 10 <= 9 && (n % 100 < 11 || n % 100 > 19)) ? 1 "
+                ": 2)",
+                lithuanian},
+            builtin{
+                "breton",
+                "(n % 10 == 1 && n % 100 != 11 && n % 100 != 71 && n % 100 != "
+                "91) ? 0 : ((n % 10 == 2 && n % 100 != 12 && n % 100 != 72 && "
+                "n % 100 != 92) ? 1 : ((((n % 10 == 3 || n % 10 == 4) || n % "
+                "10 == 9) && (n % 100 < 10 || n % 100 > 19) && (n % 100 < 70 "
+                "|| n % 100 > 79) && (n % 100 < 90 || n % 100 > 99)) ? 2 : ((n "
+                "!= 0 && n % 1000000 == 0) ? 3 : 4)))",
+                breton},
+            builtin{
+                "maltese",
+                "(n == 1) ? 0 : ((n == 0 || n % 100 >= 2 && n % 100 <= 10) ? 1 "
+                ": ((n % 100 >= 11 && n % 100 <= 19) ? 2 : 3))",
+                maltese},
+            builtin{
+                "romanian",
+                "(n == 1) ? 0 : ((n == 0 || n % 100 >= 2 && n % 100 <= 19) ? 1 "
+                ": 2)",
+                romanian},
+            builtin{
+                "polish",
+                "(n == 1) ? 0 : ((n % 10 >= 2 && n % 10 <= 4 && (n % 100 < 12 "
+                "|| n % 100 > 14)) ? 1 : 2)",
+                polish},
+            builtin{
+                "one_two_other",
+                "(n == 1) ? 0 : ((n == 2) ? 1 : 2)",
+                one_two_other},
+            builtin{
+                "hebrew",
+                "(n == 1) ? 0 : ((n == 2) ? 1 : ((n > 10 && n % 10 == 0) ? 2 : "
+                "3))",
+                hebrew},
+            builtin{
+                "irish",
+                "(n == 1) ? 0 : ((n == 2) ? 1 : ((n >= 3 && n <= 6) ? 2 : ((n "
+                ">= 7 && n <= 10) ? 3 : 4)))",
+                irish},
+            builtin{
+                "czech",
+                "(n == 1) ? 0 : ((n >= 2 && n <= 4) ? 1 : 2)",
+                czech},
+            builtin{
+                "scottish_gaelic",
+                "(n == 1 || n == 11) ? 0 : ((n == 2 || n == 12) ? 1 : ((n >= 3 "
+                "&& n <= 10 || n >= 13 && n <= 19) ? 2 : 3))",
+                scottish_gaelic},
+            builtin{
+                "filipino",
+                "n != 1 && n != 2 && n != 3 && (n % 10 == 4 || n % 10 == 6 || "
+                "n % 10 == 9)",
+                filipino},
+            builtin{"tamazight", "n >= 2 && (n < 11 || n > 99)", tamazight},
+        };
+
+        template <std::size_t Index>
+        constexpr auto prog{compiletime::parse(builtins[Index].expression)};
+
+        template <std::size_t Index>
+        constexpr std::size_t
+        signature_size() {
+            static_assert(prog<Index>.valid(), "built-in rule failed to parse");
+            counter out;
+            writer<counter> serialized{out};
+            serialize(prog<Index>, prog<Index>.root, serialized);
+            return out.size;
+        }
+
+        template <std::size_t Index>
+        constexpr signature<signature_size<Index>()>
+        signature_of() {
+            signature<signature_size<Index>()> out;
+            writer<signature<signature_size<Index>()>> serialized{out};
+            serialize(prog<Index>, prog<Index>.root, serialized);
+            return out;
+        }
+
+        // The serialization of each built-in rule, which a rule must match
+        // byte for byte, not just by fingerprint, to use its kernel.
+        template <std::size_t Index>
+        constexpr auto signatures{signature_of<Index>()};
+
+        template <std::size_t... Index>
+        constexpr std::array<kernel, sizeof...(Index)>
+        make_table(std::index_sequence<Index...>) {
+            return {{kernel{
+                builtins[Index].name,
+                hash({signatures<Index>.data, signatures<Index>.size}),
+                builtins[Index].evaluate}...}};
+        }
+
+        template <std::size_t... Index>
+        constexpr std::array<std::string_view, sizeof...(Index)>
+        make_signatures(std::index_sequence<Index...>) {
+            return {{std::string_view{
+                signatures<Index>.data, signatures<Index>.size}...}};
+        }
+
+        // Fingerprints are computed while compiling, from the expressions
+        // above, so the table cannot drift from the kernels it names.
+        constexpr std::size_t size{sizeof(builtins) / sizeof(builtins[0])};
+        constexpr auto table{make_table(std::make_index_sequence<size>())};
+        constexpr auto serialized{
+            make_signatures(std::make_index_sequence<size>())};
+
+        constexpr bool
+        distinct() {
+            for (std::size_t lhs = 0; lhs < table.size(); ++lhs) {
+                for (std::size_t rhs = lhs + 1; rhs < table.size(); ++rhs) {
+                    if (table[lhs].fingerprint == table[rhs].fingerprint) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        static_assert(distinct(), "two built-in rules share a fingerprint");
+
+        std::string
+        serialize(ast::operand const& ast) {
+            buffer out;
+            writer<buffer> serialized{out};
+            serializer{serialized}(ast);
+            return std::move(out.data);
+        }
+    } // namespace
+
+    std::uint64_t
+    fingerprint(ast::operand const& ast) {
+        return hash(serialize(ast));
+    }
+
+    kernel const*
+    find(ast::operand const& ast) {
+        const std::string bytes{serialize(ast)};
+        const std::uint64_t fingerprint{hash(bytes)};
+        for (std::size_t idx = 0; idx < table.size(); ++idx) {
+            // The fingerprint only narrows the search: FNV-1a is easily
+            // collided, and each constant in a rule is four free bytes.
+            if (table[idx].fingerprint == fingerprint &&
+                serialized[idx] == bytes) {
+                return &table[idx];
+            }
+        }
+        return nullptr;
+    }
+
+} // namespace kernels
+} // namespace client
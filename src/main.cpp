@@ -1,7 +1,21 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
-#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
 #include <boost/spirit/home/x3.hpp>
 
 #include "CLI/App.hpp"
@@ -10,332 +24,1989 @@
 
 #include "ast.hpp"
 #include "ast_adapted.hpp"
+#include "batch.hpp"
+#include "cache.hpp"
+#include "canonical.hpp"
+#include "catalog.hpp"
+#include "codegen.hpp"
+#include "compiled_rule.hpp"
+#include "corpus.hpp"
+#include "exhaustive.hpp"
+#include "flat.hpp"
+#include "image.hpp"
+#include "jit.hpp"
+#include "kernels.hpp"
+#include "optimizer.hpp"
 #include "parser.hpp"
+#include "periodic.hpp"
+#include "pluralsparser.h"
+#include "pratt.hpp"
+#include "range.hpp"
+#include "scan.hpp"
+#include "server.hpp"
+#include "stream.hpp"
+#include "vm.hpp"
 
 typedef unsigned int uint;
 namespace x3 = boost::spirit::x3;
 
 bool
-run_tests() {
-    std::map<std::string, std::function<uint(uint)>> test_expressions{
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "0", [](uint n) { return 0; }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 0) ? 0 : ((n == 1) ? 1 : 2)",
-            [](uint n) { return (n == 0) ? 0 : ((n == 1) ? 1 : 2); }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 0) ? 0 : ((n == 1) ? 1 : (((n % 100 == 2 || n % 100 == "
-            "22 || n % 100 == 42 || n % 100 == 62 || n % 100 == 82) || n % "
-            "1000 == 0 && (n % 100000 >= 1000 && n % 100000 <= 20000 || n "
-            "% 100000 == 40000 || n % 100000 == 60000 || n % 100000 == "
-            "80000) || n != 0 && n % 1000000 == 100000) ? 2 : ((n % 100 == "
-            "3 || n % 100 == 23 || n % 100 == 43 || n % 100 == 63 || n % "
-            "100 == 83) ? 3 : ((n != 1 && (n % 100 == 1 || n % 100 == 21 "
-            "|| n % 100 == 41 || n % 100 == 61 || n % 100 == 81)) ? 4 : "
-            "5))))",
-            [](uint n) {
-                return (n == 0)
-                           ? 0
-                           : ((n == 1)
-                                  ? 1
-                                  : (((n % 100 == 2 || n % 100 == 22 ||
-                                       n % 100 == 42 || n % 100 == 62 ||
-                                       n % 100 == 82) ||
-                                      n % 1000 == 0 &&
-                                          (n % 100000 >= 1000 &&
-                                               n % 100000 <= 20000 ||
-                                           n % 100000 == 40000 ||
-                                           n % 100000 == 60000 ||
-                                           n % 100000 == 80000) ||
-                                      n != 0 && n % 1000000 == 100000)
-                                         ? 2
-                                         : ((n % 100 == 3 || n % 100 == 23 ||
-                                             n % 100 == 43 || n % 100 == 63 ||
-                                             n % 100 == 83)
-                                                ? 3
-                                                : ((n != 1 && (n % 100 == 1 ||
-                                                               n % 100 == 21 ||
-                                                               n % 100 == 41 ||
-                                                               n % 100 == 61 ||
-                                                               n % 100 == 81))
-                                                       ? 4
-                                                       : 5))));
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 0) ? 0 : ((n == 1) ? 1 : ((n == 2) ? 2 : ((n % 100 >= 3 "
-            "&& n % 100 <= 10) ? 3 : ((n % 100 >= 11 && n % 100 <= 99) ? 4 "
-            ": 5))))",
-            [](uint n) {
-                return (n == 0)
-                           ? 0
-                           : ((n == 1)
-                                  ? 1
-                                  : ((n == 2) ? 2
-                                              : ((n % 100 >= 3 && n % 100 <= 10)
-                                                     ? 3
-                                                     : ((n % 100 >= 11 &&
-                                                         n % 100 <= 99)
-                                                            ? 4
-                                                            : 5))));
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 0) ? 0 : ((n == 1) ? 1 : ((n == 2) ? 2 : ((n == 3) ? 3 "
-            ": ((n == 6) ? 4 : 5))))",
-            [](uint n) {
-                return (n == 0)
-                           ? 0
-                           : ((n == 1)
-                                  ? 1
-                                  : ((n == 2)
-                                         ? 2
-                                         : ((n == 3) ? 3
-                                                     : ((n == 6) ? 4 : 5))));
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 0 || n == 1) ? 0 : ((n >= 2 && n <= 10) ? 1 : 2)",
-            [](uint n) {
-                return (n == 0 || n == 1) ? 0 : ((n >= 2 && n <= 10) ? 1 : 2);
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "n != 1", [](uint n) { return n != 1; }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "n > 1", [](uint n) { return n > 1; }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n % 100 == 1) ? 0 : ((n % 100 == 2) ? 1 : ((n % 100 == 3 || "
-            "n % 100 == 4) ? 2 : 3))",
-            [](uint n) {
-                return (n % 100 == 1)
-                           ? 0
-                           : ((n % 100 == 2)
-                                  ? 1
-                                  : ((n % 100 == 3 || n % 100 == 4) ? 2 : 3));
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n % 10 == 0 || n % 100 >= 11 && n % 100 <= 19) ? 0 : ((n % "
-            "10 == 1 && n % 100 != 11) ? 1 : 2)",
-            [](uint n) {
-                return (n % 10 == 0 || n % 100 >= 11 && n % 100 <= 19)
-                           ? 0
-                           : ((n % 10 == 1 && n % 100 != 11) ? 1 : 2);
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n % 10 == 1) ? 0 : ((n % 10 == 2) ? 1 : ((n % 100 == 0 || n "
-            "% 100 == 20 || n % 100 == 40 || n % 100 == 60 || n % 100 == "
-            "80) ? 2 : 3))",
-            [](uint n) {
-                return (n % 10 == 1)
-                           ? 0
-                           : ((n % 10 == 2) ? 1
-                                            : ((n % 100 == 0 || n % 100 == 20 ||
-                                                n % 100 == 40 ||
-                                                n % 100 == 60 || n % 100 == 80)
-                                                   ? 2
-                                                   : 3));
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "n % 10 != 1 || n % 100 == 11",
-            [](uint n) { return n % 10 != 1 || n % 100 == 11; }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n % 10 == 1 && n % 100 != 11) ? 0 : ((n % 10 >= 2 && n % 10 "
-            "<= 4 && (n % 100 < 12 || n % 100 > 14)) ? 1 : 2)",
-            [](uint n) {
-                return (n % 10 == 1 && n % 100 != 11)
-                           ? 0
-                           : ((n % 10 >= 2 && n % 10 <= 4 &&
-                               (n % 100 < 12 || n % 100 > 14))
-                                  ? 1
-                                  : 2);
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n % 10 == 1 && (n % 100 < 11 || n % 100 > 19)) ? 0 : ((n % "
-            "10 >= 2 && n % 10 <= 9 && (n % 100 < 11 || n % 100 > 19)) ? 1 "
-            ": 2)",
-            [](uint n) {
-                return (n % 10 == 1 && (n % 100 < 11 || n % 100 > 19))
-                           ? 0
-                           : ((n % 10 >= 2 && n % 10 <= 9 &&
-                               (n % 100 < 11 || n % 100 > 19))
-                                  ? 1
-                                  : 2);
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n % 10 == 1 && n % 100 != 11 && n % 100 != 71 && n % 100 != "
-            "91) ? 0 : ((n % 10 == 2 && n % 100 != 12 && n % 100 != 72 && "
-            "n % 100 != 92) ? 1 : ((((n % 10 == 3 || n % 10 == 4) || n % "
-            "10 == 9) && (n % 100 < 10 || n % 100 > 19) && (n % 100 < 70 "
-            "|| n % 100 > 79) && (n % 100 < 90 || n % 100 > 99)) ? 2 : ((n "
-            "!= 0 && n % 1000000 == 0) ? 3 : 4)))",
-            [](uint n) {
-                return (n % 10 == 1 && n % 100 != 11 && n % 100 != 71 &&
-                        n % 100 != 91)
-                           ? 0
-                           : ((n % 10 == 2 && n % 100 != 12 && n % 100 != 72 &&
-                               n % 100 != 92)
-                                  ? 1
-                                  : ((((n % 10 == 3 || n % 10 == 4) ||
-                                       n % 10 == 9) &&
-                                      (n % 100 < 10 || n % 100 > 19) &&
-                                      (n % 100 < 70 || n % 100 > 79) &&
-                                      (n % 100 < 90 || n % 100 > 99))
-                                         ? 2
-                                         : ((n != 0 && n % 1000000 == 0) ? 3
-                                                                         : 4)));
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 1) ? 0 : ((n == 0 || n % 100 >= 2 && n % 100 <= 10) ? 1 "
-            ": ((n % 100 >= 11 && n % 100 <= 19) ? 2 : 3))",
-            [](uint n) {
-                return (n == 1)
-                           ? 0
-                           : ((n == 0 || n % 100 >= 2 && n % 100 <= 10)
-                                  ? 1
-                                  : ((n % 100 >= 11 && n % 100 <= 19) ? 2 : 3));
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 1) ? 0 : ((n == 0 || n % 100 >= 2 && n % 100 <= 19) ? 1 "
-            ": 2)",
-            [](uint n) {
-                return (n == 1)
-                           ? 0
-                           : ((n == 0 || n % 100 >= 2 && n % 100 <= 19) ? 1
-                                                                        : 2);
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 1) ? 0 : ((n % 10 >= 2 && n % 10 <= 4 && (n % 100 < 12 "
-            "|| n % 100 > 14)) ? 1 : 2)",
-            [](uint n) {
-                return (n == 1) ? 0
-                                : ((n % 10 >= 2 && n % 10 <= 4 &&
-                                    (n % 100 < 12 || n % 100 > 14))
-                                       ? 1
-                                       : 2);
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 1) ? 0 : ((n == 2) ? 1 : 2)",
-            [](uint n) { return (n == 1) ? 0 : ((n == 2) ? 1 : 2); }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 1) ? 0 : ((n == 2) ? 1 : ((n > 10 && n % 10 == 0) ? 2 : "
-            "3))",
-            [](uint n) {
-                return (n == 1)
-                           ? 0
-                           : ((n == 2) ? 1 : ((n > 10 && n % 10 == 0) ? 2 : 3));
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 1) ? 0 : ((n == 2) ? 1 : ((n >= 3 && n <= 6) ? 2 : ((n "
-            ">= 7 && n <= 10) ? 3 : 4)))",
-            [](uint n) {
-                return (n == 1)
-                           ? 0
-                           : ((n == 2) ? 1
-                                       : ((n >= 3 && n <= 6)
-                                              ? 2
-                                              : ((n >= 7 && n <= 10) ? 3 : 4)));
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 1) ? 0 : ((n >= 2 && n <= 4) ? 1 : 2)",
-            [](uint n) { return (n == 1) ? 0 : ((n >= 2 && n <= 4) ? 1 : 2); }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "(n == 1 || n == 11) ? 0 : ((n == 2 || n == 12) ? 1 : ((n >= 3 "
-            "&& n <= 10 || n >= 13 && n <= 19) ? 2 : 3))",
-            [](uint n) {
-                return (n == 1 || n == 11)
-                           ? 0
-                           : ((n == 2 || n == 12)
-                                  ? 1
-                                  : ((n >= 3 && n <= 10 || n >= 13 && n <= 19)
-                                         ? 2
-                                         : 3));
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "n != 1 && n != 2 && n != 3 && (n % 10 == 4 || n % 10 == 6 || "
-            "n % 10 == 9)",
-            [](uint n) {
-                return n != 1 && n != 2 && n != 3 &&
-                       (n % 10 == 4 || n % 10 == 6 || n % 10 == 9);
-            }),
-        std::make_pair<std::string, std::function<uint(uint)>>(
-            "n >= 2 && (n < 11 || n > 99)",
-            [](uint n) { return n >= 2 && (n < 11 || n > 99); }),
+check_engine(
+    std::string const& engine,
+    std::string const& str,
+    uint n,
+    uint expected,
+    uint actual) {
+    if (actual == expected) {
+        return true;
+    }
+
+    std::cout << "-------------------------" << std::endl;
+    std::cout << "Expression: " << std::quoted(str) << std::endl;
+    std::cout << "n: " << n << std::endl;
+    std::cout << "Tree result: " << expected << std::endl;
+    std::cout << engine << " result: " << actual << std::endl;
+    std::cout << "-------------------------" << std::endl;
+
+    std::cout << "FAIL: " << engine << " did not match tree evaluator!"
+              << std::endl;
+    return false;
+}
+
+bool
+parse_rule(std::string const& str, client::ast::operand& program) {
+    std::string::const_iterator iter = str.begin();
+    std::string::const_iterator end = str.end();
+    if (!phrase_parse(iter, end, client::expression(), x3::space, program) ||
+        iter != end) {
+        std::cout << "Parsing failed" << std::endl;
+        std::cout << "stopped at: \" " << std::string(iter, end) << "\""
+                  << std::endl;
+        std::cout << "-------------------------" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool
+check_compiled_engines(
+    std::string const& str,
+    client::ast::operand const& program,
+    uint (*truth)(uint)) {
+    client::batch::program batch;
+    std::string error;
+    if (!client::batch::compile(program, batch, error)) {
+        std::cout << "Batch compilation failed: " << error << std::endl;
+        std::cout << "Expression: " << std::quoted(str) << std::endl;
+        return false;
+    }
+
+    std::vector<uint> ns(1001);
+    std::iota(ns.begin(), ns.end(), 0);
+    std::vector<std::uint8_t> results(ns.size());
+
+    bool success{true};
+    if (client::jit::available()) {
+        client::jit::function function;
+        if (!client::jit::compile(program, function, error)) {
+            std::cout << "JIT compilation failed: " << error << std::endl;
+            std::cout << "Expression: " << std::quoted(str) << std::endl;
+            return false;
+        }
+        for (uint n : ns) {
+            if (!check_engine("JIT", str, n, truth(n), function(n))) {
+                success = false;
+                break;
+            }
+        }
+    }
+
+    for (client::batch::isa target :
+         {client::batch::isa::scalar,
+          client::batch::isa::sse4,
+          client::batch::isa::avx2}) {
+        if (target > client::batch::detect_isa()) {
+            continue;
+        }
+        client::batch::evaluate(
+            batch, ns.data(), results.data(), ns.size(), target);
+        for (uint n : ns) {
+            const std::string engine{
+                std::string("Batch ") + client::batch::isa_name(target)};
+            if (!check_engine(engine, str, n, truth(n), results[n])) {
+                success = false;
+                break;
+            }
+        }
+    }
+    return success;
+}
+
+// Checks that `str` and a respelling of it without whitespace and with
+// redundant parentheses resolve to the same built-in kernel, and that the
+// kernel agrees with `truth`.
+bool
+check_kernel(std::string const& str, uint (*truth)(uint)) {
+    std::string respelled{"(("};
+    for (char c : str) {
+        if (c != ' ') {
+            respelled += c;
+        }
+    }
+    respelled += "))";
+
+    client::ast::operand program;
+    client::ast::operand variant;
+    if (!parse_rule(str, program) || !parse_rule(respelled, variant)) {
+        return false;
+    }
+    client::ast::optimize(program);
+    client::ast::optimize(variant);
+
+    client::kernels::kernel const* kernel{
+        client::kernels::find(program)};
+    if (!kernel) {
+        std::cout << "FAIL: no built-in kernel for " << std::quoted(str)
+                  << std::endl;
+        return false;
+    }
+    if (client::kernels::find(variant) !=
+        kernel) {
+        std::cout << "FAIL: " << std::quoted(respelled)
+                  << " did not resolve to kernel " << kernel->name
+                  << std::endl;
+        return false;
+    }
+
+    const std::string engine{std::string("Kernel ") + kernel->name};
+    for (uint n = 0; n <= 1000; ++n) {
+        if (!check_engine(engine, str, n, truth(n), kernel->evaluate(n))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Malformed rules must be rejected with the offset and the token expected,
+// whether the scan, the grammar or the variable lookup catches them.
+bool
+check_errors() {
+    struct {
+        char const* text;
+        std::size_t offset;
+        char const* expected;
+    } const cases[] = {
+        {"n % 10 == 1 ? 0 : 1;", 19, "character"},
+        {"(n == 1) ? \xC3\xA9 : 1", 11, "character"},
+        {"(n == 1", 7, "')'"},
+        {"n == 1 ? 0", 10, "':'"},
+        {"n == x", 5, "variable n"},
+        {"n 1", 2, "end of input"},
+        {"", 0, "expression"},
     };
 
     bool success{true};
-    for (const std::pair<std::string, std::function<uint(uint)>>& key_value :
-         test_expressions) {
-        for (uint idx = 0; idx <= 1000; ++idx) {
-            const std::string& str{key_value.first};
-            client::ast::operand program;
-            client::ast::evaluator eval(idx);
-            client::ast::printer print;
-
-            std::string::const_iterator iter = str.begin();
-            std::string::const_iterator end = str.end();
-            bool r = phrase_parse(
-                iter, end, client::expression(), x3::space, program);
-
-            if (r && iter == end) {
-                const uint result{eval(program)};
-                const uint truth{key_value.second(idx)};
-
-                if (result != truth) {
-                    std::cout << "-------------------------" << std::endl;
-                    std::cout << "Program:    ";
-                    print(program);
-                    std::cout << std::endl;
-                    std::cout << "Expression: " << std::quoted(str)
-                              << std::endl;
-                    std::cout << "n: " << idx << std::endl;
-                    std::cout << "Result: " << result << std::endl;
-                    std::cout << "Truth: " << truth << std::endl;
-                    std::cout << "-------------------------" << std::endl;
-
-                    std::cout << "FAIL: Result did not match truth!"
-                              << std::endl;
-                    success = false;
+    for (int byte = 0; byte < 256; ++byte) {
+        std::string text(40, 'n');
+        text[byte % 40] = static_cast<char>(byte);
+        const std::size_t expected{
+            client::scan::allowed(text[byte % 40]) ? 40u : byte % 40u};
+        if (client::scan::first_invalid(text.data(), 40) != expected) {
+            std::cout << "FAIL: scan misclassified byte " << byte
+                      << std::endl;
+            success = false;
+        }
+    }
+    for (auto const& test : cases) {
+        client::compiled_rule rule;
+        client::compile_error error;
+        if (client::compiled_rule::compile(
+                test.text, client::engine::automatic, rule, error) ||
+            error.offset != test.offset || error.expected != test.expected) {
+            std::cout << "FAIL: " << std::quoted(test.text)
+                      << " should fail at " << test.offset << " expecting "
+                      << test.expected << ", got " << error.offset << ' '
+                      << error.expected << " (" << error.message << ')'
+                      << std::endl;
+            success = false;
+        }
+    }
+
+    // `% 0` by a constant is neither folded nor tabulated, so the VM
+    // rejects it.
+    for (char const* text : {"5 % 0", "n % 7 % 0", "n ? 1 : 5 % 0"}) {
+        client::compiled_rule rule;
+        client::compile_error error;
+        if (client::compiled_rule::compile(
+                text, client::engine::automatic, rule, error) ||
+            error.message != "modulo by constant zero") {
+            std::cout << "FAIL: " << std::quoted(text)
+                      << " compiled or failed for another reason: "
+                      << error.message << std::endl;
+            success = false;
+        }
+    }
+
+    // Nesting that would exhaust the stack fails at the token that goes
+    // past the limit, with either frontend, while shallower rules compile.
+    auto repeat = [](std::string const& part, std::size_t count) {
+        std::string out;
+        for (std::size_t idx = 0; idx < count; ++idx) {
+            out += part;
+        }
+        return out;
+    };
+    const std::size_t limit{client::scan::max_depth};
+    const struct {
+        std::string text;
+        std::size_t offset;
+    } deep[] = {
+        {repeat("(", 20000) + "n" + repeat(")", 20000), limit - 1},
+        {repeat("n==1?0:", 60000) + "1", 4 + 7 * (limit - 1)},
+        {repeat("n==1&&", 60000) + "1", 4 + 6 * (limit - 1)},
+        {repeat("(n||", 20000) + "n" + repeat(")", 20000),
+         4 * (limit / 2 - 1) + 2},
+    };
+    for (auto const& test : deep) {
+        for (client::frontend parser :
+             {client::frontend::pratt, client::frontend::x3}) {
+            client::compiled_rule rule;
+            client::compile_error error;
+            if (client::compiled_rule::compile(
+                    test.text,
+                    client::engine::automatic,
+                    rule,
+                    error,
+                    parser) ||
+                error.offset != test.offset ||
+                error.expected != "nesting depth") {
+                std::cout << "FAIL: deep nesting with "
+                          << client::frontend_name(parser) << " failed at "
+                          << error.offset << " expecting " << error.expected
+                          << std::endl;
+                success = false;
+            }
+        }
+        client::ast::operand tree;
+        client::flat::tree flat;
+        std::size_t offset = 0;
+        std::string expected;
+        std::string error;
+        if (client::pratt::parse(test.text, tree, offset, expected) ||
+            expected != "nesting depth" ||
+            client::pratt::parse(test.text, flat, offset, expected) ||
+            expected != "nesting depth" ||
+            client::flat::parse(test.text, flat, error)) {
+            std::cout << "FAIL: the parsers accepted deep nesting"
+                      << std::endl;
+            success = false;
+        }
+    }
+    client::compiled_rule shallow;
+    std::string error;
+    if (!client::compiled_rule::compile(
+            repeat("(", limit - 1) + "n" + repeat(")", limit - 1),
+            client::engine::automatic,
+            shallow,
+            error) ||
+        !client::compiled_rule::compile(
+            repeat("n==1?0:", limit / 2) + "1",
+            client::engine::vm,
+            shallow,
+            error)) {
+        std::cout << "FAIL: nesting within the limit: " << error << std::endl;
+        success = false;
+    }
+    return success;
+}
+
+// Random text in the grammar's alphabet: well-formed expressions with
+// random spacing, then truncated or with one character changed.
+std::string
+random_expression(std::mt19937& random, int depth) {
+    auto pick = [&](std::size_t count) { return random() % count; };
+    char const* const spaces[] = {"", "", " ", "  ", "\t"};
+    std::string space{spaces[pick(5)]};
+    if (depth <= 0 || pick(3) == 0) {
+        char const* const leaves[] = {
+            "n", "n", "0", "1", "10", "100", "4294967295", "4294967296", "007"};
+        return space + leaves[pick(9)];
+    }
+    char const* const operators[] = {
+        "%", "&&", "||", "<", "<=", ">", ">=", "==", "!="};
+    switch (pick(3)) {
+    case 0: return space + "(" + random_expression(random, depth - 1) + ")";
+    case 1:
+        return random_expression(random, depth - 1) + space +
+               operators[pick(9)] + random_expression(random, depth - 1);
+    default:
+        return random_expression(random, depth - 1) + space + "?" +
+               random_expression(random, depth - 1) + ":" +
+               random_expression(random, depth - 1);
+    }
+}
+
+// The hand-written parser must build the same tree as the X3 grammar and
+// fail at the same offset with the same expectation.
+bool
+check_frontends() {
+    std::mt19937 random(2024);
+    const std::string alphabet{"n0123456789 ()?:%&|<>=!x\t"};
+    bool success{true};
+    for (int idx = 0; idx < 5000; ++idx) {
+        std::string text{random_expression(random, 5)};
+        switch (idx % 4) {
+        case 1: text.resize(random() % (text.size() + 1)); break;
+        case 2:
+            text.insert(
+                random() % (text.size() + 1),
+                1,
+                alphabet[random() % alphabet.size()]);
+            break;
+        case 3:
+            if (!text.empty()) {
+                text.erase(random() % text.size(), 1);
+            }
+            break;
+        }
+
+        client::compiled_rule pratt;
+        client::compiled_rule x3;
+        client::compile_error pratt_error;
+        client::compile_error x3_error;
+        const bool pratt_ok{client::compiled_rule::compile(
+            text,
+            client::engine::tree,
+            pratt,
+            pratt_error,
+            client::frontend::pratt)};
+        const bool x3_ok{client::compiled_rule::compile(
+            text, client::engine::tree, x3, x3_error, client::frontend::x3)};
+        if (pratt_ok != x3_ok || pratt_error.offset != x3_error.offset ||
+            pratt_error.expected != x3_error.expected ||
+            (pratt_ok &&
+             (client::ast::to_string(pratt.program()) !=
+                  client::ast::to_string(x3.program()) ||
+              pratt.nodes() != x3.nodes() ||
+              pratt.removed() != x3.removed()))) {
+            std::cout << "FAIL: frontends disagree on " << std::quoted(text)
+                      << ": pratt " << pratt_error.message << ", x3 "
+                      << x3_error.message << std::endl;
+            success = false;
+        }
+
+        client::flat::tree pratt_tree;
+        client::flat::tree x3_tree;
+        std::size_t offset;
+        std::string expected;
+        std::string error;
+        const bool pratt_flat{
+            client::pratt::parse(text, pratt_tree, offset, expected)};
+        const bool x3_flat{client::flat::parse(text, x3_tree, error)};
+        bool same{pratt_flat == x3_flat};
+        if (same && pratt_flat) {
+            same = pratt_tree.size() == x3_tree.size() &&
+                   pratt_tree.root() == x3_tree.root();
+        }
+        for (std::uint32_t at = 0; same && pratt_flat && at < x3_tree.size();
+             ++at) {
+            client::flat::node const& lhs{pratt_tree[at]};
+            client::flat::node const& rhs{x3_tree[at]};
+            same = lhs.type == rhs.type && lhs.op.code == rhs.op.code &&
+                   lhs.a == rhs.a && lhs.b == rhs.b && lhs.c == rhs.c;
+        }
+        if (!same) {
+            std::cout << "FAIL: flat trees differ on " << std::quoted(text)
+                      << std::endl;
+            success = false;
+        }
+    }
+    return success;
+}
+
+// Respellings of a rule must share its canonical key, other rules must
+// not, and the canonical form must compute the same function.
+bool
+check_canonical() {
+    bool success{true};
+    auto key = [](std::string const& text) {
+        client::compiled_rule rule;
+        std::string error;
+        client::compiled_rule::compile(
+            text, client::engine::tree, rule, error);
+        return rule.canonical();
+    };
+
+    char const* const same[][2] = {
+        {"n != 1", "((1)) !=n"},
+        {"n < 2", "2 > n"},
+        {"n >= 2", "(2 <= n)"},
+        {"n == 1 || n == 2 || n == 3", "n == 3 || (2 == n || n == 1)"},
+        {"n%10==1 && n%100!=11 ? 0 : 1", "(11 != n%100) && 1 == n%10 ? 0 : 1"},
+        {"n == 0 ? 0 : n == 1 ? 1 : 2", "(0 == n) ? 0 : ((n == 1) ? 1 : 2)"},
+    };
+    for (auto const& pair : same) {
+        if (key(pair[0]).empty() || key(pair[0]) != key(pair[1])) {
+            std::cout << "FAIL: " << std::quoted(pair[0]) << " and "
+                      << std::quoted(pair[1]) << " are not canonicalized "
+                      << "alike" << std::endl;
+            success = false;
+        }
+    }
+    char const* const different[][2] = {
+        {"n < 2", "n > 2"},
+        {"n % 10", "10 % n"},
+        {"n > 1 ? 1 : 0", "n > 1 ? 0 : 1"},
+        {"n == 1 || n == 2 && n == 3", "(n == 1 || n == 2) && n == 3"},
+        {"n == 1 || n == 2", "n == 1 && n == 2"},
+    };
+    for (auto const& pair : different) {
+        if (key(pair[0]) == key(pair[1])) {
+            std::cout << "FAIL: " << std::quoted(pair[0]) << " and "
+                      << std::quoted(pair[1]) << " share a canonical form"
+                      << std::endl;
+            success = false;
+        }
+    }
+
+    // The hash is part of the output of `eval -v` and must not change
+    // between builds.
+    client::compiled_rule germanic;
+    std::string error;
+    client::compiled_rule::compile(
+        "n != 1", client::engine::automatic, germanic, error);
+    if (germanic.canonical_hash() != 0xf08cf2d94da2d728) {
+        std::cout << "FAIL: the canonical hash of \"n != 1\" changed to "
+                  << std::hex << germanic.canonical_hash() << std::dec
+                  << std::endl;
+        success = false;
+    }
+
+    // Chains are keyed in a loop, in one pass over their operands, so
+    // 100000 links neither overflow the stack nor take quadratic time,
+    // even where every link moves its operand in front of the chain.
+    const int links = 100000;
+    const std::string n_key{'\3', 0, 0, 0, 0};
+    const std::string one_key{'\4', 0, 0, 0, 1};
+    const std::string seven_key{'\4', 0, 0, 0, 7};
+    const std::string modulo{'\1', 0};
+    const std::string equal{'\1', 7};
+    std::string modulo_text{"n"};
+    std::string modulo_key;
+    std::string swap_text{"n == 1"};
+    std::string swap_key;
+    for (int idx = 0; idx < links; ++idx) {
+        modulo_text += " % 7";
+        modulo_key += modulo;
+        swap_text += " == n % 7";
+        swap_key += equal + modulo + n_key + seven_key;
+    }
+    modulo_key += n_key;
+    for (int idx = 0; idx < links; ++idx) {
+        modulo_key += seven_key;
+    }
+    swap_key += equal + n_key + one_key;
+    for (auto const& chain :
+         {std::make_pair(modulo_text, modulo_key),
+          std::make_pair(swap_text, swap_key)}) {
+        client::ast::operand tree;
+        std::size_t offset = 0;
+        std::string expected;
+        if (!client::pratt::parse(chain.first, tree, offset, expected) ||
+            client::canonical::key(tree) != chain.second) {
+            std::cout << "FAIL: the canonical key of a chain of " << links
+                      << " links is wrong" << std::endl;
+            success = false;
+        }
+    }
+
+    // Printing the canonical form and compiling it again must give the
+    // same key and the same results.
+    std::mt19937 random(2023);
+    for (int idx = 0; idx < 2000; ++idx) {
+        const std::string text{random_expression(random, 5)};
+        client::compiled_rule original;
+        if (!client::compiled_rule::compile(
+                text, client::engine::tree, original, error)) {
+            continue;
+        }
+        client::ast::operand tree{original.program()};
+        client::canonical::canonicalize(tree);
+        client::compiled_rule respelled;
+        if (!client::compiled_rule::compile(
+                client::ast::to_string(tree),
+                client::engine::tree,
+                respelled,
+                error) ||
+            respelled.canonical() != original.canonical()) {
+            std::cout << "FAIL: the canonical form of " << std::quoted(text)
+                      << " is not canonical" << std::endl;
+            success = false;
+            continue;
+        }
+        for (uint n = 0; n <= 200; ++n) {
+            if (original(n) != respelled(n)) {
+                std::cout << "FAIL: the canonical form of "
+                          << std::quoted(text) << " differs for n = " << n
+                          << std::endl;
+                success = false;
+                break;
+            }
+        }
+    }
+    return success;
+}
+
+bool
+check_cache() {
+    std::string error;
+    client::cache::set_capacity(client::cache::default_capacity);
+    const client::cache::statistics before{client::cache::stats()};
+
+    bool success{true};
+    const std::string str{client::corpus::rules[1].expression};
+    std::shared_ptr<client::compiled_rule const> first{
+        client::cache::lookup(str, error)};
+    std::shared_ptr<client::compiled_rule const> second{
+        client::cache::lookup(str, error)};
+    client::cache::statistics after{client::cache::stats()};
+    if (!first || first != second || after.hits <= before.hits) {
+        std::cout << "FAIL: repeated lookup was not served from the cache"
+                  << std::endl;
+        success = false;
+    }
+    if (client::cache::lookup("n ==", error)) {
+        std::cout << "FAIL: cache returned a rule for a malformed expression"
+                  << std::endl;
+        success = false;
+    }
+
+    // Respellings share the rule compiled for the first one.
+    const client::cache::statistics unshared{client::cache::stats()};
+    std::shared_ptr<client::compiled_rule const> spelled{
+        client::cache::lookup("n % 7 == 3 || n == 1000", error)};
+    std::shared_ptr<client::compiled_rule const> respelled{
+        client::cache::lookup("(1000 == n) || 3 == n%7", error)};
+    after = client::cache::stats();
+    if (!spelled || spelled != respelled ||
+        after.shared != unshared.shared + 1 ||
+        after.misses != unshared.misses + 1 || after.dedup_ratio() <= 1) {
+        std::cout << "FAIL: equivalent rules were not shared in the cache"
+                  << std::endl;
+        success = false;
+    }
+
+    client::cache::set_capacity(2);
+    for (char const* rule : {"n % 3", "n % 5", "n % 7"}) {
+        client::cache::lookup(rule, error);
+    }
+    after = client::cache::stats();
+    if (after.size > 2 || after.evictions == before.evictions) {
+        std::cout << "FAIL: cache grew past its capacity" << std::endl;
+        success = false;
+    }
+    client::cache::set_capacity(client::cache::default_capacity);
+
+    // Concurrent evaluation of the whole corpus through the cache.
+    std::vector<std::thread> threads;
+    std::vector<char> passed(4, true);
+    for (std::size_t idx = 0; idx < passed.size(); ++idx) {
+        threads.emplace_back([&passed, idx] {
+            std::string error;
+            for (uint n = 0; n <= 1000; ++n) {
+                for (client::corpus::entry const& test :
+                     client::corpus::rules) {
+                    uint result;
+                    if (!client::cache::evaluate(
+                            test.expression, n, result, error) ||
+                        result != test.truth(n)) {
+                        passed[idx] = false;
+                    }
                 }
-            } else {
-                std::string rest(iter, end);
-                std::cout << "Parsing failed" << std::endl;
-                std::cout << "stopped at: \" " << rest << "\"" << std::endl;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (char thread : passed) {
+        if (!thread) {
+            std::cout << "FAIL: concurrent cache evaluation did not match "
+                         "truth"
+                      << std::endl;
+            success = false;
+            break;
+        }
+    }
+    return success;
+}
+
+// Exercises the C interface the way an embedding program would.
+bool
+check_library() {
+    bool success{true};
+    std::vector<uint> ns(1001);
+    std::iota(ns.begin(), ns.end(), 0);
+    std::vector<uint> results(ns.size());
+
+    for (client::corpus::entry const& test : client::corpus::rules) {
+        char error[128];
+        pluralsparser_rule* rule{
+            pluralsparser_compile(test.expression, error, sizeof(error))};
+        if (!rule) {
+            std::cout << "FAIL: library did not compile "
+                      << std::quoted(test.expression) << ": " << error
+                      << std::endl;
+            success = false;
+            continue;
+        }
+        pluralsparser_eval_batch(rule, ns.data(), results.data(), ns.size());
+        for (uint n : ns) {
+            if (!check_engine(
+                    "Library",
+                    test.expression,
+                    n,
+                    test.truth(n),
+                    pluralsparser_eval(rule, n)) ||
+                !check_engine(
+                    "Library batch",
+                    test.expression,
+                    n,
+                    test.truth(n),
+                    results[n])) {
+                success = false;
+                break;
+            }
+        }
+        pluralsparser_free(rule);
+    }
+
+    // A rule that runs on the VM and exceeds the batch kernels' byte range.
+    char const* identity{"n > 1 ? n : 7"};
+    pluralsparser_rule* wide{pluralsparser_compile(identity, nullptr, 0)};
+    pluralsparser_eval_batch(wide, ns.data(), results.data(), ns.size());
+    for (uint n : ns) {
+        const uint truth{n > 1 ? n : 7};
+        if (!check_engine("Library batch", identity, n, truth, results[n])) {
+            success = false;
+            break;
+        }
+    }
+    pluralsparser_free(wide);
+
+    char error[8];
+    if (pluralsparser_compile("n ==", error, sizeof(error)) ||
+        std::strlen(error) != sizeof(error) - 1) {
+        std::cout << "FAIL: library accepted a malformed expression"
+                  << std::endl;
+        success = false;
+    }
+    return success;
+}
+
+// Values streamed through --stdin give one output line per input line, or
+// fail at the first malformed line.
+bool
+check_stream() {
+    pluralsparser_rule* rule{pluralsparser_compile("n != 1", nullptr, 0)};
+    if (!rule) {
+        std::cout << "FAIL: could not compile a rule to stream" << std::endl;
+        return false;
+    }
+    auto run = [rule](std::string const& input, std::string& output) {
+        int in[2];
+        int out[2];
+        if (pipe(in) != 0 || pipe(out) != 0) {
+            return std::string{"pipe"};
+        }
+        write(in[1], input.data(), input.size());
+        ::close(in[1]);
+        std::string error;
+        client::stream::evaluate(rule, in[0], out[1], error);
+        ::close(in[0]);
+        ::close(out[1]);
+        char buffer[256];
+        ssize_t count;
+        output.clear();
+        while ((count = read(out[0], buffer, sizeof(buffer))) > 0) {
+            output.append(buffer, count);
+        }
+        ::close(out[0]);
+        return error;
+    };
+    const struct {
+        char const* input;
+        char const* output;
+        char const* error;
+    } cases[] = {
+        {"0\n1\n2", "1\n0\n1\n", ""},
+        {"0\r\n1\r\n", "1\n0\n", ""},
+        {"1\r2\n", "",
+         "line 1: carriage return before the end of the line"},
+        {"0\n\n2\n", "1\n", "line 2: expected an unsigned integer"},
+        {"5\n4294967296\n", "1\n", "line 2: n does not fit in 32 bits"},
+    };
+    bool success{true};
+    for (auto const& test : cases) {
+        std::string output;
+        const std::string error{run(test.input, output)};
+        if (output != test.output || error != test.error) {
+            std::cout << "FAIL: streaming " << std::quoted(test.input)
+                      << " gave " << std::quoted(output) << ", "
+                      << std::quoted(error) << std::endl;
+            success = false;
+        }
+    }
+    pluralsparser_free(rule);
+    return success;
+}
+
+// Runs a daemon in-process and talks to it over its socket.
+bool
+check_server() {
+    const std::string path{
+        "/tmp/plurals-parser-test-" + std::to_string(getpid()) + ".sock"};
+    client::server::options config;
+    config.socket_path = path;
+    config.workers = 2;
+
+    std::string error;
+    client::server::daemon daemon;
+    client::server::connection first;
+    client::server::connection second;
+    if (!daemon.start(config, error) || !first.open(path, error) ||
+        !second.open(path, error)) {
+        std::cout << "FAIL: could not start the daemon: " << error
+                  << std::endl;
+        return false;
+    }
+
+    bool success{true};
+    std::vector<std::uint32_t> ns(1001);
+    std::iota(ns.begin(), ns.end(), 0);
+    std::vector<std::uint32_t> results;
+    for (client::corpus::entry const& test : client::corpus::rules) {
+        std::uint32_t id;
+        std::uint32_t again;
+        if (!first.register_rule(test.expression, id, error) ||
+            !second.register_rule(test.expression, again, error) ||
+            id != again) {
+            std::cout << "FAIL: daemon did not register "
+                      << std::quoted(test.expression) << ": " << error
+                      << std::endl;
+            success = false;
+            continue;
+        }
+
+        // Pipelined single evaluations, then one batch.
+        for (uint n : ns) {
+            std::string body;
+            client::protocol::put_u32(body, id);
+            client::protocol::put_u32(body, n);
+            first.send(client::protocol::request::evaluate, body);
+        }
+        for (uint n : ns) {
+            client::protocol::status status;
+            std::string body;
+            if (!first.receive(status, body) ||
+                status != client::protocol::status::ok ||
+                !check_engine(
+                    "Daemon",
+                    test.expression,
+                    n,
+                    test.truth(n),
+                    client::protocol::get_u32(body.data()))) {
+                success = false;
+                break;
+            }
+        }
+        if (!second.evaluate_batch(id, ns, results, error) ||
+            results.size() != ns.size()) {
+            std::cout << "FAIL: daemon batch failed: " << error << std::endl;
+            success = false;
+            continue;
+        }
+        for (uint n : ns) {
+            if (!check_engine(
+                    "Daemon batch",
+                    test.expression,
+                    n,
+                    test.truth(n),
+                    results[n])) {
+                success = false;
+                break;
+            }
+        }
+    }
+
+    std::uint32_t id;
+    std::uint32_t result;
+    if (first.register_rule("n ==", id, error) ||
+        first.evaluate(1 << 20, 1, result, error)) {
+        std::cout << "FAIL: daemon accepted an invalid request" << std::endl;
+        success = false;
+    }
+
+    // The length prefix alone is enough to refuse an oversized frame, so
+    // the daemon hangs up long before the body has been written.
+    client::server::connection third;
+    client::protocol::status status;
+    std::string body(client::protocol::max_frame, '\0');
+    if (!third.open(path, error) ||
+        third.send(client::protocol::request::register_rule, body) ||
+        third.receive(status, body)) {
+        std::cout << "FAIL: daemon read an oversized frame" << std::endl;
+        success = false;
+    }
+    daemon.stop();
+    daemon.wait();
+    return success;
+}
+
+// A .mo image holding the header entry and one message.
+std::string
+mo_image(std::string const& header, bool swapped) {
+    auto put = [swapped](std::string& out, std::uint32_t value) {
+        if (swapped) {
+            value = __builtin_bswap32(value);
+        }
+        out.append(reinterpret_cast<char const*>(&value), sizeof(value));
+    };
+    std::string const originals[]{"", "file"};
+    std::string const translations[]{header, "Datei"};
+    // magic, revision, count, originals, translations, hash table size
+    // and offset, then the two string tables and the strings.
+    std::string image;
+    for (std::uint32_t value : {0x950412de, 0u, 2u, 28u, 44u, 0u, 0u}) {
+        put(image, value);
+    }
+    std::string strings;
+    for (auto const& table : {originals, translations}) {
+        for (std::size_t idx = 0; idx < 2; ++idx) {
+            put(image, table[idx].size());
+            put(image, 60 + strings.size());
+            strings += table[idx] + '\0';
+        }
+    }
+    return image + strings;
+}
+
+bool
+check_catalog() {
+    const std::string polish{
+        "n%10==1 && n%100!=11 ? 0 : n%10>=2 && n%10<=4 && (n%100<10 || "
+        "n%100>=20) ? 1 : 2"};
+    const std::string header{
+        "Project-Id-Version: test\nContent-Type: text/plain; "
+        "charset=UTF-8\nPlural-Forms: nplurals=3; plural=" +
+        polish + ";\n"};
+    bool success{true};
+    std::string error;
+    for (bool swapped : {false, true}) {
+        bool defaulted;
+        std::string_view found;
+        std::uint32_t nplurals;
+        std::string_view plural;
+        const std::string image{mo_image(header, swapped)};
+        if (!client::catalog::mo_header(image, found, error) ||
+            found != header ||
+            !client::catalog::find_plural_forms(
+                found, nplurals, plural, defaulted, error) ||
+            defaulted || nplurals != 3 || plural != polish) {
+            std::cout << "FAIL: .mo header" << (swapped ? " (swapped)" : "")
+                      << ": " << error << std::endl;
+            success = false;
+        }
+    }
+
+    const std::string po{
+        "# A comment\n"
+        "msgid \"\"\n"
+        "msgstr \"\"\n"
+        "\"Content-Type: text/plain; charset=UTF-8\\n\"\n"
+        "\"Plural-Forms: nplurals=2; \"\n"
+        "\"plural=(n != 1);\\n\"\n"
+        "\n"
+        "msgid \"file\"\n"
+        "msgstr \"Datei\"\n"};
+    std::string po_header;
+    std::uint32_t nplurals;
+    std::string_view plural;
+    bool defaulted;
+    if (!client::catalog::po_header(po, po_header, error) ||
+        !client::catalog::find_plural_forms(
+            po_header, nplurals, plural, defaulted, error) ||
+        defaulted || nplurals != 2 || plural != "(n != 1)") {
+        std::cout << "FAIL: .po header: " << error << std::endl;
+        success = false;
+    }
+    if (!client::catalog::find_plural_forms(
+            "Language: de\n", nplurals, plural, defaulted, error) ||
+        !defaulted || plural != client::catalog::default_plural) {
+        std::cout << "FAIL: a header without Plural-Forms: " << error
+                  << std::endl;
+        success = false;
+    }
+
+    std::string_view found;
+    std::string unused;
+    if (client::catalog::mo_header(
+            mo_image(header, false).substr(0, 16), found, error) ||
+        client::catalog::mo_header(
+            mo_image(header, false).substr(0, 64), found, error) ||
+        client::catalog::po_header("msgid \"file\"\n", unused, error) ||
+        client::catalog::find_plural_forms(
+            "Plural-Forms: nplurals=0; plural=0;",
+            nplurals,
+            plural,
+            defaulted,
+            error) ||
+        client::catalog::find_plural_forms(
+            "Plural-Forms: nplurals=2;", nplurals, plural, defaulted, error)) {
+        std::cout << "FAIL: a malformed catalog was accepted" << std::endl;
+        success = false;
+    }
+
+    // Both files hold the same rule, written differently.
+    const std::string base{
+        "/tmp/plurals-parser-test-" + std::to_string(getpid())};
+    const std::string files[][2]{
+        {base + ".mo",
+         mo_image("Plural-Forms: nplurals=2; plural=n!=1;\n", false)},
+        {base + ".po", po}};
+    std::uint64_t fingerprint = 0;
+    for (auto const& file : files) {
+        FILE* out{std::fopen(file[0].c_str(), "wb")};
+        if (out) {
+            std::fwrite(file[1].data(), 1, file[1].size(), out);
+            std::fclose(out);
+        }
+        client::catalog::entry loaded;
+        loaded.path = file[0];
+        if (!client::catalog::load(loaded) || loaded.nplurals != 2 ||
+            (*loaded.rule)(1) != 0 || (*loaded.rule)(2) != 1 ||
+            (fingerprint && loaded.rule->fingerprint() != fingerprint)) {
+            std::cout << "FAIL: could not load " << file[0] << ": "
+                      << loaded.error << std::endl;
+            success = false;
+        } else {
+            fingerprint = loaded.rule->fingerprint();
+        }
+        std::remove(file[0].c_str());
+    }
+    return success;
+}
+
+// The values a range report allows, if there are few enough to list.
+std::set<std::uint64_t>
+listed_values(client::range::report const& report) {
+    std::set<std::uint64_t> values;
+    for (client::range::progression const& run : report.values) {
+        for (std::uint64_t value = run.first; value <= run.last;
+             value += run.step ? run.step : 1) {
+            values.insert(value);
+        }
+    }
+    return values;
+}
+
+bool
+check_range() {
+    bool success{true};
+    for (client::corpus::entry const& test : client::corpus::rules) {
+        client::ast::operand program;
+        client::periodic::table table;
+        if (!parse_rule(test.expression, program) ||
+            !client::periodic::tabulate(program, table)) {
+            continue;
+        }
+        std::set<std::uint64_t> truth{
+            table.exceptions.begin(), table.exceptions.end()};
+        truth.insert(table.residues.begin(), table.residues.end());
+
+        const client::range::report report{client::range::analyze(program)};
+        bool samples{report.samples.size() == truth.size()};
+        for (client::range::sample const& found : report.samples) {
+            samples &= client::ast::evaluator(found.n)(program) == found.value;
+        }
+        if (!report.exact || listed_values(report) != truth || !samples ||
+            report.max != *truth.rbegin() || !report.divisions.empty()) {
+            std::cout << "FAIL: range analysis of "
+                      << std::quoted(test.expression) << std::endl;
+            success = false;
+        }
+    }
+
+    struct {
+        char const* expression;
+        std::set<std::uint64_t> values;
+        std::size_t unreachable;
+        char const* division;
+        bool proven;
+        std::uint64_t n;
+    } const cases[]{
+        {"n > 5 ? n % 0 : 1", {0, 1}, 0, "n % 0", true, 6},
+        {"n > 5 && n < 3 ? n % 0 : 1", {1}, 1, nullptr, false, 0},
+        {"n == 1 ? 0 : n == 1 ? 1 : 2", {0, 2}, 1, nullptr, false, 0},
+        {"n % 10 == 1 ? n % (n % 10) : 7", {0, 7}, 0, nullptr, false, 0},
+        {"n % (n % 10)", {}, 0, "n % (n % 10)", true, 0},
+        {"n != 0 && 7 % n > 3 ? 2 : 0", {0, 2}, 0, nullptr, false, 0},
+        {"n > 4294967295 ? 1 : (n == 0 ? 0 : 1)", {0, 1}, 1, nullptr, false,
+         0},
+    };
+    for (auto const& test : cases) {
+        client::ast::operand program;
+        if (!parse_rule(test.expression, program)) {
+            success = false;
+            continue;
+        }
+        const client::range::report report{client::range::analyze(program)};
+        const bool division{
+            test.division
+                ? report.divisions.size() == 1 &&
+                      report.divisions[0].text == test.division &&
+                      report.divisions[0].proven == test.proven &&
+                      report.divisions[0].n == test.n
+                : report.divisions.empty()};
+        if (!report.exact ||
+            (!test.values.empty() && listed_values(report) != test.values) ||
+            report.unreachable.size() != test.unreachable || !division) {
+            std::cout << "FAIL: range analysis of "
+                      << std::quoted(test.expression) << std::endl;
+            success = false;
+        }
+    }
+
+    client::ast::operand identity;
+    parse_rule("n", identity);
+    const client::range::report all{client::range::analyze(identity)};
+    if (!all.exact || all.values.size() != 1 || all.values[0].first != 0 ||
+        all.values[0].last != 0xFFFFFFFF || all.values[0].step != 1) {
+        std::cout << "FAIL: range analysis of \"n\"" << std::endl;
+        success = false;
+    }
+
+    // A chain is not scanned again for each undecided test in it, nor
+    // printed again for each `%`, so 100000 links take linear time.
+    std::string equal_text{"n"};
+    std::string modulo_text{"n"};
+    for (int idx = 0; idx < 100000; ++idx) {
+        equal_text += " == 1";
+        modulo_text += " % 7";
+    }
+    for (auto const& test :
+         {std::make_pair(equal_text, std::set<std::uint64_t>{0, 1}),
+          std::make_pair(
+              modulo_text, std::set<std::uint64_t>{0, 1, 2, 3, 4, 5, 6})}) {
+        client::ast::operand program;
+        std::size_t offset;
+        std::string expected;
+        if (!client::pratt::parse(test.first, program, offset, expected)) {
+            std::cout << "FAIL: a long chain did not parse" << std::endl;
+            success = false;
+            continue;
+        }
+        const client::range::report report{client::range::analyze(program)};
+        if (!report.exact || listed_values(report) != test.second) {
+            std::cout << "FAIL: range analysis of a long chain" << std::endl;
+            success = false;
+        }
+    }
+    return success;
+}
+
+// Image bytes copied to storage aligned like a mapping.
+std::vector<std::uint64_t>
+aligned(std::string const& bytes) {
+    std::vector<std::uint64_t> words((bytes.size() + 7) / 8);
+    std::memcpy(words.data(), bytes.data(), bytes.size());
+    return words;
+}
+
+bool
+check_image() {
+    bool success{true};
+    std::string error;
+    auto compile = [&error](std::string name, std::string const& text) {
+        client::image::entry entry{std::move(name), {}};
+        if (!client::image::compile(text, entry.rule, error)) {
+            std::cout << "FAIL: could not compile " << std::quoted(text)
+                      << " for an image: " << error << std::endl;
+        }
+        return entry;
+    };
+
+    std::vector<client::image::entry> rules;
+    for (std::size_t idx = 0; idx < std::size(client::corpus::rules); ++idx) {
+        rules.push_back(compile(
+            "corpus" + std::to_string(idx),
+            client::corpus::rules[idx].expression));
+    }
+    rules.push_back(compile("vm", "n > 5 ? n % 3 : n"));
+    std::string bytes;
+    if (!client::image::write(rules, bytes, error)) {
+        std::cout << "FAIL: could not write an image: " << error << std::endl;
+        return false;
+    }
+    const std::vector<std::uint64_t> words{aligned(bytes)};
+    client::image::view image;
+    if (!client::image::view::open(
+            {reinterpret_cast<char const*>(words.data()), bytes.size()},
+            image,
+            error) ||
+        image.size() != rules.size()) {
+        std::cout << "FAIL: could not open an image: " << error << std::endl;
+        return false;
+    }
+    for (std::size_t idx = 0; idx < std::size(client::corpus::rules); ++idx) {
+        client::corpus::entry const& test = client::corpus::rules[idx];
+        client::image::rule rule;
+        if (!image.find("corpus" + std::to_string(idx), rule) ||
+            rule.text() != test.expression) {
+            std::cout << "FAIL: rule " << idx << " is missing from the image"
+                      << std::endl;
+            success = false;
+            continue;
+        }
+        for (uint n : {0u, 1u, 2u, 5u, 11u, 21u, 101u, 1000u, 4294967295u}) {
+            if (rule(n) != test.truth(n)) {
+                std::cout << "FAIL: image rule " << std::quoted(rule.text())
+                          << " differs for n = " << n << std::endl;
+                success = false;
+                break;
+            }
+        }
+    }
+    client::image::rule vm;
+    if (!image.find("vm", vm) || vm.selected() != client::engine::vm ||
+        vm(4) != 4 || vm(7) != 1 || image.find("missing", vm)) {
+        std::cout << "FAIL: bytecode in an image" << std::endl;
+        success = false;
+    }
+
+    // A respelled rule adds a record and its strings, but no tables.
+    std::vector<client::image::entry> one;
+    one.push_back(compile("a", "n%10==1 && n%100!=11 ? 0 : 1"));
+    std::string single;
+    client::image::write(one, single, error);
+    one.push_back(compile("b", "1==n%10 && 11!=n%100 ? 0 : 1"));
+    std::string pair;
+    client::image::write(one, pair, error);
+    if (pair.size() - single.size() >
+        sizeof(client::image::record) + 2 * 8 + 32) {
+        std::cout << "FAIL: equivalent rules did not share their table"
+                  << std::endl;
+        success = false;
+    }
+
+    // Damaged images are refused.
+    auto refused = [&error](std::string const& damaged) {
+        const std::vector<std::uint64_t> words{aligned(damaged)};
+        client::image::view ignored;
+        return !client::image::view::open(
+            {reinterpret_cast<char const*>(words.data()), damaged.size()},
+            ignored,
+            error);
+    };
+    std::string flipped{bytes};
+    flipped[bytes.size() / 2] ^= 1;
+    std::string version{bytes};
+    version[offsetof(client::image::header, version)] ^= 1;
+    if (!refused(flipped) || !refused(version) ||
+        !refused(bytes.substr(0, bytes.size() - 8)) ||
+        !refused(bytes.substr(0, 16))) {
+        std::cout << "FAIL: a damaged image was accepted" << std::endl;
+        success = false;
+    }
+
+    // Code that would leave the stack, the program or its operands.
+    typedef client::vm::opcode op;
+    const std::vector<client::vm::instruction> bad[] = {
+        {{op::mod, 0}, {op::ret, 0}},
+        {{op::push, 1}, {op::jump, 0}, {op::ret, 0}},
+        {{op::push, 1}, {op::load_slot, 0}, {op::ret, 0}},
+        {{op::push, 1}, {op::push, 0}, {op::jump_if_false, 4},
+         {op::push, 2}, {op::ret, 0}},
+        {{op::push, 1}},
+    };
+    for (auto const& code : bad) {
+        if (client::vm::verify(code.data(), code.size(), 0, 0, error)) {
+            std::cout << "FAIL: the verifier accepted bad bytecode"
+                      << std::endl;
+            success = false;
+        }
+    }
+    // And accepts whatever the compiler emits.
+    std::mt19937 random(2025);
+    for (int idx = 0; idx < 2000; ++idx) {
+        const std::string text{random_expression(random, 6)};
+        client::compiled_rule rule;
+        if (!client::compiled_rule::compile(
+                text, client::engine::vm, rule, error)) {
+            continue;
+        }
+        client::vm::program const& code = rule.bytecode();
+        if (!client::vm::verify(
+                code.code.data(),
+                code.code.size(),
+                code.divisors.size(),
+                code.slots.size(),
+                error)) {
+            std::cout << "FAIL: the verifier rejected the bytecode of "
+                      << std::quoted(text) << ": " << error << std::endl;
+            success = false;
+        }
+    }
+
+    const std::string path{
+        "/tmp/plurals-parser-test-" + std::to_string(getpid()) + ".img"};
+    FILE* out{std::fopen(path.c_str(), "wb")};
+    if (out) {
+        std::fwrite(bytes.data(), 1, bytes.size(), out);
+        std::fclose(out);
+    }
+    client::image::file mapped;
+    client::image::rule loaded;
+    if (!mapped.open(path, error) || !mapped.rules().find("corpus1", loaded) ||
+        loaded(1) != client::corpus::rules[1].truth(1)) {
+        std::cout << "FAIL: could not map an image: " << error << std::endl;
+        success = false;
+    }
+    std::remove(path.c_str());
+    return success;
+}
+
+// Generates a header for the whole corpus, compiles it with a driver using
+// $CXX, or c++, and compares what every function returns with the truth.
+// Skipped when that compiler does not run.
+bool
+check_generated_code() {
+    char const* from_environment{std::getenv("CXX")};
+    const std::string compiler{
+        from_environment && *from_environment ? from_environment : "c++"};
+    if (std::system((compiler + " --version >/dev/null 2>&1").c_str()) != 0) {
+        std::cout << "Skipping generated code: " << compiler
+                  << " does not run" << std::endl;
+        return true;
+    }
+
+    std::vector<client::codegen::source> rules;
+    for (std::size_t idx = 0; idx < std::size(client::corpus::rules); ++idx) {
+        rules.push_back(
+            {"c" + std::to_string(idx), client::corpus::rules[idx].expression});
+    }
+    rules.push_back({"sr@latin.UTF-8", client::corpus::rules[12].expression});
+    std::vector<uint> ns(2000);
+    std::iota(ns.begin(), ns.end(), 0u);
+    for (uint power = 10000; power <= 1000000000; power *= 10) {
+        for (uint n : {power - 1, power, power + 1, power + 100000}) {
+            ns.push_back(n);
+        }
+    }
+    ns.push_back(4294967295u);
+
+    std::string error;
+    std::ostringstream header;
+    if (!client::codegen::generate(rules, {}, header, error)) {
+        std::cout << "FAIL: could not generate the corpus: " << error
+                  << std::endl;
+        return false;
+    }
+    char directory[] = "/tmp/plurals-parser-codegen-XXXXXX";
+    if (!mkdtemp(directory)) {
+        std::cout << "FAIL: mkdtemp: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    const std::string base{directory};
+    std::ofstream{base + "/plurals.hpp"} << header.str();
+    {
+        // Prints each locale and its results for `ns`, then whether find()
+        // returns its function.
+        std::ofstream driver{base + "/driver.cpp"};
+        driver << "#include <cstdio>\n#include \"plurals.hpp\"\n\n"
+               << "static_assert(plurals::find(\"xx\") == nullptr);\n"
+               << "static_assert(plurals::find(\"c6\")(2) == 1);\n"
+               << "constexpr unsigned ns[] = {";
+        for (uint n : ns) {
+            driver << n << "u, ";
+        }
+        driver << "};\n\nint\nmain() {\n"
+               << "    for (auto const& rule : plurals::locales) {\n"
+               << "        std::printf(\"%.*s\", int(rule.locale.size()), "
+                  "rule.locale.data());\n"
+               << "        for (unsigned n : ns) {\n"
+               << "            std::printf(\" %u\", rule.plural(n));\n"
+               << "        }\n"
+               << "        std::printf(\" %d\\n\", "
+                  "plurals::find(rule.locale) == rule.plural);\n"
+               << "    }\n}\n";
+    }
+    bool success{true};
+    const std::string build{
+        compiler + " -std=c++17 -O1 -Wall -Wextra -Werror -o " + base +
+        "/driver " + base + "/driver.cpp"};
+    if (std::system(build.c_str()) != 0) {
+        std::cout << "FAIL: the generated header did not compile: " << build
+                  << std::endl;
+        success = false;
+    } else if (FILE* output{popen((base + "/driver").c_str(), "r")}) {
+        std::ostringstream expected;
+        for (client::codegen::source const& rule : rules) {
+            expected << rule.locale;
+            uint (*truth)(uint) = nullptr;
+            for (client::corpus::entry const& test : client::corpus::rules) {
+                if (rule.text == test.expression) {
+                    truth = test.truth;
+                }
+            }
+            for (uint n : ns) {
+                expected << ' ' << truth(n);
+            }
+            expected << " 1\n";
+        }
+        std::string lines;
+        char buffer[4096];
+        std::size_t count;
+        while ((count = std::fread(buffer, 1, sizeof(buffer), output)) > 0) {
+            lines.append(buffer, count);
+        }
+        // The table is sorted by locale, so sort the expected lines too.
+        auto sorted = [](std::string const& text) {
+            std::multiset<std::string> out;
+            std::istringstream in{text};
+            for (std::string line; std::getline(in, line);) {
+                out.insert(line);
+            }
+            return out;
+        };
+        if (pclose(output) != 0 || sorted(lines) != sorted(expected.str())) {
+            std::cout << "FAIL: generated functions differ from the corpus"
+                      << std::endl;
+            success = false;
+        }
+    }
+    for (char const* file : {"/plurals.hpp", "/driver.cpp", "/driver"}) {
+        std::remove((base + file).c_str());
+    }
+    rmdir(directory);
+    return success;
+}
+
+// Generated code for a few rules: shared functions and subexpressions, the
+// table and the input it refuses.
+bool
+check_codegen() {
+    bool success{true};
+    const std::vector<client::codegen::source> rules{
+        {"ru",
+         "n%10==1 && n%100!=11 ? 0 : n%10>=2 && n%10<=4 && (n%100<10 || "
+         "n%100>=20) ? 1 : 2"},
+        {"uk",
+         "n%10==1 && 11!=n%100 ? 0 : n%10>=2 && n%10<=4 && (n%100<10 || "
+         "n%100>=20) ? 1 : 2"},
+        {"fr", "n > 1"},
+        {"", "n % (n % 7) == 0"},
+    };
+    std::ostringstream header;
+    std::string error;
+    if (!client::codegen::generate(rules, {}, header, error)) {
+        std::cout << "FAIL: could not generate code: " << error << std::endl;
+        return false;
+    }
+    const std::string text{header.str()};
+    auto contains = [&text](std::string const& part) {
+        return text.find(part) != std::string::npos;
+    };
+    if (contains("plural_3") || !contains("plural_2") ||
+        !contains("// Locales: ru, uk") ||
+        !contains("const unsigned t0 = (n % 10u);") ||
+        !contains("detail::mod(n, (n % 7u))")) {
+        std::cout << "FAIL: generated functions:\n" << text << std::endl;
+        success = false;
+    }
+    const auto fr = text.find("{\"fr\", plural_1}");
+    const auto ru = text.find("{\"ru\", plural_0}");
+    const auto uk = text.find("{\"uk\", plural_0}");
+    if (fr == std::string::npos || ru == std::string::npos ||
+        uk == std::string::npos || !(fr < ru && ru < uk)) {
+        std::cout << "FAIL: generated locale table:\n" << text << std::endl;
+        success = false;
+    }
+
+    std::ostringstream ignored;
+    if (client::codegen::generate(
+            {{"fr", "n > 1"}, {"fr", "n != 1"}}, {}, ignored, error) ||
+        client::codegen::generate(
+            {{"fr", "n > 1"}}, {"not a namespace"}, ignored, error) ||
+        client::codegen::generate({{"fr", "n >"}}, {}, ignored, error) ||
+        client::codegen::generate({{"fr\\", "n > 1"}}, {}, ignored, error) ||
+        client::codegen::generate(
+            {{"fr\n", "n > 1"}}, {}, ignored, error) ||
+        client::codegen::generate({{"f\"r", "n > 1"}}, {}, ignored, error) ||
+        !ignored.str().empty()) {
+        std::cout << "FAIL: codegen accepted bad input" << std::endl;
+        success = false;
+    }
+    return check_generated_code() && success;
+}
+
+bool
+run_tests() {
+    bool success{true};
+    for (client::corpus::entry const& test : client::corpus::rules) {
+        const std::string str{test.expression};
+        client::ast::operand program;
+        if (!parse_rule(str, program)) {
+            success = false;
+            continue;
+        }
+
+        client::ast::operand optimized{program};
+        client::ast::optimize(optimized);
+
+        client::vm::program bytecode;
+        std::string error;
+        if (!client::vm::compile(optimized, bytecode, error)) {
+            std::cout << "Compilation failed: " << error << std::endl;
+            std::cout << "Expression: " << std::quoted(str) << std::endl;
+            success = false;
+            continue;
+        }
+
+        client::periodic::table table;
+        const bool tabulated{client::periodic::tabulate(optimized, table)};
+
+        client::flat::tree parsed;
+        if (!client::flat::parse(str, parsed, error)) {
+            std::cout << "Flat parsing failed: " << error << std::endl;
+            std::cout << "Expression: " << std::quoted(str) << std::endl;
+            success = false;
+            continue;
+        }
+        client::flat::tree flattened;
+        client::flat::flatten(optimized, flattened);
+
+        for (uint idx = 0; idx <= 1000; ++idx) {
+            const uint result{client::ast::evaluator(idx)(program)};
+            const uint truth{test.truth(idx)};
+
+            success &= check_engine(
+                "optimizer",
+                str,
+                idx,
+                result,
+                client::ast::evaluator(idx)(optimized));
+            success &= check_engine(
+                "VM", str, idx, result, client::vm::run(bytecode, idx));
+            if (tabulated) {
+                success &= check_engine("Table", str, idx, result, table(idx));
+            }
+            success &=
+                check_engine("Flat parser", str, idx, result, parsed(idx));
+            success &=
+                check_engine("Flat tree", str, idx, result, flattened(idx));
+
+            if (result != truth) {
                 std::cout << "-------------------------" << std::endl;
-                return EXIT_FAILURE;
+                std::cout << "Program:    ";
+                client::ast::printer{}(program);
+                std::cout << std::endl;
+                std::cout << "Expression: " << std::quoted(str) << std::endl;
+                std::cout << "n: " << idx << std::endl;
+                std::cout << "Result: " << result << std::endl;
+                std::cout << "Truth: " << truth << std::endl;
+                std::cout << "-------------------------" << std::endl;
+
+                std::cout << "FAIL: Result did not match truth!" << std::endl;
+                success = false;
+            }
+        }
+        success &= check_compiled_engines(str, optimized, test.truth);
+        success &= check_kernel(str, test.truth);
+    }
+
+    client::ast::operand custom;
+    if (!parse_rule("n % 7 == 3", custom) ||
+        client::kernels::find(custom)) {
+        std::cout << "FAIL: a non-standard rule matched a built-in kernel"
+                  << std::endl;
+        success = false;
+    }
+    client::flat::tree broken;
+    std::string error;
+    if (client::flat::parse("(n == 1", broken, error)) {
+        std::cout << "FAIL: the flat parser accepted \"(n == 1\""
+                  << std::endl;
+        success = false;
+    }
+    // Flat trees evaluate chains of operations in a loop.
+    std::string chain{"n"};
+    for (int idx = 0; idx < 100000; ++idx) {
+        chain += " % 7";
+    }
+    client::flat::tree chained;
+    client::flat::tree pratt_chained;
+    client::flat::tree flattened_chain;
+    client::ast::operand chain_tree;
+    std::size_t offset = 0;
+    std::string expected;
+    if (!client::flat::parse(chain, chained, error) ||
+        !client::pratt::parse(chain, pratt_chained, offset, expected) ||
+        !client::pratt::parse(chain, chain_tree, offset, expected)) {
+        std::cout << "FAIL: a chain of 100000 operations did not parse"
+                  << std::endl;
+        success = false;
+    } else {
+        client::flat::flatten(chain_tree, flattened_chain);
+        for (uint n : {0u, 12u, 4294967295u}) {
+            if (chained(n) != n % 7 || pratt_chained(n) != n % 7 ||
+                flattened_chain(n) != n % 7) {
+                std::cout << "FAIL: a chain of 100000 operations gave the "
+                          << "wrong result for n = " << n << std::endl;
+                success = false;
             }
         }
     }
+    // The VM stores a shared subexpression where every path through the
+    // code after it reads it: here after the test of n == 0.
+    client::compiled_rule branchy;
+    if (client::compiled_rule::compile(
+            "n == 0 ? 0 : n % 100 == 2 || n % 100 == 22",
+            client::engine::vm,
+            branchy,
+            error)) {
+        auto const& code = branchy.bytecode().code;
+        auto first = [&code](client::vm::opcode op) {
+            return std::find_if(
+                code.begin(), code.end(), [op](auto const& ins) {
+                    return ins.op == op;
+                });
+        };
+        if (branchy.bytecode().slots.size() != 1 ||
+            first(client::vm::opcode::store_slot) <
+                first(client::vm::opcode::jump_if_false)) {
+            std::cout << "FAIL: n % 100 was not stored in the branch that "
+                      << "uses it" << std::endl;
+            success = false;
+        }
+    } else {
+        std::cout << "FAIL: " << error << std::endl;
+        success = false;
+    }
+    client::compiled_rule unknown;
+    if (client::compiled_rule::compile(
+            "x == 1", client::engine::automatic, unknown, error) ||
+        client::flat::parse("n == 1 || nn", broken, error)) {
+        std::cout << "FAIL: an unknown variable was accepted" << std::endl;
+        success = false;
+    }
+    success &= check_errors();
+    success &= check_frontends();
+    success &= check_range();
+    success &= check_canonical();
+    success &= check_cache();
+    success &= check_library();
+    success &= check_stream();
+    success &= check_server();
+    success &= check_catalog();
+    success &= check_image();
+    success &= check_codegen();
 
     return success;
 }
 
 bool
 evaluate_plural_forms(
-    std::string plural_forms, uint n, uint& result, bool verbose) {
+    std::string plural_forms,
+    uint n,
+    uint& result,
+    client::engine engine,
+    client::frontend parser,
+    bool verbose) {
+    std::shared_ptr<client::compiled_rule const> rule;
+    std::string error;
+    if (engine == client::engine::automatic &&
+        parser == client::frontend::pratt) {
+        rule = client::cache::lookup(plural_forms, error);
+    } else {
+        client::compiled_rule compiled;
+        if (client::compiled_rule::compile(
+                plural_forms, engine, compiled, error, parser)) {
+            rule = std::make_shared<client::compiled_rule const>(
+                std::move(compiled));
+        }
+    }
+    if (!rule) {
+        std::cout << "Failed to compile plural-forms expression: " << error
+                  << std::endl;
+        return false;
+    }
+
+    result = (*rule)(n);
+    if (verbose) {
+        client::ast::printer print;
+        std::cout << "Program:    ";
+        print(rule->program());
+        std::cout << std::endl;
+        std::cout << "Optimizer:  removed " << rule->removed() << " of "
+                  << rule->nodes() << " nodes" << std::endl;
+        std::cout << "Hash:       " << std::hex << std::setw(16)
+                  << std::setfill('0') << rule->fingerprint() << std::dec
+                  << std::setfill(' ') << std::endl;
+        std::cout << "Canonical:  " << std::hex << std::setw(16)
+                  << std::setfill('0') << rule->canonical_hash() << std::dec
+                  << std::setfill(' ') << std::endl;
+        std::cout << "Path:       " << client::engine_name(rule->selected());
+        if (rule->kernel()) {
+            std::cout << ' ' << rule->kernel()->name;
+        }
+        std::cout << std::endl;
+        if (rule->selected() == client::engine::table) {
+            std::cout << "Table:      period " << rule->table().period.value
+                      << ", threshold " << rule->table().threshold
+                      << std::endl;
+        }
+        if (rule->function().size()) {
+            std::cout << "JIT:        " << rule->function().size()
+                      << " bytes of x86-64" << std::endl;
+        }
+        if (!rule->bytecode().code.empty()) {
+            std::cout << "Bytecode:" << std::endl;
+            client::vm::disassembler{}(rule->bytecode());
+        }
+        if (engine == client::engine::automatic) {
+            const client::cache::statistics stats{client::cache::stats()};
+            std::cout << "Cache:      " << stats.hits << " hits, "
+                      << stats.misses << " misses, " << stats.size << " of "
+                      << stats.capacity << " entries, " << stats.programs
+                      << " distinct rules" << std::endl;
+        }
+        std::cout << "Expression: " << std::quoted(plural_forms) << std::endl;
+        std::cout << "Result: " << result << std::endl;
+    }
+
+    return true;
+}
+
+client::server::daemon* serving = nullptr;
+
+void
+stop_serving(int) {
+    if (serving) {
+        serving->stop();
+    }
+}
+
+// A JSON string literal.
+std::string
+json_string(std::string const& text) {
+    std::string out{"\""};
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + '"';
+}
+
+// Prints what range analysis proves about a rule. Fails if the rule does
+// not parse, a `% 0` may be reached, or, when `nplurals` is not 0, a result
+// may be nplurals or more.
+bool
+check_plural_forms(std::string const& text, uint nplurals, bool json) {
     client::ast::operand program;
-    client::ast::evaluator eval(n);
-    client::ast::printer print;
-
-    std::string::const_iterator iter = plural_forms.begin();
-    std::string::const_iterator end = plural_forms.end();
-    bool r = phrase_parse(iter, end, client::expression(), x3::space, program);
-
-    if (r && iter == end) {
-        result = eval(program);
-        if (verbose) {
-            std::cout << "Program:    ";
-            print(program);
-            std::cout << std::endl;
-            std::cout << "Expression: " << std::quoted(plural_forms)
+    std::size_t offset;
+    std::string expected;
+    if (!client::pratt::parse(text, program, offset, expected)) {
+        if (json) {
+            std::cout << "{\"expression\": " << json_string(text)
+                      << ", \"error\": {\"offset\": " << offset
+                      << ", \"expected\": " << json_string(expected) << "}}"
+                      << std::endl;
+        } else {
+            std::cout << "Expected " << expected << " at offset " << offset
                       << std::endl;
-            std::cout << "Result: " << result << std::endl;
         }
-    } else {
-        if (verbose) {
-            std::string rest(iter, end);
-            std::cout << "Parsing failed" << std::endl;
-            std::cout << "stopped at: \" " << rest << "\"" << std::endl;
+        return false;
+    }
+
+    const client::range::report report{client::range::analyze(program)};
+    // A result of nplurals or more, and an n producing it if one is known.
+    client::range::sample const* over{nullptr};
+    for (client::range::sample const& found : report.samples) {
+        if (nplurals && found.value >= nplurals) {
+            over = &found;
+            break;
+        }
+    }
+    const bool in_range{!nplurals || report.max < nplurals};
+    const bool passed{in_range && report.divisions.empty()};
+
+    if (json) {
+        std::cout << "{\"expression\": " << json_string(text)
+                  << ", \"exact\": " << std::boolalpha << report.exact
+                  << ", \"values\": [";
+        for (std::size_t idx = 0; idx < report.values.size(); ++idx) {
+            client::range::progression const& run = report.values[idx];
+            std::cout << (idx ? ", " : "") << "{\"first\": " << run.first
+                      << ", \"last\": " << run.last
+                      << ", \"step\": " << run.step << '}';
+        }
+        std::cout << "], \"max\": " << report.max << ", \"samples\": [";
+        for (std::size_t idx = 0; idx < report.samples.size(); ++idx) {
+            std::cout << (idx ? ", " : "")
+                      << "{\"value\": " << report.samples[idx].value
+                      << ", \"n\": " << report.samples[idx].n << '}';
+        }
+        std::cout << ']';
+        if (nplurals) {
+            std::cout << ", \"nplurals\": " << nplurals << ", \"in_range\": ";
+            if (in_range) {
+                std::cout << "true";
+            } else if (report.exact) {
+                std::cout << "false";
+            } else {
+                std::cout << "null";
+            }
+            if (over) {
+                std::cout << ", \"out_of_range\": {\"value\": " << over->value
+                          << ", \"n\": " << over->n << '}';
+            }
+        }
+        std::cout << ", \"divisions_by_zero\": [";
+        for (std::size_t idx = 0; idx < report.divisions.size(); ++idx) {
+            client::range::division const& found = report.divisions[idx];
+            std::cout << (idx ? ", " : "")
+                      << "{\"operation\": " << json_string(found.text)
+                      << ", \"proven\": " << found.proven;
+            if (found.proven) {
+                std::cout << ", \"n\": " << found.n;
+            }
+            std::cout << '}';
+        }
+        std::cout << "], \"unreachable\": [";
+        for (std::size_t idx = 0; idx < report.unreachable.size(); ++idx) {
+            client::range::branch const& found = report.unreachable[idx];
+            std::cout << (idx ? ", " : "")
+                      << "{\"condition\": " << json_string(found.condition)
+                      << ", \"when\": " << found.when
+                      << ", \"branch\": " << json_string(found.text) << '}';
+        }
+        std::cout << "], \"regions\": " << report.regions << '}'
+                  << std::noboolalpha << std::endl;
+        return passed;
+    }
+
+    std::cout << "Values:      ";
+    for (std::size_t idx = 0; idx < report.values.size(); ++idx) {
+        client::range::progression const& run = report.values[idx];
+        std::cout << (idx ? ", " : "") << run.first;
+        if (run.step) {
+            std::cout << ".." << run.last;
+        }
+        if (run.step > 1) {
+            std::cout << " step " << run.step;
+        }
+    }
+    std::cout << (report.exact ? " (exact)" : " (at most)") << std::endl;
+    if (nplurals) {
+        std::cout << "nplurals:    " << nplurals << ", ";
+        if (in_range) {
+            std::cout << "every result is in range";
+        } else if (report.exact) {
+            std::cout << "results reach " << report.max;
+        } else {
+            std::cout << "results may reach " << report.max;
+        }
+        if (over) {
+            std::cout << " (" << over->value << " for n = " << over->n << ')';
+        }
+        std::cout << std::endl;
+    }
+    for (client::range::division const& found : report.divisions) {
+        std::cout << "Modulo zero: " << found.text;
+        if (found.proven) {
+            std::cout << " for n = " << found.n;
+        } else {
+            std::cout << " may be reached";
+        }
+        std::cout << std::endl;
+    }
+    for (client::range::branch const& found : report.unreachable) {
+        std::cout << "Unreachable: " << (found.when ? "? " : ": ")
+                  << found.text << " after " << found.condition << std::endl;
+    }
+    return passed;
+}
+
+// Splits "LOCALE=expression" into its parts. Text with no locale before
+// its first '=', such as "n==1 ? 0 : 1", is an expression without a name.
+void
+split_rule(std::string const& arg, std::string& name, std::string& text) {
+    const std::size_t equals{arg.find('=')};
+    const bool named{
+        equals != std::string::npos && equals > 0 &&
+        arg.compare(equals, 2, "==") != 0 &&
+        std::all_of(arg.begin(), arg.begin() + equals, [](char c) {
+            return std::isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+                   c == '-' || c == '@' || c == '.';
+        })};
+    name = named ? arg.substr(0, equals) : std::string();
+    text = named ? arg.substr(equals + 1) : arg;
+}
+
+// Appends the rules in `path`, one per line; blank lines and lines
+// starting with '#' are skipped.
+bool
+read_rules(std::string const& path, std::vector<std::string>& out) {
+    std::ifstream in{path};
+    if (!in) {
+        std::cerr << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty() && line[0] != '#') {
+            out.push_back(line);
         }
+    }
+    return true;
+}
+
+// Compiles `sources` into an image at `output`. The image is written
+// next to it and renamed into place, so a process mapping the old image
+// never sees a partial one.
+bool
+compile_image(
+    std::vector<std::string> const& sources, std::string const& output) {
+    std::vector<client::image::entry> rules;
+    std::set<std::string> distinct;
+    std::size_t tables = 0;
+    for (std::string const& source : sources) {
+        client::image::entry entry;
+        std::string text;
+        split_rule(source, entry.name, text);
+        std::string error;
+        if (!client::image::compile(text, entry.rule, error)) {
+            std::cerr << "compile: " << std::quoted(source) << ": " << error
+                      << std::endl;
+            return false;
+        }
+        tables += entry.rule.selected() == client::engine::table;
+        distinct.insert(entry.rule.canonical());
+        rules.push_back(std::move(entry));
+    }
+
+    std::string bytes;
+    std::string error;
+    if (!client::image::write(rules, bytes, error)) {
+        std::cerr << "compile: " << error << std::endl;
+        return false;
+    }
+    const std::string partial{output + ".tmp"};
+    FILE* out{std::fopen(partial.c_str(), "wb")};
+    const bool written{
+        out && std::fwrite(bytes.data(), 1, bytes.size(), out) == bytes.size()};
+    if (!out || std::fclose(out) != 0 || !written ||
+        std::rename(partial.c_str(), output.c_str()) != 0) {
+        std::cerr << "compile: " << output << ": " << std::strerror(errno)
+                  << std::endl;
+        std::remove(partial.c_str());
         return false;
     }
+    std::cout << "Wrote " << rules.size() << " rules to " << output << ", "
+              << bytes.size() << " bytes: " << tables << " tables, "
+              << rules.size() - tables << " programs, "
+              << rules.size() - distinct.size() << " shared" << std::endl;
+    return true;
+}
 
+// Writes the C++ header for `sources` to `output`, or to standard output
+// if it is empty.
+bool
+generate_header(
+    std::vector<std::string> const& sources,
+    client::codegen::options const& config,
+    std::string const& output) {
+    std::vector<client::codegen::source> rules;
+    for (std::string const& source : sources) {
+        rules.emplace_back();
+        split_rule(source, rules.back().locale, rules.back().text);
+    }
+    std::ostringstream header;
+    std::string error;
+    if (!client::codegen::generate(rules, config, header, error)) {
+        std::cerr << "codegen: " << error << std::endl;
+        return false;
+    }
+    if (output.empty()) {
+        std::cout << header.str();
+        return true;
+    }
+    std::ofstream out{output};
+    out << header.str();
+    out.close();
+    if (!out) {
+        std::cerr << "codegen: " << output << ": " << std::strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Evaluates the rule named `name` in the image at `path`, or failing
+// that the first rule whose text is `name`.
+bool
+evaluate_image(
+    std::string const& path, std::string const& name, uint n, bool verbose) {
+    const auto start{std::chrono::steady_clock::now()};
+    client::image::file image;
+    std::string error;
+    if (!image.open(path, error)) {
+        std::cout << path << ": " << error << std::endl;
+        return false;
+    }
+    const std::chrono::duration<double> opened{
+        std::chrono::steady_clock::now() - start};
+
+    client::image::view const& rules = image.rules();
+    client::image::rule rule;
+    bool found{rules.find(name, rule)};
+    for (std::size_t idx = 0; !found && idx < rules.size(); ++idx) {
+        if (rules[idx].text() == name) {
+            rule = rules[idx];
+            found = true;
+        }
+    }
+    if (!found) {
+        std::cout << path << ": no rule " << std::quoted(name) << std::endl;
+        return false;
+    }
+    const uint result{rule(n)};
+    if (verbose) {
+        std::cout << "Image:      " << rules.size() << " rules, "
+                  << rules.bytes() << " bytes, opened in " << std::fixed
+                  << std::setprecision(1) << opened.count() * 1e6 << " us"
+                  << std::endl;
+        std::cout << "Canonical:  " << std::hex << std::setw(16)
+                  << std::setfill('0') << rule.canonical_hash() << std::dec
+                  << std::setfill(' ') << std::endl;
+        std::cout << "Path:       " << client::engine_name(rule.selected())
+                  << std::endl;
+        std::cout << "Expression: " << std::quoted(rule.text()) << std::endl;
+        std::cout << "Result: " << result << std::endl;
+    }
+    std::cout << result << std::endl;
     return true;
 }
 
@@ -354,32 +2025,276 @@ main(int argc, char** argv) {
         ->required(true);
 
     uint n;
-    eval->add_option("-n,--n", n, "The value of n.")->required(true);
+    CLI::Option* n_option{
+        eval->add_option("-n,--n", n, "The value of n.")->required(false)};
+
+    bool from_stdin{false};
+    eval->add_flag(
+            "--stdin",
+            from_stdin,
+            "Read newline-separated values of n from stdin instead.")
+        ->required(false)
+        ->excludes(n_option);
+
+    std::string engine_name{"auto"};
+    eval->add_option(
+            "--engine",
+            engine_name,
+            "Evaluation engine: auto (default), kernel, table, jit, vm or "
+            "tree.")
+        ->required(false);
+
+    std::string parser_name{"pratt"};
+    eval->add_option(
+            "--parser", parser_name, "Parser: pratt (default) or x3.")
+        ->required(false);
+
+    std::string image_path;
+    eval->add_option(
+            "--image",
+            image_path,
+            "Evaluate the rule of this name, or with this text, from an "
+            "image written by compile.")
+        ->required(false);
 
     bool verbose;
     eval->add_flag("-v,--verbose", verbose, "Be verbose.")->required(false);
 
+    CLI::App* serve{app.add_subcommand(
+        "serve", "Evaluate plural-forms ternaries for other processes.")};
+
+    client::server::options config;
+    serve
+        ->add_option(
+            "--socket", config.socket_path, "Path of the Unix domain socket.")
+        ->required(true);
+    serve
+        ->add_option(
+            "--workers",
+            config.workers,
+            "Number of threads serving connections (default 4).")
+        ->required(false);
+
+    CLI::App* load{app.add_subcommand(
+        "load", "Read the Plural-Forms of .mo and .po catalogs.")};
+    client::catalog::options catalogs;
+    load->add_option(
+            "paths", catalogs.paths, "Catalogs, or directories to search.")
+        ->required(true);
+    load->add_option(
+            "--threads",
+            catalogs.threads,
+            "Threads loading catalogs (default: all cores).")
+        ->required(false);
+    load->add_flag("-q,--quiet", catalogs.quiet, "Only print the summary.")
+        ->required(false);
+
+    CLI::App* compile{app.add_subcommand(
+        "compile", "Precompile plural-forms ternaries into an image.")};
+    std::vector<std::string> sources;
+    compile
+        ->add_option(
+            "rules",
+            sources,
+            "Rules to compile, each an expression or LOCALE=expression.")
+        ->required(false);
+    std::string rules_path;
+    compile
+        ->add_option(
+            "-f,--file",
+            rules_path,
+            "Also read rules from a file, one per line.")
+        ->required(false);
+    std::string output;
+    compile->add_option("-o,--output", output, "The image to write.")
+        ->required(true);
+
+    CLI::App* codegen{app.add_subcommand(
+        "codegen", "Generate a C++ header evaluating plural-forms ternaries.")};
+    std::vector<std::string> generated;
+    codegen
+        ->add_option(
+            "rules",
+            generated,
+            "Rules to generate, each an expression or LOCALE=expression.")
+        ->required(false);
+    std::string generated_path;
+    codegen
+        ->add_option(
+            "-f,--file",
+            generated_path,
+            "Also read rules from a file, one per line.")
+        ->required(false);
+    std::string header_path;
+    codegen
+        ->add_option(
+            "-o,--output",
+            header_path,
+            "The header to write (default: stdout).")
+        ->required(false);
+    client::codegen::options generation;
+    codegen
+        ->add_option(
+            "--namespace",
+            generation.name_space,
+            "Namespace of the generated code (default: plurals).")
+        ->required(false);
+
+    CLI::App* check{app.add_subcommand(
+        "check", "Prove what values a plural-forms ternary can produce.")};
+    std::string checked;
+    check->add_option(
+            "plural-forms", checked, "A Gettext plural-forms ternary.")
+        ->required(true);
+    uint nplurals = 0;
+    check->add_option(
+            "--nplurals",
+            nplurals,
+            "Also prove that every result is less than this.")
+        ->required(false);
+    bool json{false};
+    check->add_flag("--json", json, "Print the analysis as JSON.")
+        ->required(false);
+
     CLI::App* test{app.add_subcommand("test", "Run test suite.")};
     test->add_flag("-v,--verbose", verbose, "Be verbose.")->required(false);
 
+    bool exhaustive{false};
+    test->add_flag(
+            "--exhaustive",
+            exhaustive,
+            "Check every 32-bit n against the truth functions.")
+        ->required(false);
+
+    client::exhaustive::options sweep;
+    test->add_option(
+            "--engine",
+            sweep.engine,
+            "Engine checked by --exhaustive: all (default), kernel, table, "
+            "jit, batch, vm or tree.")
+        ->required(false);
+    test->add_option(
+            "--threads",
+            sweep.threads,
+            "Threads used by --exhaustive (default: all cores).")
+        ->required(false);
+    test->add_option(
+            "--last", sweep.last, "Largest n checked by --exhaustive.")
+        ->required(false);
+
     CLI11_PARSE(app, argc, argv);
 
     if (app.got_subcommand("test")) {
-        if (run_tests()) {
+        const bool passed{
+            exhaustive ? client::exhaustive::verify(sweep) : run_tests()};
+        if (passed) {
             std::cout << "All tests passed." << std::endl;
         } else {
             std::cout << "Tests failed." << std::endl;
+            return EXIT_FAILURE;
         }
     }
 
+    if (app.got_subcommand("check") &&
+        !check_plural_forms(checked, nplurals, json)) {
+        return EXIT_FAILURE;
+    }
+
+    if (app.got_subcommand("load") && !client::catalog::run(catalogs)) {
+        return EXIT_FAILURE;
+    }
+
+    if (app.got_subcommand("codegen") &&
+        ((!generated_path.empty() && !read_rules(generated_path, generated)) ||
+         !generate_header(generated, generation, header_path))) {
+        return EXIT_FAILURE;
+    }
+
+    if (app.got_subcommand("compile") &&
+        ((!rules_path.empty() && !read_rules(rules_path, sources)) ||
+         !compile_image(sources, output))) {
+        return EXIT_FAILURE;
+    }
+
+    if (app.got_subcommand("serve")) {
+        client::server::daemon daemon;
+        std::string error;
+        if (!daemon.start(config, error)) {
+            std::cerr << "serve: " << error << std::endl;
+            return EXIT_FAILURE;
+        }
+        serving = &daemon;
+        std::signal(SIGINT, stop_serving);
+        std::signal(SIGTERM, stop_serving);
+        std::cout << "Listening on " << config.socket_path << std::endl;
+        daemon.wait();
+        serving = nullptr;
+    }
+
     if (app.got_subcommand("eval")) {
         uint result;
-        if (!evaluate_plural_forms(plural_forms, n, result, verbose)) {
-            std::cout << "Failed to parse plural-forms expression. Try running "
-                         "with --verbose for more information."
+        client::engine engine;
+        if (!client::parse_engine(engine_name, engine)) {
+            std::cout << "Unknown engine " << std::quoted(engine_name)
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+        client::frontend parser;
+        if (!client::parse_frontend(parser_name, parser)) {
+            std::cout << "Unknown parser " << std::quoted(parser_name)
                       << std::endl;
             return EXIT_FAILURE;
         }
+        if (!from_stdin && !n_option->count()) {
+            std::cout << "--n or --stdin is required" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!image_path.empty()) {
+            if (from_stdin) {
+                std::cout << "--stdin does not support --image" << std::endl;
+                return EXIT_FAILURE;
+            }
+            return evaluate_image(image_path, plural_forms, n, verbose)
+                       ? EXIT_SUCCESS
+                       : EXIT_FAILURE;
+        }
+        const bool defaults{
+            engine == client::engine::automatic &&
+            parser == client::frontend::pratt && !verbose};
+        if (from_stdin && !defaults) {
+            std::cout << "--stdin only supports --engine=auto and "
+                         "--parser=pratt without --verbose"
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (defaults) {
+            char error[256];
+            pluralsparser_rule* rule{pluralsparser_compile(
+                plural_forms.c_str(), error, sizeof(error))};
+            if (!rule) {
+                std::cout << "Failed to compile plural-forms expression: "
+                          << error << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (from_stdin) {
+                std::string message;
+                const bool streamed{client::stream::evaluate(
+                    rule, STDIN_FILENO, STDOUT_FILENO, message)};
+                pluralsparser_free(rule);
+                if (!streamed) {
+                    std::cerr << "eval --stdin: " << message << std::endl;
+                    return EXIT_FAILURE;
+                }
+                return EXIT_SUCCESS;
+            }
+            std::cout << pluralsparser_eval(rule, n) << std::endl;
+            pluralsparser_free(rule);
+            return EXIT_SUCCESS;
+        }
+        if (!evaluate_plural_forms(
+                plural_forms, n, result, engine, parser, verbose)) {
+            return EXIT_FAILURE;
+        }
         std::cout << result << std::endl;
     }
 
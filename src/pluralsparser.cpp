@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+
+#include "batch.hpp"
+#include "cache.hpp"
+#include "compiled_rule.hpp"
+#include "pluralsparser.h"
+
+struct pluralsparser_rule {
+    std::shared_ptr<client::compiled_rule const> rule;
+    // Set for rules that run on the VM, which is slower per n than the
+    // SIMD batch kernels.
+    client::batch::program batch;
+    bool vectorized = false;
+};
+
+namespace {
+    // Values of n evaluated per call into the batch kernels.
+    constexpr std::size_t chunk = 256;
+
+    void
+    report(std::string const& message, char* error, std::size_t error_size) {
+        if (!error || !error_size) {
+            return;
+        }
+        const std::size_t length{std::min(message.size(), error_size - 1)};
+        std::memcpy(error, message.data(), length);
+        error[length] = '\0';
+    }
+} // namespace
+
+pluralsparser_rule*
+pluralsparser_compile(char const* text, char* error, size_t error_size) {
+    if (!text) {
+        report("no expression given", error, error_size);
+        return nullptr;
+    }
+    // No exception may cross the C interface.
+    try {
+        std::string message;
+        std::unique_ptr<pluralsparser_rule> handle{new pluralsparser_rule};
+        handle->rule = client::cache::lookup(text, message);
+        if (!handle->rule) {
+            report(message, error, error_size);
+            return nullptr;
+        }
+        if (handle->rule->selected() == client::engine::vm) {
+            handle->vectorized = client::batch::compile(
+                handle->rule->program(), handle->batch, message);
+        }
+        return handle.release();
+    } catch (std::exception const& failure) {
+        report(failure.what(), error, error_size);
+        return nullptr;
+    }
+}
+
+unsigned int
+pluralsparser_eval(pluralsparser_rule const* rule, unsigned int n) {
+    return (*rule->rule)(n);
+}
+
+void
+pluralsparser_eval_batch(
+    pluralsparser_rule const* rule,
+    unsigned int const* ns,
+    unsigned int* out,
+    size_t count) {
+    client::compiled_rule const& scalar = *rule->rule;
+    if (!rule->vectorized) {
+        for (std::size_t idx = 0; idx < count; ++idx) {
+            out[idx] = scalar(ns[idx]);
+        }
+        return;
+    }
+
+    std::uint8_t categories[chunk];
+    for (std::size_t base = 0; base < count; base += chunk) {
+        const std::size_t size{std::min(chunk, count - base)};
+        client::batch::evaluate(rule->batch, ns + base, categories, size);
+        for (std::size_t idx = 0; idx < size; ++idx) {
+            // The batch kernels saturate at 255; recompute those exactly.
+            out[base + idx] = categories[idx] == 255
+                                  ? scalar(ns[base + idx])
+                                  : categories[idx];
+        }
+    }
+}
+
+void
+pluralsparser_free(pluralsparser_rule* rule) {
+    delete rule;
+}
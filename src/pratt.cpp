@@ -0,0 +1,506 @@
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <boost/spirit/home/x3/support/ast/variant.hpp>
+
+#include "pratt.hpp"
+#include "scan.hpp"
+
+namespace client {
+namespace pratt {
+    namespace x3 = boost::spirit::x3;
+
+    namespace {
+        enum class level : std::uint8_t {
+            logical,
+            equality,
+            relational,
+            multiplicative,
+        };
+
+        // Names of the X3 rules, as reported in expectation failures.
+        char const*
+        rule_name(level at) {
+            switch (at) {
+            case level::logical: return "logical";
+            case level::equality: return "relational";
+            case level::relational: return "multiplicative";
+            case level::multiplicative: return "primary";
+            }
+            return "?";
+        }
+
+        // A rule either matches, does not match without consuming input,
+        // or fails after consuming some, which X3 reports by throwing.
+        enum class result : std::uint8_t { match, no_match, error };
+
+        // Builds the ast::operand the X3 grammar does. Nodes are created in
+        // their final place, as assigning a finished node to an operand
+        // costs as much again as building it.
+        class tree_builder {
+        public:
+            typedef ast::operand value;
+            typedef ast::expression* chain;
+            typedef ast::conditional_op* branches;
+
+            chain
+            begin(value& out) {
+                return &emplace<ast::expression>(out);
+            }
+
+            value&
+            first(chain node) {
+                return node->lhs;
+            }
+
+            value&
+            next(chain node, ast::binary_operator op) {
+                node->rhs.push_back({op, {}});
+                return node->rhs.back().rhs;
+            }
+
+            void
+            combine(chain) {}
+
+            void
+            finish(chain, value&) {}
+
+            branches
+            conditional(value& out) {
+                ast::operand condition{std::move(out)};
+                ast::conditional_op& node{emplace<ast::conditional_op>(out)};
+                node.lhs = std::move(condition);
+                return &node;
+            }
+
+            value&
+            if_true(branches node) {
+                return node->rhs_true;
+            }
+
+            value&
+            if_false(branches node) {
+                return node->rhs_false;
+            }
+
+            void
+            finish(branches, value&) {}
+
+            void
+            constant(value& out, uint number) {
+                out = number;
+            }
+
+            void
+            variable(value& out, std::uint32_t slot) {
+                out = ast::variable{slot};
+            }
+
+        private:
+            template <typename Node>
+            static Node&
+            emplace(ast::operand& out) {
+                out = Node{};
+                return boost::get<x3::forward_ast<Node>>(out.get()).get();
+            }
+        };
+
+        // Builds the same flat::tree as flat::parse, bottom-up.
+        class flat_builder {
+        public:
+            typedef std::uint32_t value;
+
+            struct chain {
+                ast::binary_operator op;
+                value lhs;
+                value rhs;
+            };
+
+            struct branches {
+                value condition;
+                value yes;
+                value no;
+            };
+
+            explicit flat_builder(flat::tree& out) : out(out) {}
+
+            chain
+            begin(value&) {
+                return {};
+            }
+
+            value&
+            first(chain& node) {
+                return node.lhs;
+            }
+
+            value&
+            next(chain& node, ast::binary_operator op) {
+                node.op = op;
+                return node.rhs;
+            }
+
+            void
+            combine(chain& node) {
+                node.lhs = out.add(
+                    {flat::kind::binary, node.op, node.lhs, node.rhs, 0});
+            }
+
+            void
+            finish(chain& node, value& result) {
+                result = node.lhs;
+            }
+
+            branches
+            conditional(value& condition) {
+                return {condition, 0, 0};
+            }
+
+            value&
+            if_true(branches& node) {
+                return node.yes;
+            }
+
+            value&
+            if_false(branches& node) {
+                return node.no;
+            }
+
+            void
+            finish(branches& node, value& result) {
+                result = out.add(
+                    {flat::kind::conditional,
+                     {},
+                     node.condition,
+                     node.yes,
+                     node.no});
+            }
+
+            void
+            constant(value& result, uint number) {
+                result = out.add({flat::kind::constant, {}, number, 0, 0});
+            }
+
+            void
+            variable(value& result, std::uint32_t slot) {
+                result = out.add({flat::kind::variable, {}, slot, 0, 0});
+            }
+
+        private:
+            flat::tree& out;
+        };
+
+        template <typename Builder>
+        class parser {
+        public:
+            typedef typename Builder::value value;
+
+            parser(
+                Builder& builder,
+                std::string const& text,
+                std::size_t& offset,
+                std::string& expected)
+                : builder(builder),
+                  text(text),
+                  offset(offset),
+                  expected(expected) {}
+
+            bool
+            parse(value& out) {
+                switch (expression(out)) {
+                case result::match: break;
+                case result::no_match: fail(0, "expression"); return false;
+                case result::error: return false;
+                }
+                const std::size_t end{skip()};
+                if (end != text.size()) {
+                    fail(end, "end of input");
+                    return false;
+                }
+                return true;
+            }
+
+        private:
+            static bool
+            is_space(char c) {
+                return c == ' ' || (c >= '\t' && c <= '\r');
+            }
+
+            static bool
+            is_alpha(char c) {
+                return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+            }
+
+            static bool
+            is_digit(char c) {
+                return c >= '0' && c <= '9';
+            }
+
+            result
+            fail(std::size_t at, std::string const& what) {
+                offset = at;
+                expected = what;
+                return result::error;
+            }
+
+            std::size_t
+            skip() const {
+                std::size_t next{pos};
+                while (next < text.size() && is_space(text[next])) {
+                    ++next;
+                }
+                return next;
+            }
+
+            bool
+            accept(char c) {
+                const std::size_t next{skip()};
+                if (next < text.size() && text[next] == c) {
+                    pos = next + 1;
+                    return true;
+                }
+                return false;
+            }
+
+            // A missing character is reported after the spaces before it.
+            bool
+            expect(char c) {
+                if (accept(c)) {
+                    return true;
+                }
+                const char quoted[] = {'\'', c, '\'', '\0'};
+                fail(skip(), quoted);
+                return false;
+            }
+
+            // A missing rule is reported right after the previous token.
+            bool
+            expect_expression(value& out) {
+                const std::size_t before{pos};
+                switch (expression(out)) {
+                case result::match: return true;
+                case result::no_match: fail(before, "expression"); break;
+                case result::error: break;
+                }
+                return false;
+            }
+
+            // Parses `parse` one level deeper, failing past scan::max_depth
+            // so that no input can exhaust the stack.
+            template <typename Parse>
+            result
+            nested(Parse const& parse) {
+                if (depth == scan::max_depth) {
+                    return fail(skip(), "nesting depth");
+                }
+                ++depth;
+                const result status{parse()};
+                --depth;
+                return status;
+            }
+
+            result
+            expression(value& out) {
+                return nested([&] { return conditional(out); });
+            }
+
+            result
+            conditional(value& out) {
+                result status{operators(level::logical, out)};
+                if (status != result::match || !accept('?')) {
+                    return status;
+                }
+                typename Builder::branches node{builder.conditional(out)};
+                if (!expect_expression(builder.if_true(node)) ||
+                    !expect(':') ||
+                    !expect_expression(builder.if_false(node))) {
+                    return result::error;
+                }
+                builder.finish(node, out);
+                return result::match;
+            }
+
+            // Matches the longest operator of level `at` at `next` and
+            // returns its length, or 0.
+            std::size_t
+            match_operator(
+                level at, std::size_t next, ast::binary_operator& op) const {
+                const char first{next < text.size() ? text[next] : '\0'};
+                const char second{
+                    next + 1 < text.size() ? text[next + 1] : '\0'};
+                switch (at) {
+                case level::logical:
+                    if (first == '&' && second == '&') {
+                        op = {ast::optoken::logical_and};
+                        return 2;
+                    }
+                    if (first == '|' && second == '|') {
+                        op = {ast::optoken::logical_or};
+                        return 2;
+                    }
+                    return 0;
+                case level::equality:
+                    if (first == '=' && second == '=') {
+                        op = {ast::optoken::equal};
+                        return 2;
+                    }
+                    if (first == '!' && second == '=') {
+                        op = {ast::optoken::not_equal};
+                        return 2;
+                    }
+                    return 0;
+                case level::relational:
+                    if (first == '<' || first == '>') {
+                        const bool inclusive{second == '='};
+                        op = {first == '<'
+                                  ? (inclusive ? ast::optoken::less_equal
+                                               : ast::optoken::less)
+                                  : (inclusive ? ast::optoken::greater_equal
+                                               : ast::optoken::greater)};
+                        return inclusive ? 2 : 1;
+                    }
+                    return 0;
+                case level::multiplicative:
+                    if (first == '%') {
+                        op = {ast::optoken::mod};
+                        return 1;
+                    }
+                    return 0;
+                }
+                return 0;
+            }
+
+            result
+            operand(level at, value& out) {
+                if (at == level::multiplicative) {
+                    return primary(out);
+                }
+                return operators(
+                    static_cast<level>(static_cast<int>(at) + 1), out);
+            }
+
+            // One precedence level: an operand of the next level followed
+            // by any number of operators of this one. && and || take the
+            // whole rest of the level as their right-hand side, as in the
+            // X3 grammar.
+            result
+            operators(level at, value& out) {
+                typename Builder::chain node{builder.begin(out)};
+                result status{operand(at, builder.first(node))};
+                if (status != result::match) {
+                    return status;
+                }
+                for (;;) {
+                    ast::binary_operator op;
+                    const std::size_t next{skip()};
+                    const std::size_t length{match_operator(at, next, op)};
+                    if (!length) {
+                        builder.finish(node, out);
+                        return result::match;
+                    }
+                    pos = next + length;
+                    const std::size_t before{pos};
+                    value& rhs{builder.next(node, op)};
+                    status = at == level::logical
+                                 ? nested([&] {
+                                       return operators(level::logical, rhs);
+                                   })
+                                 : operand(at, rhs);
+                    if (status == result::no_match) {
+                        return fail(before, rule_name(at));
+                    }
+                    if (status == result::error) {
+                        return status;
+                    }
+                    builder.combine(node);
+                }
+            }
+
+            result
+            primary(value& out) {
+                const std::size_t next{skip()};
+                if (next == text.size()) {
+                    return result::no_match;
+                }
+                const char first{text[next]};
+                if (is_digit(first)) {
+                    std::uint64_t number = 0;
+                    std::size_t end{next};
+                    while (end < text.size() && is_digit(text[end])) {
+                        number = number * 10 + (text[end++] - '0');
+                        if (number > 0xFFFFFFFF) {
+                            return result::no_match;
+                        }
+                    }
+                    pos = end;
+                    builder.constant(out, static_cast<uint>(number));
+                    return result::match;
+                }
+                if (first == '(') {
+                    pos = next + 1;
+                    if (!expect_expression(out) || !expect(')')) {
+                        return result::error;
+                    }
+                    return result::match;
+                }
+                if (is_alpha(first)) {
+                    std::size_t end{next + 1};
+                    while (end < text.size() &&
+                           (is_alpha(text[end]) || is_digit(text[end]))) {
+                        ++end;
+                    }
+                    std::uint32_t slot = 0;
+                    if (!ast::find_variable(
+                            std::string_view(text).substr(next, end - next),
+                            slot)) {
+                        return fail(next, ast::expected_variable());
+                    }
+                    pos = end;
+                    builder.variable(out, slot);
+                    return result::match;
+                }
+                return result::no_match;
+            }
+
+            Builder& builder;
+            std::string const& text;
+            std::size_t& offset;
+            std::string& expected;
+            // Just past the last token consumed, before any spaces.
+            std::size_t pos = 0;
+            // Conditionals, parentheses and logical operators open.
+            std::size_t depth = 0;
+        };
+    } // namespace
+
+    bool
+    parse(
+        std::string const& text,
+        ast::operand& out,
+        std::size_t& offset,
+        std::string& expected) {
+        tree_builder builder;
+        return parser<tree_builder>{builder, text, offset, expected}.parse(
+            out);
+    }
+
+    bool
+    parse(
+        std::string const& text,
+        flat::tree& out,
+        std::size_t& offset,
+        std::string& expected) {
+        out.clear();
+        out.reserve(text.size());
+        flat_builder builder{out};
+        std::uint32_t root = 0;
+        if (!parser<flat_builder>{builder, text, offset, expected}.parse(
+                root)) {
+            return false;
+        }
+        out.set_root(root);
+        return true;
+    }
+
+} // namespace pratt
+} // namespace client
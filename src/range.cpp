@@ -0,0 +1,734 @@
+#include <algorithm>
+#include <list>
+#include <map>
+#include <set>
+#include <sstream>
+#include <tuple>
+
+#include "range.hpp"
+
+namespace client {
+namespace range {
+    namespace {
+        typedef std::uint64_t u64;
+
+        constexpr u64 largest = 0xFFFFFFFF;
+        // Most residue classes a set of n is split into at once.
+        constexpr u64 max_split = 100;
+        // Most result values merged into runs one by one.
+        constexpr u64 max_listed = 1 << 16;
+
+        u64
+        gcd(u64 a, u64 b) {
+            while (b) {
+                const u64 t = a % b;
+                a = b;
+                b = t;
+            }
+            return a;
+        }
+
+        // The possible values of a subexpression over a set of n. When
+        // `exact`, it takes every one of them for some n in the set.
+        struct value {
+            u64 first;
+            u64 last;
+            u64 step;
+            bool exact;
+
+            bool
+            single() const {
+                return first == last;
+            }
+        };
+
+        value
+        constant(u64 number) {
+            return {number, number, 0, true};
+        }
+
+        // The values in [first, last] congruent to `residue` modulo
+        // `modulus`; false if there are none.
+        bool
+        normalize(
+            u64 first,
+            u64 last,
+            u64 modulus,
+            u64 residue,
+            bool exact,
+            value& out) {
+            first += (residue + modulus - first % modulus) % modulus;
+            if (first > last) {
+                return false;
+            }
+            last -= (last % modulus + modulus - residue) % modulus;
+            out = {first, last, first == last ? 0 : modulus, exact};
+            return true;
+        }
+
+        value
+        join(value const& a, value const& b) {
+            const u64 difference{a.first > b.first ? a.first - b.first
+                                                   : b.first - a.first};
+            const value out{
+                std::min(a.first, b.first),
+                std::max(a.last, b.last),
+                gcd(gcd(a.step, b.step), difference),
+                false};
+            const bool same{
+                a.first == b.first && a.last == b.last && a.step == b.step};
+            return {out.first, out.last, out.step, same && a.exact && b.exact};
+        }
+
+        enum class truth : std::uint8_t { no, yes, maybe };
+
+        truth
+        test(value const& x) {
+            if (x.last == 0) {
+                return truth::no;
+            }
+            return x.first > 0 ? truth::yes : truth::maybe;
+        }
+
+        value
+        boolean(truth t) {
+            switch (t) {
+            case truth::no: return constant(0);
+            case truth::yes: return constant(1);
+            case truth::maybe: break;
+            }
+            return {0, 1, 1, false};
+        }
+
+        truth
+        negate(truth t) {
+            switch (t) {
+            case truth::no: return truth::yes;
+            case truth::yes: return truth::no;
+            case truth::maybe: break;
+            }
+            return t;
+        }
+
+        truth
+        less(value const& x, value const& y, bool inclusive) {
+            if (inclusive ? x.last <= y.first : x.last < y.first) {
+                return truth::yes;
+            }
+            if (inclusive ? x.first > y.last : x.first >= y.last) {
+                return truth::no;
+            }
+            return truth::maybe;
+        }
+
+        truth
+        equal(value const& x, value const& y) {
+            if (x.single() && y.single() && x.first == y.first) {
+                return truth::yes;
+            }
+            if (x.last < y.first || y.last < x.first) {
+                return truth::no;
+            }
+            const u64 common{gcd(x.step, y.step)};
+            if (common && x.first % common != y.first % common) {
+                return truth::no;
+            }
+            return truth::maybe;
+        }
+
+        truth
+        compare(ast::optoken code, value const& x, value const& y) {
+            switch (code) {
+            case ast::optoken::less: return less(x, y, false);
+            case ast::optoken::less_equal: return less(x, y, true);
+            case ast::optoken::greater: return less(y, x, false);
+            case ast::optoken::greater_equal: return less(y, x, true);
+            case ast::optoken::equal: return equal(x, y);
+            case ast::optoken::not_equal: return negate(equal(x, y));
+            default: break;
+            }
+            return truth::maybe;
+        }
+
+        // x % divisor for a constant divisor > 0.
+        value
+        modulo(value const& x, u64 divisor) {
+            if (x.last < divisor) {
+                return x;
+            }
+            if (x.single() || x.step % divisor == 0) {
+                return constant(x.first % divisor);
+            }
+            if (x.first / divisor == x.last / divisor) {
+                return {x.first % divisor, x.last % divisor, x.step, x.exact};
+            }
+            // Every remainder congruent to first modulo the common divisor
+            // occurs once x runs through a whole period of both.
+            const u64 common{gcd(x.step, divisor)};
+            const bool whole{(x.last - x.first) / x.step + 1 >=
+                             divisor / common};
+            const u64 residue{x.first % common};
+            value out;
+            normalize(0, divisor - 1, common, residue, x.exact && whole, out);
+            return out;
+        }
+
+        bool
+        is_variable(ast::operand const& ast) {
+            return boost::get<ast::variable>(&ast.get()) != nullptr;
+        }
+
+        // Where to split a set of n so that an undecided test is decided:
+        // the moduli the test uses and the constants it compares n with.
+        struct hint {
+            std::vector<u64> moduli;
+            std::vector<u64> cuts;
+
+            bool
+            empty() const {
+                return moduli.empty() && cuts.empty();
+            }
+        };
+
+        struct scanner {
+            typedef void result_type;
+
+            hint& out;
+
+            result_type
+            operator()(ast::operand const& ast) {
+                boost::apply_visitor(*this, ast.get());
+            }
+
+            result_type
+            operator()(ast::nil) {}
+
+            result_type
+            operator()(uint) {}
+
+            result_type
+            operator()(ast::variable const&) {}
+
+            result_type
+            operator()(ast::expression const& ast) {
+                links(ast, ast.rhs.begin(), ast.rhs.end());
+            }
+
+            // The operations of `ast` from `first` up to `last`, and its
+            // lhs when `first` is the first of them.
+            void
+            links(
+                ast::expression const& ast,
+                std::list<ast::operation>::const_iterator first,
+                std::list<ast::operation>::const_iterator last) {
+                ast::operand const* left{nullptr};
+                if (first == ast.rhs.begin()) {
+                    (*this)(ast.lhs);
+                    left = &ast.lhs;
+                }
+                for (; first != last; ++first) {
+                    pair(first->op, left, first->rhs);
+                    (*this)(first->rhs);
+                    left = nullptr;
+                }
+            }
+
+            result_type
+            operator()(ast::binary_op const& ast) {
+                pair(ast.op, &ast.lhs, ast.rhs);
+                (*this)(ast.lhs);
+                (*this)(ast.rhs);
+            }
+
+            result_type
+            operator()(ast::conditional_op const& ast) {
+                truth_of(ast.lhs);
+                (*this)(ast.lhs);
+                (*this)(ast.rhs_true);
+                (*this)(ast.rhs_false);
+            }
+
+            // `left op right`, where left is null for an operation chain.
+            void
+            pair(
+                ast::binary_operator op,
+                ast::operand const* left,
+                ast::operand const& right) {
+                uint const* rhs{boost::get<uint>(&right.get())};
+                uint const* lhs{left ? boost::get<uint>(&left->get())
+                                     : nullptr};
+                switch (op.code) {
+                case ast::optoken::mod:
+                    if (rhs && *rhs) {
+                        out.moduli.push_back(*rhs);
+                    }
+                    return;
+                case ast::optoken::logical_and:
+                case ast::optoken::logical_or:
+                    if (left) {
+                        truth_of(*left);
+                    }
+                    truth_of(right);
+                    return;
+                default: break;
+                }
+                if (left && is_variable(*left) && rhs) {
+                    cut(*rhs);
+                } else if (lhs && is_variable(right)) {
+                    cut(*lhs);
+                }
+            }
+
+            // A bare n used as a truth value is compared with 0.
+            void
+            truth_of(ast::operand const& ast) {
+                if (is_variable(ast)) {
+                    cut(0);
+                }
+            }
+
+            void
+            cut(u64 at) {
+                out.cuts.push_back(at);
+                out.cuts.push_back(at + 1);
+            }
+        };
+
+        enum flag : std::uint8_t {
+            taken_true = 1,
+            taken_false = 2,
+            zero_divisor = 4,
+            maybe_zero_divisor = 8,
+        };
+
+        struct mark {
+            void const* node;
+            flag what;
+        };
+
+        // Evaluates a rule over one set of n.
+        class interpreter {
+        public:
+            typedef value result_type;
+
+            explicit interpreter(value const& n) : n(n) {}
+
+            result_type
+            operator()(ast::operand const& ast) {
+                return boost::apply_visitor(*this, ast.get());
+            }
+
+            result_type
+            operator()(ast::nil) {
+                return constant(0);
+            }
+
+            result_type
+            operator()(uint number) {
+                return constant(number);
+            }
+
+            result_type
+            operator()(ast::variable const&) {
+                return n;
+            }
+
+            result_type
+            operator()(ast::expression const& ast) {
+                value state{(*this)(ast.lhs)};
+                // The operations before `barren`, and the lhs, were scanned
+                // and hold no hints, so a long chain is not scanned again
+                // for each undecided test in it.
+                auto barren = ast.rhs.begin();
+                for (auto at = ast.rhs.begin(); at != ast.rhs.end(); ++at) {
+                    auto left = [&ast, &barren, at](scanner& scan) {
+                        scan.links(ast, barren, at);
+                        if (scan.out.empty()) {
+                            barren = at;
+                        }
+                    };
+                    state = combine(
+                        at->op,
+                        state,
+                        at == ast.rhs.begin() ? &ast.lhs : nullptr,
+                        left,
+                        at->rhs,
+                        &*at);
+                }
+                return state;
+            }
+
+            result_type
+            operator()(ast::binary_op const& ast) {
+                auto left = [&ast](scanner& scan) { scan(ast.lhs); };
+                return combine(
+                    ast.op, (*this)(ast.lhs), &ast.lhs, left, ast.rhs, &ast);
+            }
+
+            result_type
+            operator()(ast::conditional_op const& ast) {
+                const truth t{test((*this)(ast.lhs))};
+                if (t != truth::no) {
+                    marks.push_back({&ast, taken_true});
+                }
+                if (t != truth::yes) {
+                    marks.push_back({&ast, taken_false});
+                }
+                switch (t) {
+                case truth::yes: return (*this)(ast.rhs_true);
+                case truth::no: return (*this)(ast.rhs_false);
+                case truth::maybe: break;
+                }
+                defer([&ast](scanner& scan) {
+                    scan.truth_of(ast.lhs);
+                    scan(ast.lhs);
+                });
+                const value yes{(*this)(ast.rhs_true)};
+                return join(yes, (*this)(ast.rhs_false));
+            }
+
+            bool undecided = false;
+            // Filled in for the first undecided test.
+            hint split;
+            std::vector<mark> marks;
+
+        private:
+            template <typename Scan>
+            void
+            defer(Scan const& scan) {
+                undecided = true;
+                if (split.empty()) {
+                    scanner scanning{split};
+                    scan(scanning);
+                }
+            }
+
+            template <typename Left>
+            value
+            combine(
+                ast::binary_operator op,
+                value const& lhs,
+                ast::operand const* left,
+                Left const& scan_left,
+                ast::operand const& right,
+                void const* node) {
+                auto scan_pair = [&](scanner& scan) {
+                    scan_left(scan);
+                    scan.pair(op, left, right);
+                    scan(right);
+                };
+                switch (op.code) {
+                case ast::optoken::logical_and:
+                case ast::optoken::logical_or: {
+                    const truth settled{
+                        op.code == ast::optoken::logical_and ? truth::no
+                                                             : truth::yes};
+                    const truth a{test(lhs)};
+                    if (a == settled) {
+                        return boolean(settled);
+                    }
+                    if (a == truth::maybe) {
+                        defer(scan_pair);
+                    }
+                    const truth b{test((*this)(right))};
+                    if (b == truth::maybe) {
+                        defer(scan_pair);
+                    }
+                    if (a == truth::maybe && b != settled) {
+                        return boolean(truth::maybe);
+                    }
+                    return boolean(b);
+                }
+                case ast::optoken::mod: {
+                    const value rhs{(*this)(right)};
+                    if (rhs.single()) {
+                        if (rhs.first == 0) {
+                            marks.push_back({node, zero_divisor});
+                            return constant(0);
+                        }
+                        return modulo(lhs, rhs.first);
+                    }
+                    if (rhs.first == 0) {
+                        marks.push_back({node, maybe_zero_divisor});
+                        defer([&](scanner& scan) {
+                            scan.truth_of(right);
+                            scan(right);
+                        });
+                    }
+                    if (lhs.last < rhs.first) {
+                        return lhs;
+                    }
+                    const u64 last{std::min(lhs.last, rhs.last - 1)};
+                    return {0, last, last ? 1u : 0u, false};
+                }
+                default: {
+                    const truth t{compare(op.code, lhs, (*this)(right))};
+                    if (t == truth::maybe) {
+                        defer(scan_pair);
+                    }
+                    return boolean(t);
+                }
+                }
+            }
+
+            value n;
+        };
+
+        // Splits `region` in a way that should decide the test `split`
+        // came from: by residue for a modulus the region's step does not
+        // settle, else at a constant compared with n, else in halves.
+        void
+        divide(
+            value const& region,
+            hint const& split,
+            std::vector<value>& pending) {
+            const u64 step{region.step};
+            value part;
+            for (u64 modulus : split.moduli) {
+                if (step % modulus == 0) {
+                    continue;
+                }
+                const u64 ratio{modulus / gcd(step, modulus)};
+                u64 count{std::min(ratio, max_split)};
+                while (ratio % count) {
+                    --count;
+                }
+                if (count == 1) {
+                    for (count = 2; ratio % count; ++count) {
+                    }
+                }
+                for (u64 idx = 0; idx < count; ++idx) {
+                    if (normalize(
+                            region.first,
+                            region.last,
+                            step * count,
+                            (region.first + idx * step) % (step * count),
+                            true,
+                            part)) {
+                        pending.push_back(part);
+                    }
+                }
+                return;
+            }
+            u64 at{region.first + (region.last - region.first) / step / 2 *
+                                      step +
+                   step};
+            for (u64 cut : split.cuts) {
+                if (cut > region.first && cut <= region.last) {
+                    at = cut;
+                    break;
+                }
+            }
+            const u64 residue{region.first % step};
+            if (normalize(region.first, at - 1, step, residue, true, part)) {
+                pending.push_back(part);
+            }
+            if (normalize(at, region.last, step, residue, true, part)) {
+                pending.push_back(part);
+            }
+        }
+
+        // Lists what the marks found, walking the rule in source order.
+        struct describer {
+            typedef void result_type;
+
+            std::map<void const*, std::uint8_t> const& flags;
+            std::map<void const*, u64> const& witnesses;
+            report& out;
+
+            std::uint8_t
+            flags_of(void const* node) const {
+                auto found = flags.find(node);
+                return found == flags.end() ? 0 : found->second;
+            }
+
+            result_type
+            operator()(ast::operand const& ast) {
+                boost::apply_visitor(*this, ast.get());
+            }
+
+            result_type
+            operator()(ast::nil) {}
+
+            result_type
+            operator()(uint) {}
+
+            result_type
+            operator()(ast::variable const&) {}
+
+            result_type
+            operator()(ast::expression const& ast) {
+                std::ostringstream prefix;
+                ast::printer print{prefix};
+                print(ast.lhs);
+                (*this)(ast.lhs);
+                bool chained{false};
+                for (ast::operation const& op : ast.rhs) {
+                    // Only a reported division copies the text before it.
+                    if (op.op.code == ast::optoken::mod &&
+                        flags_of(&op) & (zero_divisor | maybe_zero_divisor)) {
+                        std::string const left{
+                            chained ? '(' + prefix.str() + ')'
+                                    : prefix.str()};
+                        division_at(
+                            &op, left + " % " + ast::to_string(op.rhs));
+                    }
+                    prefix << ' ' << op.op.name() << ' ';
+                    print(op.rhs);
+                    (*this)(op.rhs);
+                    chained = true;
+                }
+            }
+
+            result_type
+            operator()(ast::binary_op const& ast) {
+                if (ast.op.code == ast::optoken::mod) {
+                    std::ostringstream text;
+                    ast::printer{text}(ast);
+                    division_at(&ast, text.str());
+                }
+                (*this)(ast.lhs);
+                (*this)(ast.rhs);
+            }
+
+            result_type
+            operator()(ast::conditional_op const& ast) {
+                const std::uint8_t taken{flags_of(&ast)};
+                (*this)(ast.lhs);
+                if (!(taken & (taken_true | taken_false))) {
+                    return;
+                }
+                const std::string condition{ast::to_string(ast.lhs)};
+                if (taken & taken_true) {
+                    (*this)(ast.rhs_true);
+                } else {
+                    out.unreachable.push_back(
+                        {condition, true, ast::to_string(ast.rhs_true)});
+                }
+                if (taken & taken_false) {
+                    (*this)(ast.rhs_false);
+                } else {
+                    out.unreachable.push_back(
+                        {condition, false, ast::to_string(ast.rhs_false)});
+                }
+            }
+
+            void
+            division_at(void const* node, std::string const& text) {
+                const std::uint8_t found{flags_of(node)};
+                if (found & zero_divisor) {
+                    out.divisions.push_back(
+                        {text, true, witnesses.find(node)->second});
+                } else if (found & maybe_zero_divisor) {
+                    out.divisions.push_back({text, false, 0});
+                }
+            }
+        };
+    } // namespace
+
+    report
+    analyze(ast::operand const& ast) {
+        report out;
+        std::map<void const*, std::uint8_t> flags;
+        std::map<void const*, u64> witnesses;
+        std::map<u64, u64> singles;
+        std::vector<progression> ranges;
+
+        std::vector<value> pending{{0, largest, 1, true}};
+        while (!pending.empty()) {
+            const value region{pending.back()};
+            pending.pop_back();
+            ++out.regions;
+
+            interpreter run{region};
+            const value result{run(ast)};
+            const bool settled{!run.undecided && result.exact};
+            if (!settled && !region.single() &&
+                out.regions < max_regions) {
+                if (run.split.empty()) {
+                    scanner{run.split}(ast);
+                }
+                divide(region, run.split, pending);
+                continue;
+            }
+
+            out.exact &= settled;
+            for (mark const& found : run.marks) {
+                flag what{found.what};
+                // Not every test on the way was decided.
+                if (what == zero_divisor && !settled) {
+                    what = maybe_zero_divisor;
+                }
+                flags[found.node] |= what;
+                if (what == zero_divisor) {
+                    auto seen = witnesses.emplace(found.node, region.first);
+                    seen.first->second =
+                        std::min(seen.first->second, region.first);
+                }
+            }
+            if (result.single()) {
+                auto seen = singles.emplace(result.first, region.first);
+                seen.first->second =
+                    std::min(seen.first->second, region.first);
+            } else {
+                ranges.push_back({result.first, result.last, result.step});
+            }
+        }
+
+        for (auto const& found : singles) {
+            out.samples.push_back({found.first, found.second});
+        }
+        // Few enough values are listed one by one, so that overlapping
+        // progressions found in different sets of n merge.
+        std::set<u64> listed;
+        u64 count{singles.size()};
+        for (progression const& run : ranges) {
+            count += (run.last - run.first) / run.step + 1;
+        }
+        if (count <= max_listed) {
+            for (auto const& found : singles) {
+                listed.insert(found.first);
+            }
+            for (progression const& run : ranges) {
+                for (u64 at = run.first; at <= run.last; at += run.step) {
+                    listed.insert(at);
+                }
+            }
+            ranges.clear();
+        } else {
+            for (auto const& found : singles) {
+                listed.insert(found.first);
+            }
+        }
+        // Runs of consecutive values become one progression.
+        for (auto at = listed.begin(); at != listed.end();) {
+            const u64 first{*at};
+            u64 last{first};
+            for (++at; at != listed.end() && *at == last + 1; ++at) {
+                ++last;
+            }
+            ranges.push_back({first, last, first == last ? 0u : 1u});
+        }
+        std::sort(
+            ranges.begin(),
+            ranges.end(),
+            [](progression const& a, progression const& b) {
+                return std::tie(a.first, a.last, a.step) <
+                       std::tie(b.first, b.last, b.step);
+            });
+        for (progression const& next : ranges) {
+            progression const* last{
+                out.values.empty() ? nullptr : &out.values.back()};
+            if (!last || last->first != next.first ||
+                last->last != next.last || last->step != next.step) {
+                out.values.push_back(next);
+                out.max = std::max(out.max, next.last);
+            }
+        }
+
+        describer{flags, witnesses, out}(ast);
+        return out;
+    }
+
+} // namespace range
+} // namespace client
@@ -0,0 +1,95 @@
+#include <cstdint>
+
+#include "scan.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace client {
+namespace scan {
+    namespace {
+        std::size_t
+        first_invalid_scalar(
+            char const* text, std::size_t first, std::size_t size) {
+            while (first < size && allowed(text[first])) {
+                ++first;
+            }
+            return first;
+        }
+
+#if defined(__SSE2__)
+        // All-ones in the lanes of `bytes` that lie in [low, high]: after
+        // subtracting `low`, a lane is in range iff it is no greater than
+        // high - low as an unsigned byte.
+        inline __m128i
+        in_range(__m128i bytes, char low, char high) {
+            const __m128i shifted{_mm_sub_epi8(bytes, _mm_set1_epi8(low))};
+            const __m128i limit{_mm_set1_epi8(static_cast<char>(high - low))};
+            return _mm_cmpeq_epi8(_mm_min_epu8(shifted, limit), shifted);
+        }
+
+        inline __m128i
+        equal(__m128i bytes, char value) {
+            return _mm_cmpeq_epi8(bytes, _mm_set1_epi8(value));
+        }
+#endif
+    } // namespace
+
+    std::size_t
+    first_invalid(char const* text, std::size_t size) noexcept {
+        std::size_t idx = 0;
+#if defined(__SSE2__)
+        for (; idx + 16 <= size; idx += 16) {
+            const __m128i bytes{_mm_loadu_si128(
+                reinterpret_cast<__m128i const*>(text + idx))};
+            __m128i ok{in_range(bytes, '0', ':')};
+            ok = _mm_or_si128(ok, in_range(bytes, 'a', 'z'));
+            ok = _mm_or_si128(ok, in_range(bytes, 'A', 'Z'));
+            ok = _mm_or_si128(ok, in_range(bytes, '\t', '\r'));
+            ok = _mm_or_si128(ok, in_range(bytes, '<', '?'));
+            ok = _mm_or_si128(ok, in_range(bytes, ' ', '!'));
+            ok = _mm_or_si128(ok, in_range(bytes, '%', '&'));
+            ok = _mm_or_si128(ok, in_range(bytes, '(', ')'));
+            ok = _mm_or_si128(ok, equal(bytes, '|'));
+            const int mask{_mm_movemask_epi8(ok)};
+            if (mask != 0xFFFF) {
+                return idx + __builtin_ctz(~mask);
+            }
+        }
+#endif
+        return first_invalid_scalar(text, idx, size);
+    }
+
+    std::size_t
+    too_deep(char const* text, std::size_t size) noexcept {
+        // The depth at each open parenthesis, to restore at its close.
+        std::uint16_t opened[max_depth];
+        std::size_t parentheses = 0;
+        std::size_t depth = 1;
+        for (std::size_t idx = 0; idx < size; ++idx) {
+            const char c{text[idx]};
+            if (c == ')') {
+                if (parentheses) {
+                    depth = opened[--parentheses];
+                }
+                continue;
+            }
+            if (c == '(') {
+                opened[parentheses++] = static_cast<std::uint16_t>(depth);
+            } else if (
+                (c == '&' || c == '|') && idx + 1 < size &&
+                text[idx + 1] == c) {
+                ++idx;
+            } else if (c != '?') {
+                continue;
+            }
+            if (++depth > max_depth) {
+                return c == '(' || c == '?' ? idx : idx - 1;
+            }
+        }
+        return size;
+    }
+
+} // namespace scan
+} // namespace client
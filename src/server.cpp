@@ -0,0 +1,744 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "pluralsparser.h"
+#include "server.hpp"
+
+namespace client {
+namespace server {
+    namespace {
+        // Responses a connection may have queued before the daemon stops
+        // reading its requests.
+        constexpr std::size_t max_backlog = 1 << 24;
+        constexpr std::size_t read_size = 1 << 16;
+        // Bytes taken from one connection per wakeup; epoll is level
+        // triggered, so the rest waits for the next round.
+        constexpr std::size_t max_read = 16 * read_size;
+        constexpr int max_events = 64;
+        // Milliseconds to stop accepting after running out of descriptors.
+        constexpr int accept_pause = 100;
+
+        std::string
+        system_error(char const* what) {
+            return std::string(what) + ": " + std::strerror(errno);
+        }
+
+        void
+        notify(int fd) {
+            const std::uint64_t one{1};
+            while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+            }
+        }
+
+        void
+        drain(int fd) {
+            std::uint64_t count;
+            while (read(fd, &count, sizeof(count)) > 0) {
+            }
+        }
+
+        bool
+        make_address(
+            std::string const& path, sockaddr_un& address, std::string& error) {
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+                error = "socket path is empty or too long";
+                return false;
+            }
+            std::memcpy(address.sun_path, path.data(), path.size());
+            return true;
+        }
+
+        void
+        fail(std::string& out, std::string const& message) {
+            protocol::put_frame(
+                out,
+                static_cast<std::uint8_t>(protocol::status::error),
+                message);
+        }
+    } // namespace
+
+    // Rules registered by any connection. Ids index a fixed array that is
+    // only appended to, so lookups take no lock.
+    class registry {
+    public:
+        static constexpr std::size_t capacity = 1 << 16;
+
+        registry() : rules(new pluralsparser_rule*[capacity]) {}
+
+        ~registry() {
+            for (std::uint32_t idx = 0; idx < size.load(); ++idx) {
+                pluralsparser_free(rules[idx]);
+            }
+        }
+
+        bool
+        add(std::string const& text, std::uint32_t& id, std::string& error) {
+            if (text.find('\0') != std::string::npos) {
+                error = "expression contains a NUL byte";
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = ids.find(text);
+            if (found != ids.end()) {
+                id = found->second;
+                return true;
+            }
+            const std::uint32_t next{size.load(std::memory_order_relaxed)};
+            if (next == capacity) {
+                error = "too many rules";
+                return false;
+            }
+            char message[256];
+            pluralsparser_rule* rule{
+                pluralsparser_compile(text.c_str(), message, sizeof(message))};
+            if (!rule) {
+                error = message;
+                return false;
+            }
+            rules[next] = rule;
+            ids.emplace(text, next);
+            size.store(next + 1, std::memory_order_release);
+            id = next;
+            return true;
+        }
+
+        // nullptr for an unknown id.
+        pluralsparser_rule const*
+        get(std::uint32_t id) const {
+            return id < size.load(std::memory_order_acquire) ? rules[id]
+                                                             : nullptr;
+        }
+
+    private:
+        std::mutex mutex;
+        std::unordered_map<std::string, std::uint32_t> ids;
+        std::unique_ptr<pluralsparser_rule*[]> rules;
+        std::atomic<std::uint32_t> size{0};
+    };
+
+    class worker {
+    public:
+        explicit worker(registry& rules) : rules(rules) {}
+
+        ~worker() {
+            for (auto& entry : sessions) {
+                ::close(entry.first);
+            }
+            for (int fd : incoming) {
+                ::close(fd);
+            }
+            if (epoll >= 0) {
+                ::close(epoll);
+            }
+            if (wake >= 0) {
+                ::close(wake);
+            }
+        }
+
+        bool
+        start(std::string& error) {
+            epoll = epoll_create1(EPOLL_CLOEXEC);
+            wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (epoll < 0 || wake < 0) {
+                error = system_error("epoll");
+                return false;
+            }
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.ptr = nullptr;
+            if (epoll_ctl(epoll, EPOLL_CTL_ADD, wake, &event) != 0) {
+                error = system_error("epoll_ctl");
+                return false;
+            }
+            thread = std::thread(&worker::run, this);
+            return true;
+        }
+
+        // Takes ownership of a connected socket.
+        void
+        adopt(int fd) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                incoming.push_back(fd);
+            }
+            notify(wake);
+        }
+
+        void
+        stop() {
+            stopping.store(true, std::memory_order_release);
+            notify(wake);
+        }
+
+        void
+        join() {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+
+    private:
+        struct session {
+            explicit session(int fd) : fd(fd) {}
+
+            int fd;
+            std::string in;
+            std::string out;
+            std::size_t sent = 0;
+            std::uint32_t events = 0;
+            // The peer has shut down its side; close once `out` is sent.
+            bool closing = false;
+
+            std::size_t
+            backlog() const {
+                return out.size() - sent;
+            }
+        };
+
+        void
+        run() {
+            epoll_event events[max_events];
+            while (!stopping.load(std::memory_order_acquire)) {
+                const int count{epoll_wait(epoll, events, max_events, -1)};
+                if (count < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                for (int idx = 0; idx < count; ++idx) {
+                    session* peer = static_cast<session*>(events[idx].data.ptr);
+                    if (!peer) {
+                        drain(wake);
+                        adopt_incoming();
+                    } else if (!service(*peer, events[idx].events)) {
+                        close(peer);
+                    }
+                }
+            }
+        }
+
+        void
+        adopt_incoming() {
+            std::vector<int> fds;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                fds.swap(incoming);
+            }
+            for (int fd : fds) {
+                std::unique_ptr<session> peer{new session(fd)};
+                peer->events = EPOLLIN | EPOLLRDHUP;
+                epoll_event event{};
+                event.events = peer->events;
+                event.data.ptr = peer.get();
+                if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+                    ::close(fd);
+                    continue;
+                }
+                sessions.emplace(fd, std::move(peer));
+            }
+        }
+
+        void
+        close(session* peer) {
+            epoll_ctl(epoll, EPOLL_CTL_DEL, peer->fd, nullptr);
+            ::close(peer->fd);
+            sessions.erase(peer->fd);
+        }
+
+        // Returns false when the connection should be closed.
+        bool
+        service(session& peer, std::uint32_t ready) {
+            if ((ready & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) &&
+                !peer.closing && !receive(peer)) {
+                return false;
+            }
+            do {
+                if (!process(peer) || !flush(peer)) {
+                    return false;
+                }
+            } while (peer.backlog() < max_backlog && complete(peer));
+
+            if (peer.closing && !peer.backlog()) {
+                return false;
+            }
+
+            // EPOLLRDHUP stays ready once the peer has shut down its side,
+            // so a closing session only waits to send what is left.
+            const std::uint32_t wanted{
+                peer.closing
+                    ? static_cast<std::uint32_t>(EPOLLOUT)
+                    : (peer.backlog() >= max_backlog ? 0u : EPOLLIN) |
+                          (peer.backlog() ? EPOLLOUT : 0u) | EPOLLRDHUP};
+            if (wanted != peer.events) {
+                peer.events = wanted;
+                epoll_event event{};
+                event.events = wanted;
+                event.data.ptr = &peer;
+                epoll_ctl(epoll, EPOLL_CTL_MOD, peer.fd, &event);
+            }
+            return true;
+        }
+
+        bool
+        receive(session& peer) {
+            char buffer[read_size];
+            for (std::size_t total = 0; total < max_read;) {
+                const ssize_t count{recv(peer.fd, buffer, sizeof(buffer), 0)};
+                if (count > 0) {
+                    peer.in.append(buffer, count);
+                    total += count;
+                    // Refuse an oversized frame before buffering its body.
+                    if (peer.in.size() >= 4 &&
+                        !framed(protocol::get_u32(peer.in.data()))) {
+                        return false;
+                    }
+                    continue;
+                }
+                if (count == 0) {
+                    peer.closing = true;
+                    return true;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            return true;
+        }
+
+        static bool
+        framed(std::uint32_t size) {
+            return size != 0 && size <= protocol::max_frame;
+        }
+
+        bool
+        complete(session const& peer) const {
+            return peer.in.size() >= 4 &&
+                   peer.in.size() - 4 >= protocol::get_u32(peer.in.data());
+        }
+
+        // Answers every complete request in `in`, in order.
+        bool
+        process(session& peer) {
+            std::size_t offset = 0;
+            while (peer.in.size() - offset >= 4 &&
+                   peer.backlog() < max_backlog) {
+                const std::uint32_t size{
+                    protocol::get_u32(peer.in.data() + offset)};
+                if (!framed(size)) {
+                    return false;
+                }
+                if (peer.in.size() - offset - 4 < size) {
+                    break;
+                }
+                respond(peer.out, peer.in.data() + offset + 4, size);
+                offset += 4 + size;
+            }
+            peer.in.erase(0, offset);
+            return true;
+        }
+
+        void
+        respond(std::string& out, char const* frame, std::size_t size) {
+            const auto code = static_cast<protocol::request>(frame[0]);
+            char const* body = frame + 1;
+            const std::size_t length{size - 1};
+            const auto ok = static_cast<std::uint8_t>(protocol::status::ok);
+
+            switch (code) {
+            case protocol::request::register_rule: {
+                std::uint32_t id;
+                std::string error;
+                if (!rules.add(std::string(body, length), id, error)) {
+                    return fail(out, error);
+                }
+                protocol::put_u32(out, 5);
+                out.push_back(ok);
+                protocol::put_u32(out, id);
+                return;
+            }
+            case protocol::request::evaluate: {
+                if (length != 8) {
+                    return fail(out, "malformed evaluate request");
+                }
+                pluralsparser_rule const* rule{
+                    rules.get(protocol::get_u32(body))};
+                if (!rule) {
+                    return fail(out, "unknown rule id");
+                }
+                protocol::put_u32(out, 5);
+                out.push_back(ok);
+                protocol::put_u32(
+                    out, pluralsparser_eval(rule, protocol::get_u32(body + 4)));
+                return;
+            }
+            case protocol::request::evaluate_batch: {
+                if (length < 4 || length % 4) {
+                    return fail(out, "malformed evaluate_batch request");
+                }
+                pluralsparser_rule const* rule{
+                    rules.get(protocol::get_u32(body))};
+                if (!rule) {
+                    return fail(out, "unknown rule id");
+                }
+                const std::size_t count{length / 4 - 1};
+                ns.resize(count);
+                results.resize(count);
+                for (std::size_t idx = 0; idx < count; ++idx) {
+                    ns[idx] = protocol::get_u32(body + 4 + 4 * idx);
+                }
+                pluralsparser_eval_batch(
+                    rule, ns.data(), results.data(), count);
+                protocol::put_u32(out, 1 + 4 * count);
+                out.push_back(ok);
+                for (std::uint32_t result : results) {
+                    protocol::put_u32(out, result);
+                }
+                return;
+            }
+            }
+            fail(out, "unknown request");
+        }
+
+        bool
+        flush(session& peer) {
+            while (peer.backlog()) {
+                const ssize_t count{send(
+                    peer.fd,
+                    peer.out.data() + peer.sent,
+                    peer.backlog(),
+                    MSG_NOSIGNAL)};
+                if (count < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return errno == EAGAIN || errno == EWOULDBLOCK;
+                }
+                peer.sent += count;
+            }
+            peer.out.clear();
+            peer.sent = 0;
+            return true;
+        }
+
+        registry& rules;
+        int epoll = -1;
+        int wake = -1;
+        std::thread thread;
+        std::mutex mutex;
+        std::vector<int> incoming;
+        std::atomic<bool> stopping{false};
+        std::unordered_map<int, std::unique_ptr<session>> sessions;
+        // Scratch space for batch requests.
+        std::vector<unsigned int> ns;
+        std::vector<unsigned int> results;
+    };
+
+    daemon::daemon() = default;
+
+    daemon::~daemon() {
+        stop();
+        wait();
+    }
+
+    bool
+    daemon::start(options const& config, std::string& error) {
+        sockaddr_un address;
+        if (!make_address(config.socket_path, address, error)) {
+            return false;
+        }
+
+        // A socket file left behind by a daemon that is no longer running
+        // is replaced; a live one is not.
+        struct stat existing;
+        if (lstat(config.socket_path.c_str(), &existing) == 0) {
+            connection probe;
+            std::string ignored;
+            if (!S_ISSOCK(existing.st_mode) ||
+                probe.open(config.socket_path, ignored)) {
+                error = config.socket_path + " is already in use";
+                return false;
+            }
+            unlink(config.socket_path.c_str());
+        }
+
+        listener =
+            socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listener < 0) {
+            error = system_error("socket");
+            return false;
+        }
+        if (bind(listener,
+                 reinterpret_cast<sockaddr const*>(&address),
+                 sizeof(address)) != 0 ||
+            listen(listener, SOMAXCONN) != 0) {
+            error = system_error("bind");
+            ::close(listener);
+            listener = -1;
+            return false;
+        }
+        path = config.socket_path;
+
+        stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (stop_fd < 0) {
+            error = system_error("eventfd");
+            return false;
+        }
+        rules.reset(new registry);
+        const std::size_t pool{std::max<std::size_t>(config.workers, 1)};
+        for (std::size_t idx = 0; idx < pool; ++idx) {
+            workers.emplace_back(new worker(*rules));
+            if (!workers.back()->start(error)) {
+                return false;
+            }
+        }
+        acceptor = std::thread(&daemon::accept_loop, this);
+        return true;
+    }
+
+    void
+    daemon::stop() {
+        if (stop_fd >= 0) {
+            notify(stop_fd);
+        }
+    }
+
+    void
+    daemon::wait() {
+        if (acceptor.joinable()) {
+            acceptor.join();
+        }
+        for (std::unique_ptr<worker>& pool : workers) {
+            pool->stop();
+            pool->join();
+        }
+        workers.clear();
+        rules.reset();
+        if (listener >= 0) {
+            ::close(listener);
+            listener = -1;
+            unlink(path.c_str());
+        }
+        if (stop_fd >= 0) {
+            ::close(stop_fd);
+            stop_fd = -1;
+        }
+    }
+
+    void
+    daemon::accept_loop() {
+        const int epoll{epoll_create1(EPOLL_CLOEXEC)};
+        if (epoll < 0) {
+            return;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = listener;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+        event.data.fd = stop_fd;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, stop_fd, &event);
+
+        std::size_t next = 0;
+        // Out of descriptors, the listener stays readable while accept4
+        // fails, so it is left out of the set for a while instead.
+        bool paused{false};
+        for (bool running = true; running;) {
+            epoll_event events[2];
+            const int count{
+                epoll_wait(epoll, events, 2, paused ? accept_pause : -1)};
+            if (count < 0 && errno != EINTR) {
+                break;
+            }
+            if (count == 0 && paused) {
+                event.data.fd = listener;
+                epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+                paused = false;
+            }
+            for (int idx = 0; idx < count; ++idx) {
+                if (events[idx].data.fd == stop_fd) {
+                    running = false;
+                    continue;
+                }
+                int fd;
+                while ((fd = accept4(
+                            listener,
+                            nullptr,
+                            nullptr,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    workers[next++ % workers.size()]->adopt(fd);
+                }
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+                    errno == ENOMEM) {
+                    epoll_ctl(epoll, EPOLL_CTL_DEL, listener, nullptr);
+                    paused = true;
+                }
+            }
+        }
+        ::close(epoll);
+    }
+
+    connection::~connection() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    bool
+    connection::open(std::string const& socket_path, std::string& error) {
+        sockaddr_un address;
+        if (!make_address(socket_path, address, error)) {
+            return false;
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            error = system_error("socket");
+            return false;
+        }
+        if (connect(fd,
+                    reinterpret_cast<sockaddr const*>(&address),
+                    sizeof(address)) != 0) {
+            error = system_error("connect");
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    bool
+    connection::send(protocol::request code, std::string const& body) {
+        std::string frame;
+        protocol::put_frame(frame, static_cast<std::uint8_t>(code), body);
+        std::size_t written = 0;
+        while (written < frame.size()) {
+            const ssize_t count{::send(
+                fd,
+                frame.data() + written,
+                frame.size() - written,
+                MSG_NOSIGNAL)};
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            written += count;
+        }
+        return true;
+    }
+
+    bool
+    connection::receive(protocol::status& status, std::string& body) {
+        auto read_exact = [this](char* out, std::size_t size) {
+            while (size) {
+                const ssize_t count{recv(fd, out, size, 0)};
+                if (count <= 0) {
+                    if (count < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                out += count;
+                size -= count;
+            }
+            return true;
+        };
+
+        char header[protocol::header_size];
+        if (!read_exact(header, sizeof(header))) {
+            return false;
+        }
+        const std::uint32_t size{protocol::get_u32(header)};
+        if (size == 0 || size > protocol::max_frame) {
+            return false;
+        }
+        status = static_cast<protocol::status>(header[4]);
+        body.resize(size - 1);
+        return read_exact(&body[0], body.size());
+    }
+
+    bool
+    connection::call(
+        protocol::request code,
+        std::string const& body,
+        std::string& response,
+        std::string& error) {
+        protocol::status status;
+        if (!send(code, body) || !receive(status, response)) {
+            error = "connection lost";
+            return false;
+        }
+        if (status != protocol::status::ok) {
+            error = response;
+            return false;
+        }
+        return true;
+    }
+
+    bool
+    connection::register_rule(
+        std::string const& text, std::uint32_t& id, std::string& error) {
+        std::string response;
+        if (!call(protocol::request::register_rule, text, response, error)) {
+            return false;
+        }
+        id = protocol::get_u32(response.data());
+        return true;
+    }
+
+    bool
+    connection::evaluate(
+        std::uint32_t id,
+        std::uint32_t n,
+        std::uint32_t& result,
+        std::string& error) {
+        std::string body;
+        protocol::put_u32(body, id);
+        protocol::put_u32(body, n);
+        std::string response;
+        if (!call(protocol::request::evaluate, body, response, error)) {
+            return false;
+        }
+        result = protocol::get_u32(response.data());
+        return true;
+    }
+
+    bool
+    connection::evaluate_batch(
+        std::uint32_t id,
+        std::vector<std::uint32_t> const& ns,
+        std::vector<std::uint32_t>& results,
+        std::string& error) {
+        std::string body;
+        protocol::put_u32(body, id);
+        for (std::uint32_t n : ns) {
+            protocol::put_u32(body, n);
+        }
+        std::string response;
+        if (!call(protocol::request::evaluate_batch, body, response, error)) {
+            return false;
+        }
+        results.resize(response.size() / 4);
+        for (std::size_t idx = 0; idx < results.size(); ++idx) {
+            results[idx] = protocol::get_u32(response.data() + 4 * idx);
+        }
+        return true;
+    }
+
+} // namespace server
+} // namespace client
@@ -0,0 +1,171 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+#include "stream.hpp"
+
+namespace client {
+namespace stream {
+    namespace {
+        class writer {
+        public:
+            explicit writer(int fd) : fd(fd), buffer(buffer_size) {}
+
+            void
+            put(unsigned int value) {
+                if (buffer.size() - used < 11 && !flush()) {
+                    return;
+                }
+                if (value < 10) {
+                    buffer[used++] = '0' + value;
+                } else {
+                    char digits[10];
+                    std::size_t count = 0;
+                    do {
+                        digits[count++] = '0' + value % 10;
+                        value /= 10;
+                    } while (value);
+                    while (count) {
+                        buffer[used++] = digits[--count];
+                    }
+                }
+                buffer[used++] = '\n';
+            }
+
+            bool
+            flush() {
+                std::size_t written = 0;
+                while (written < used) {
+                    const ssize_t count{
+                        write(fd, buffer.data() + written, used - written)};
+                    if (count < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        failure = errno;
+                        used = 0;
+                        return false;
+                    }
+                    written += count;
+                }
+                used = 0;
+                return !failure;
+            }
+
+            int
+            error() const {
+                return failure;
+            }
+
+        private:
+            int fd;
+            std::vector<char> buffer;
+            std::size_t used = 0;
+            int failure = 0;
+        };
+    } // namespace
+
+    bool
+    evaluate(
+        pluralsparser_rule const* rule, int in, int out, std::string& error) {
+        std::vector<char> input(buffer_size);
+        std::vector<unsigned int> ns;
+        std::vector<unsigned int> results(batch_size);
+        ns.reserve(batch_size);
+        writer output(out);
+
+        auto drain = [&]() {
+            pluralsparser_eval_batch(
+                rule, ns.data(), results.data(), ns.size());
+            for (std::size_t idx = 0; idx < ns.size(); ++idx) {
+                output.put(results[idx]);
+            }
+            ns.clear();
+        };
+        auto fail = [&](std::string const& message) {
+            drain();
+            output.flush();
+            error = message;
+            return false;
+        };
+
+        std::uint64_t value = 0;
+        std::size_t digits = 0;
+        std::size_t line = 1;
+        // The last byte was a carriage return, which must end the line.
+        bool carriage{false};
+        auto malformed = [&]() {
+            return fail(
+                "line " + std::to_string(line) +
+                (carriage ? ": carriage return before the end of the line"
+                          : ": expected an unsigned integer"));
+        };
+        for (;;) {
+            const ssize_t count{read(in, input.data(), input.size())};
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return fail(std::strerror(errno));
+            }
+            if (count == 0) {
+                break;
+            }
+
+            for (char const *iter = input.data(), *end = iter + count;
+                 iter != end;
+                 ++iter) {
+                const unsigned int digit =
+                    static_cast<unsigned char>(*iter) - '0';
+                if (carriage && *iter != '\n') {
+                    return malformed();
+                }
+                if (digit < 10) {
+                    value = value * 10 + digit;
+                    ++digits;
+                    if (value > 0xFFFFFFFF) {
+                        return fail(
+                            "line " + std::to_string(line) +
+                            ": n does not fit in 32 bits");
+                    }
+                } else if (*iter == '\n') {
+                    if (!digits) {
+                        carriage = false;
+                        return malformed();
+                    }
+                    ns.push_back(value);
+                    if (ns.size() == batch_size) {
+                        drain();
+                    }
+                    value = 0;
+                    digits = 0;
+                    carriage = false;
+                    ++line;
+                } else if (*iter == '\r') {
+                    carriage = true;
+                } else {
+                    return malformed();
+                }
+            }
+            if (output.error()) {
+                break;
+            }
+        }
+        if (carriage) {
+            return malformed();
+        }
+        if (digits) {
+            ns.push_back(value);
+        }
+        drain();
+        if (!output.flush()) {
+            error = std::strerror(output.error());
+            return false;
+        }
+        return true;
+    }
+
+} // namespace stream
+} // namespace client